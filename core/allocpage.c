@@ -15,6 +15,7 @@
 #include "device.h"
 #include "compiler.h"
 #include "panic.h"
+#include "atomic.h"
 
 u64 phy_end;
 
@@ -44,11 +45,24 @@ struct memzone {
   u64 start;
   u64 end;
   struct free_chunk chunks[MAX_ORDER+1];
+  u64 nfree_pages;    /* sum of chunks: read without lock */
   spinlock_t lock;
 };
 
 static struct memzone memzone;
 
+/*
+ *  pin count of each page frame.
+ *  free of a pinned page is deferred until the last unpin, so a device can
+ *  dma from a frame the owner has already freed (e.g. zero-copy transmit).
+ */
+#define PIN_FREED   0x80
+#define PIN_COUNT   0x7f
+
+static u8 *pin_table;
+static u64 pin_base;
+static u64 pin_npages;
+
 static inline u64 page_buddy_pfn(u64 pfn, int order) {
   return pfn ^ (1 << order);
 }
@@ -88,6 +102,8 @@ static void *__alloc_pages(struct memzone *z, int order) {
 
     expand(z, p, order, i);
 
+    z->nfree_pages -= 1 << order;
+
     return (void *)p;
   }
 
@@ -113,6 +129,11 @@ void *alloc_pages(int order) {
   return p;
 }
 
+/* number of free pages in memzone: without lock, may be stale by a few */
+u64 nr_free_pages() {
+  return *(volatile u64 *)&memzone.nfree_pages;
+}
+
 static void __free_pages(struct memzone *z, void *pages, int order) {
   struct free_chunk *f = &z->chunks[order];
 
@@ -120,11 +141,36 @@ static void __free_pages(struct memzone *z, void *pages, int order) {
 
   freelist_add(f, pages);
   ((struct header *)pages)->order = order;
+
+  z->nfree_pages += 1 << order;
 }
 
-void free_pages(void *pages, int order) {
+static void free_pages_nopin(void *pages, int order) {
   u64 flags;
 
+  spin_lock_irqsave(&memzone.lock, flags);
+
+  __free_pages(&memzone, pages, order);
+
+  spin_unlock_irqrestore(&memzone.lock, flags);
+}
+
+static u8 *page_pin_ref(void *page) {
+  u64 pfn;
+
+  if(!pin_table)
+    return NULL;
+
+  pfn = (V2P(page) - pin_base) >> PAGESHIFT;
+  if(pfn >= pin_npages)
+    return NULL;
+
+  return &pin_table[pfn];
+}
+
+void free_pages(void *pages, int order) {
+  u8 *ref, old;
+
   if(!pages)
     panic("null free_page");
 
@@ -134,11 +180,63 @@ void free_pages(void *pages, int order) {
   if((u64)pages & ((PAGESIZE << order) - 1))
     panic("alignment %p %d", pages, order);
 
-  spin_lock_irqsave(&memzone.lock, flags);
+  if(order == 0 && (ref = page_pin_ref(pages)) != NULL) {
+    do {
+      old = *(volatile u8 *)ref;
+      if(old & PIN_FREED)
+        panic("double free %p", pages);
+      if(old == 0)
+        break;
+    } while(!atomic_cmpxchg8(ref, old, old | PIN_FREED));
+
+    /* still pinned: freed by the last page_unpin() */
+    if(old)
+      return;
+  }
 
-  __free_pages(&memzone, pages, order);
+  free_pages_nopin(pages, order);
+}
 
-  spin_unlock_irqrestore(&memzone.lock, flags);
+/*
+ *  pin page frame @page not to be freed until page_unpin()
+ *  return false if @page cannot be pinned
+ */
+bool page_pin(void *page) {
+  u8 *ref, old;
+
+  if(!(ref = page_pin_ref(page)))
+    return false;
+
+  do {
+    old = *(volatile u8 *)ref;
+    if(old & PIN_FREED)
+      panic("pin freed page %p", page);
+    if((old & PIN_COUNT) == PIN_COUNT)
+      return false;
+  } while(!atomic_cmpxchg8(ref, old, old + 1));
+
+  return true;
+}
+
+void page_unpin(void *page) {
+  u8 *ref, old, new;
+
+  if(!(ref = page_pin_ref(page)))
+    panic("unpin %p", page);
+
+  do {
+    old = *(volatile u8 *)ref;
+    if(!(old & PIN_COUNT))
+      panic("unpin unpinned page %p", page);
+
+    new = old - 1;
+    if(new == PIN_FREED)
+      new = 0;
+  } while(!atomic_cmpxchg8(ref, old, new));
+
+  /* page was freed while pinned */
+  if(old - 1 == PIN_FREED)
+    free_pages_nopin(page, 0);
 }
 
 static void init_free_pages(struct memzone *z, void *pages, int order) {
@@ -146,6 +244,8 @@ static void init_free_pages(struct memzone *z, void *pages, int order) {
 
   freelist_add(f, pages);
   ((struct header *)pages)->order = order;
+
+  z->nfree_pages += 1 << order;
 }
 
 void buddydump(void) {
@@ -201,6 +301,25 @@ void early_allocator_init() {
   }
 }
 
+static void pin_table_init() {
+  u64 size;
+  int order = 0;
+
+  pin_base = system_memory_base();
+  pin_npages = (system_memory_end() - pin_base) >> PAGESHIFT;
+
+  size = pin_npages * sizeof(*pin_table);
+  while((PAGESIZE << order) < size)
+    order++;
+
+  if(order > MAX_ORDER)
+    panic("pin table: too large memory %p", size);
+
+  pin_table = alloc_pages(order);
+  if(!pin_table)
+    panic("pin table");
+}
+
 void pageallocator_init() {
   struct memblock *mem;
   int nslot = system_memory.nslot;
@@ -221,4 +340,6 @@ void pageallocator_init() {
   }
 
   printf("total %d MB page: %d\n", (PAGESIZE << MAX_ORDER) >> 20, total);
+
+  pin_table_init();
 }
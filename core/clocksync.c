@@ -0,0 +1,311 @@
+/*
+ *  cluster clock synchronization
+ *
+ *  Node0 only timestamps and answers MSG_CLOCK_SYNC.  a round of sub-node
+ *  runs on the cpu which called clocksync_init(): the next exchange is sent
+ *  from the reply callback, the next round from a timer event.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "pcpu.h"
+#include "clocksync.h"
+#include "arch-timer.h"
+#include "localnode.h"
+#include "node.h"
+#include "msg.h"
+#include "printf.h"
+#include "log.h"
+#include "lib.h"
+
+struct clock_sync_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u64 t1;
+};
+
+struct clock_sync_reply_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u64 t1;
+  u64 t2;
+  u64 t3;
+};
+
+struct clock_sample {
+  u64 local;      /* midpoint of t1 and t4 */
+  i64 offset;     /* Node0 - local */
+  u64 delay;
+};
+
+/* cluster = local + offset + drift * (local - ref) */
+struct clock_est {
+  u64 ref;
+  i64 offset;
+  i64 drift;
+};
+
+/*
+ *  written only by the cpu running rounds: readers on other cpus take the
+ *  copy not being written, which is rewritten a round later at the earliest.
+ */
+static struct clock_est est[2];
+static int cur_est;
+
+static struct clock_sample history[CLOCKSYNC_HISTORY];
+static int nhistory;
+static int history_next;
+
+/* round in progress */
+static struct clock_sample best;
+static int nexchange;
+
+static u64 nrounds;
+static u64 nrejected;
+static int reject_streak;
+static u64 residual;
+static bool synced;
+static struct timer_event round_ev;
+
+/* guest counter offset loaded on each cpu */
+static u64 cntvoff[NCPU_MAX];
+static bool cntvoff_loaded[NCPU_MAX];
+
+/* @dx * @drift >> CLOCKSYNC_DRIFT_SHIFT without overflow */
+static i64 drift_apply(i64 dx, i64 drift) {
+  u64 a = dx < 0 ? -dx : dx;
+  i64 r;
+
+  r = (i64)(a >> 32) * drift + (((i64)(a & 0xffffffff) * drift) >> 32);
+
+  return dx < 0 ? -r : r;
+}
+
+u64 local_to_cluster(u64 cycles) {
+  struct clock_est *e = &est[cur_est];
+
+  return cycles + e->offset + drift_apply(cycles - e->ref, e->drift);
+}
+
+u64 cluster_to_local(u64 cycles) {
+  struct clock_est *e = &est[cur_est];
+  u64 local = cycles - e->offset;
+
+  return cycles - e->offset - drift_apply(local - e->ref, e->drift);
+}
+
+u64 cluster_now() {
+  return local_to_cluster(now_cycles());
+}
+
+static inline u64 cycles_to_nsecs(u64 cycles) {
+  return cycles_to_usecs(cycles * 1000);
+}
+
+/* called with a vcpu loaded on this cpu: on entry and at irq exits from guest */
+void clocksync_load_cntvoff() {
+  int cpu = cpuid();
+  u64 v = localnode.bootclk;
+
+  if(cntvoff_loaded[cpu] && cntvoff[cpu] == v)
+    return;
+
+  write_sysreg(cntvoff_el2, v);
+
+  cntvoff[cpu] = v;
+  cntvoff_loaded[cpu] = true;
+}
+
+/* least squares fit of offsets in history, anchored at the newest sample */
+static void clocksync_fit(struct clock_est *e, struct clock_sample *newest) {
+  struct clock_sample *s;
+  i64 sdx = 0, sdy = 0, mdx, mdy, sxx = 0, sxy = 0;
+  i64 drift = 0, dmax;
+  u64 res = 0;
+  int n = nhistory;
+
+  for(s = history; s < &history[n]; s++) {
+    sdx += (i64)(s->local - newest->local);
+    sdy += s->offset - newest->offset;
+  }
+
+  mdx = sdx / n;
+  mdy = sdy / n;
+
+  /* x in units of 2^14 cycles keeps the sums in 64 bit */
+  for(s = history; s < &history[n]; s++) {
+    i64 x = ((i64)(s->local - newest->local) - mdx) >> 14;
+    i64 y = s->offset - newest->offset - mdy;
+
+    sxx += x * x;
+    sxy += x * y;
+  }
+
+  if(sxx) {
+    /* sxy / sxx is per 2^14 cycles: scale by 2^(32 - 14) */
+    drift = (sxy / sxx) << 18;
+    drift += ((sxy % sxx) << 18) / sxx;
+  }
+
+  dmax = ((i64)CLOCKSYNC_DRIFT_MAX_PPM << CLOCKSYNC_DRIFT_SHIFT) / 1000000;
+  if(drift > dmax)
+    drift = dmax;
+  else if(drift < -dmax)
+    drift = -dmax;
+
+  e->ref = newest->local;
+  e->offset = newest->offset + mdy + drift_apply(-mdx, drift);
+  e->drift = drift;
+
+  for(s = history; s < &history[n]; s++) {
+    i64 d = s->offset - (e->offset + drift_apply(s->local - e->ref, drift));
+
+    if((u64)(d < 0 ? -d : d) > res)
+      res = d < 0 ? -d : d;
+  }
+
+  residual = res;
+}
+
+/* a round delayed much more than the others is likely asymmetric */
+static bool clocksync_accept(struct clock_sample *s) {
+  u64 min = ~0ul;
+
+  for(int i = 0; i < nhistory; i++) {
+    if(history[i].delay < min)
+      min = history[i].delay;
+  }
+
+  if(nhistory && s->delay > min * CLOCKSYNC_DELAY_GATE &&
+     reject_streak < CLOCKSYNC_REJECT_MAX) {
+    reject_streak++;
+    nrejected++;
+    return false;
+  }
+
+  reject_streak = 0;
+
+  return true;
+}
+
+static void clocksync_update(struct clock_sample *s) {
+  int next = !cur_est;
+  u64 boot;
+
+  nrounds++;
+
+  if(!clocksync_accept(s))
+    return;
+
+  history[history_next] = *s;
+  history_next = (history_next + 1) % CLOCKSYNC_HISTORY;
+  if(nhistory < CLOCKSYNC_HISTORY)
+    nhistory++;
+
+  clocksync_fit(&est[next], s);
+
+  /* estimate is visible before readers switch to it */
+  dmb(ish);
+
+  cur_est = next;
+
+  /* step guest counter forward only */
+  if(localnode.cluster_bootclk) {
+    boot = cluster_to_local(localnode.cluster_bootclk);
+    if(boot < localnode.bootclk)
+      localnode.bootclk = boot;
+  }
+
+  synced = true;
+}
+
+static void recv_clock_sync_reply(struct msg *reply, void *arg);
+
+static void __subnode send_clock_sync() {
+  struct clock_sync_hdr hdr;
+  struct msg msg;
+
+  msg_init(&msg, 0, MSG_CLOCK_SYNC, &hdr, NULL, 0);
+
+  hdr.t1 = now_cycles();
+
+  send_msg_async(&msg, recv_clock_sync_reply, NULL);
+}
+
+static void recv_clock_sync_reply(struct msg *reply, void *arg) {
+  struct clock_sync_reply_hdr *h = (struct clock_sync_reply_hdr *)reply->hdr;
+  struct clock_sample s;
+  u64 t4 = reply->rxts;
+
+  s.local = h->t1 + (t4 - h->t1) / 2;
+  s.offset = ((i64)(h->t2 - h->t1) + (i64)(h->t3 - t4)) / 2;
+  s.delay = (t4 - h->t1) - (h->t3 - h->t2);
+
+  if(s.delay < best.delay)
+    best = s;
+
+  if(++nexchange < CLOCKSYNC_BURST) {
+    send_clock_sync();
+    return;
+  }
+
+  clocksync_update(&best);
+
+  timer_event_add(&round_ev, now_cycles() + usecs_to_cycles(CLOCKSYNC_INTERVAL_MS * 1000ul));
+}
+
+static void clocksync_round(struct timer_event *ev) {
+  nexchange = 0;
+  best.delay = ~0ul;
+
+  send_clock_sync();
+}
+
+static void __node0 recv_clock_sync_intr(struct msg *msg) {
+  struct clock_sync_hdr *h = (struct clock_sync_hdr *)msg->hdr;
+  struct clock_sync_reply_hdr reply;
+
+  reply.t1 = h->t1;
+  reply.t2 = msg->rxts;
+  reply.t3 = now_cycles();
+
+  msg_reply(msg, MSG_CLOCK_SYNC_REPLY, &reply, NULL, 0);
+}
+
+/* on sub-node: returns after the first round or CLOCKSYNC_INIT_TIMEOUT_US */
+void __subnode clocksync_init() {
+  u64 flags;
+
+  timer_event_init(&round_ev, clocksync_round, NULL);
+
+  irqsave(flags);
+  clocksync_round(&round_ev);
+  irqrestore(flags);
+
+  if(!wait_event_timeout(synced, CLOCKSYNC_INIT_TIMEOUT_US))
+    vmm_warn("clocksync: no reply from Node0, counter left unaligned\n");
+}
+
+void clocksync_dump() {
+  struct clock_est *e = &est[cur_est];
+  i64 off = e->offset + drift_apply(now_cycles() - e->ref, e->drift);
+  struct clock_sample *last;
+
+  if(local_nodeid() == 0) {
+    printf("clocksync: Node0 is the reference clock\n");
+    return;
+  }
+
+  if(!synced) {
+    printf("clocksync: not synchronized\n");
+    return;
+  }
+
+  last = &history[(history_next + CLOCKSYNC_HISTORY - 1) % CLOCKSYNC_HISTORY];
+
+  printf("clocksync: Node%d offset %s%x cycles drift %ld ppb delay %lu ns residual %lu ns"
+         " rounds %lu rejected %lu\n", local_nodeid(), off < 0 ? "-" : "", off < 0 ? -off : off,
+         (e->drift * 1000000000l) >> CLOCKSYNC_DRIFT_SHIFT, cycles_to_nsecs(last->delay),
+         cycles_to_nsecs(residual), nrounds, nrejected);
+}
+
+DEFINE_POCV2_MSG_RECV_NODE0(MSG_CLOCK_SYNC, struct clock_sync_hdr, recv_clock_sync_intr);
+DEFINE_POCV2_MSG(MSG_CLOCK_SYNC_REPLY, struct clock_sync_reply_hdr, NULL);
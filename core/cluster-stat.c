@@ -0,0 +1,370 @@
+/*
+ *  cluster-wide statistics: Node0 merges snapshots of every node
+ *
+ *  a collection sends MSG_STAT_REQUEST to every active sub-node at once and
+ *  completes when all of them replied or CLUSTER_STAT_TIMEOUT_US elapsed;
+ *  nodes which did not reply are left out of the report.  replies of an
+ *  older collection are told apart by generation and dropped.
+ *
+ *  completion is only recorded where it happens (timer irq, reply handler):
+ *  the report is printed by cluster_stat_flush() at the end of irq_entry(),
+ *  out of hard irq and with irqs enabled.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "pcpu.h"
+#include "cluster-stat.h"
+#include "allocpage.h"
+#include "arch-timer.h"
+#include "spinlock.h"
+#include "localnode.h"
+#include "node.h"
+#include "msg.h"
+#include "printf.h"
+#include "log.h"
+#include "panic.h"
+#include "lib.h"
+#include "mm.h"
+
+#define CLUSTER_STAT_TIMEOUT_US   1000000
+
+struct stat_req_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u32 gen;
+};
+
+struct stat_reply_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u32 gen;
+  u32 size;
+};
+
+static const char *vsm_names[NR_VSTAT] = {
+  [VSTAT_READ_FAULT]    "vsm:rfault",
+  [VSTAT_WRITE_FAULT]   "vsm:wfault",
+  [VSTAT_INSTR_FAULT]   "vsm:ifault",
+  [VSTAT_FETCH_IN]      "vsm:fetch_in",
+  [VSTAT_FETCH_OUT]     "vsm:fetch_out",
+  [VSTAT_INV_IN]        "vsm:inv_in",
+  [VSTAT_INV_OUT]       "vsm:inv_out",
+  [VSTAT_LOCKWAIT]      "vsm:lockwait",
+};
+
+static const char *exit_names[NR_VMEXIT] = {
+  [VMEXIT_WFX]          "exit:wfx",
+  [VMEXIT_HVC]          "exit:hvc",
+  [VMEXIT_SMC]          "exit:smc",
+  [VMEXIT_SYSREG]       "exit:sysreg",
+  [VMEXIT_IABORT]       "exit:iabort",
+  [VMEXIT_DABORT]       "exit:dabort",
+  [VMEXIT_IRQ]          "exit:irq",
+};
+
+/* snapshots of the last collection, a page per node */
+static struct node_stat *snaps[NODE_MAX];
+static u64 replied;
+static u64 waiting;
+static u32 generation;
+static bool collecting;
+static bool report_pending;
+static u64 report_missing;
+static spinlock_t cstat_lock = SPINLOCK_INIT;
+static struct timer_event timeout_ev;
+
+#ifdef CLUSTER_STAT_INTERVAL_SEC
+static struct timer_event interval_ev;
+#endif
+
+void node_stat_snapshot(struct node_stat *st) {
+  memset(st, 0, sizeof(*st));
+
+  st->version = CLUSTER_STAT_VERSION;
+  st->nodeid = local_nodeid();
+
+  vsm_stat_total(st->vsm);
+
+  for(int type = 0; type < NUM_MSG; type++)
+    msg_stat_type_total(type, st->msg[type]);
+
+  msg_link_stat_total(&st->link);
+
+  st->free_pages = nr_free_pages();
+
+  for(struct pcpu *c = pcpus; c < &pcpus[NCPU_MAX]; c++) {
+    for(int i = 0; i < NR_VMEXIT; i++)
+      st->exit[i] += c->nexit[i];
+  }
+
+  for(int i = 0; i < NIRQ; i++) {
+    for(int cpu = 0; cpu < NCPU_MAX; cpu++)
+      st->irq[i] += irqlist[i].nhandle[cpu];
+  }
+}
+
+static void cstat_print(u64 *v, const char *name, const char *suffix, int num) {
+  u64 total = 0;
+
+  for(int n = 0; n < nr_cluster_nodes; n++)
+    total += v[n];
+
+  if(!total)
+    return;
+
+  printf("clusterstat: %12lu", total);
+
+  for(int n = 0; n < nr_cluster_nodes; n++) {
+    if(replied & (1ul << n))
+      printf(" %10lu", v[n]);
+    else
+      printf("          -");
+  }
+
+  printf(" %s%s", name, suffix);
+  if(num >= 0)
+    printf("%d", num);
+  printf("\n");
+}
+
+/* a row of @field of snapshots: total and value of every node replied */
+#define cstat_row(field, name, suffix, num)                     \
+  do {                                                          \
+    u64 __v[NODE_MAX];                                          \
+    for(int __n = 0; __n < nr_cluster_nodes; __n++)             \
+      __v[__n] = replied & (1ul << __n) ? snaps[__n]->field : 0;  \
+    cstat_print(__v, name, suffix, num);                        \
+  } while(0)
+
+static void cluster_stat_report(u64 missing) {
+  int n = 0;
+
+  for(u64 m = replied; m; m &= m - 1)
+    n++;
+
+  if(missing)
+    vmm_warn("clusterstat: no reply from nodes %p (mask)\n", missing);
+
+  printf("clusterstat-begin %d %d\n", nr_cluster_nodes, n);
+
+  printf("clusterstat:        total");
+  for(int i = 0; i < nr_cluster_nodes; i++)
+    printf("      node%d", i);
+  printf("\n");
+
+  for(int i = 0; i < NR_VSTAT; i++)
+    cstat_row(vsm[i], vsm_names[i], "", -1);
+
+  for(int type = 0; type < NUM_MSG; type++) {
+    cstat_row(msg[type][MSTAT_SENT], msg_type_name(type), ":sent", -1);
+    cstat_row(msg[type][MSTAT_RECV], msg_type_name(type), ":recv", -1);
+  }
+
+  cstat_row(link.tx, "link:tx", "", -1);
+  cstat_row(link.rx, "link:rx", "", -1);
+  cstat_row(link.rexmit, "link:rexmit", "", -1);
+  cstat_row(link.timeout, "link:timeout", "", -1);
+  cstat_row(link.stall, "link:stall", "", -1);
+
+  cstat_row(free_pages, "mem:free_pages", "", -1);
+
+  for(int i = 0; i < NR_VMEXIT; i++)
+    cstat_row(exit[i], exit_names[i], "", -1);
+
+  for(int i = 0; i < NIRQ; i++)
+    cstat_row(irq[i], "irq:", "", i);
+
+  printf("clusterstat-end\n");
+}
+
+/* on the cpu which started the collection: report is left to cluster_stat_flush() */
+static void cluster_stat_finish(u64 missing) {
+  u64 flags;
+
+  timer_event_del(&timeout_ev);
+
+  spin_lock_irqsave(&cstat_lock, flags);
+  report_missing = missing;
+  report_pending = true;
+  spin_unlock_irqrestore(&cstat_lock, flags);
+}
+
+/*
+ *  print the report of a completed collection
+ *  called at the end of irq_entry() with irqs disabled
+ */
+void cluster_stat_flush() {
+  u64 flags, missing;
+
+  if(!report_pending || in_interrupt() || in_lazyirq())
+    return;
+
+  spin_lock_irqsave(&cstat_lock, flags);
+
+  if(!report_pending) {
+    spin_unlock_irqrestore(&cstat_lock, flags);
+    return;
+  }
+
+  report_pending = false;
+  missing = report_missing;
+
+  spin_unlock_irqrestore(&cstat_lock, flags);
+
+  /* a long report must not hold off irqs */
+  local_irq_enable();
+
+  cluster_stat_report(missing);
+
+  local_irq_disable();
+
+  /* snapshots are free for the next collection */
+  spin_lock_irqsave(&cstat_lock, flags);
+  collecting = false;
+  spin_unlock_irqrestore(&cstat_lock, flags);
+}
+
+static void cluster_stat_timeout(struct timer_event *ev) {
+  u64 flags, missing;
+
+  spin_lock_irqsave(&cstat_lock, flags);
+
+  /* the last reply came just now */
+  if(!(missing = waiting)) {
+    spin_unlock_irqrestore(&cstat_lock, flags);
+    return;
+  }
+
+  waiting = 0;
+  /* replies from now on are stale */
+  generation++;
+
+  spin_unlock_irqrestore(&cstat_lock, flags);
+
+  cluster_stat_finish(missing);
+}
+
+static void recv_stat_reply(struct msg *reply, void *arg) {
+  struct stat_reply_hdr *h = (struct stat_reply_hdr *)reply->hdr;
+  int src = h->hdr.src_id;
+  bool done = false;
+  u64 flags;
+
+  if(h->size != sizeof(struct node_stat) || reply->body_len < h->size ||
+     src >= NODE_MAX) {
+    vmm_warn("clusterstat: broken reply from Node%d\n", src);
+    return;
+  }
+
+  spin_lock_irqsave(&cstat_lock, flags);
+
+  if(collecting && h->gen == generation && (waiting & (1ul << src))) {
+    memcpy(snaps[src], reply->body, sizeof(struct node_stat));
+    replied |= 1ul << src;
+    waiting &= ~(1ul << src);
+    done = !waiting;
+  }
+
+  spin_unlock_irqrestore(&cstat_lock, flags);
+
+  if(done)
+    cluster_stat_finish(0);
+}
+
+/* start a collection: the report is printed when it completes */
+void __node0 cluster_stat_collect() {
+  struct stat_req_hdr hdr;
+  struct msg msg;
+  u64 flags, mask = 0;
+  u32 gen;
+
+  for(int i = 0; i < nr_cluster_nodes; i++) {
+    if(!snaps[i] && !(snaps[i] = alloc_page())) {
+      vmm_warn("clusterstat: no memory\n");
+      return;
+    }
+  }
+
+  spin_lock_irqsave(&cstat_lock, flags);
+
+  if(collecting) {
+    spin_unlock_irqrestore(&cstat_lock, flags);
+    return;
+  }
+
+  for(int i = 1; i < nr_cluster_nodes; i++) {
+    if(node_active(i))
+      mask |= 1ul << i;
+  }
+
+  collecting = true;
+  gen = ++generation;
+  replied = 1;
+  waiting = mask;
+
+  spin_unlock_irqrestore(&cstat_lock, flags);
+
+  node_stat_snapshot(snaps[0]);
+
+  if(!mask) {
+    cluster_stat_finish(0);
+    return;
+  }
+
+  timer_event_init(&timeout_ev, cluster_stat_timeout, NULL);
+  timer_event_add(&timeout_ev, now_cycles() + usecs_to_cycles(CLUSTER_STAT_TIMEOUT_US));
+
+  for(int i = 1; i < nr_cluster_nodes; i++) {
+    if(!(mask & (1ul << i)))
+      continue;
+
+    hdr.gen = gen;
+    msg_init(&msg, i, MSG_STAT_REQUEST, &hdr, NULL, 0);
+
+    send_msg_async(&msg, recv_stat_reply, NULL);
+  }
+}
+
+bool cluster_stat_busy() {
+  return collecting;
+}
+
+static void __subnode recv_stat_request_intr(struct msg *msg) {
+  struct stat_req_hdr *h = (struct stat_req_hdr *)msg->hdr;
+  struct stat_reply_hdr reply;
+  struct node_stat *st;
+
+  st = alloc_page();
+  if(!st)
+    return;
+
+  node_stat_snapshot(st);
+
+  reply.gen = h->gen;
+  reply.size = sizeof(*st);
+
+  msg_reply(msg, MSG_STAT_REPLY, &reply, st, sizeof(*st));
+
+  free_page(st);
+}
+
+#ifdef CLUSTER_STAT_INTERVAL_SEC
+static void cluster_stat_interval(struct timer_event *ev) {
+  cluster_stat_collect();
+
+  timer_event_add(ev, now_cycles() + usecs_to_cycles(CLUSTER_STAT_INTERVAL_SEC * 1000000ul));
+}
+#endif
+
+/* on Node0 */
+void cluster_stat_init() {
+  if(sizeof(struct node_stat) > PAGESIZE)
+    panic("clusterstat: too large snapshot");
+
+#ifdef CLUSTER_STAT_INTERVAL_SEC
+  timer_event_init(&interval_ev, cluster_stat_interval, NULL);
+  timer_event_add(&interval_ev, now_cycles() + usecs_to_cycles(CLUSTER_STAT_INTERVAL_SEC * 1000000ul));
+#endif
+}
+
+DEFINE_POCV2_MSG_RECV_SUBNODE(MSG_STAT_REQUEST, struct stat_req_hdr, recv_stat_request_intr);
+DEFINE_POCV2_MSG(MSG_STAT_REPLY, struct stat_reply_hdr, NULL);
@@ -157,3 +157,133 @@ void fdt_probe(struct fdt *fdt, void *base) {
   fdt->size_dt_struct = fdt_size_dt_struct(base);
   fdt->size_dt_strings = fdt_size_dt_strings(base);
 }
+
+void fdt_writer_init(struct fdt_writer *w, void *struct_buf, u32 struct_size,
+                     char *strings_buf, u32 strings_size) {
+  w->dt_struct = struct_buf;
+  w->struct_len = 0;
+  w->struct_size = struct_size;
+  w->dt_strings = strings_buf;
+  w->strings_len = 0;
+  w->strings_size = strings_size;
+}
+
+static void *fdt_w_grab(struct fdt_writer *w, u32 len) {
+  void *p = (char *)w->dt_struct + w->struct_len;
+
+  len = (len + 4 - 1) & ~(4 - 1);
+
+  if(w->struct_len + len > w->struct_size)
+    panic("fdt writer: struct overflow");
+
+  memset(p, 0, len);
+  w->struct_len += len;
+
+  return p;
+}
+
+static void fdt_w_token(struct fdt_writer *w, u32 token) {
+  fdt32 *t = fdt_w_grab(w, sizeof(fdt32));
+
+  *t = u32_to_fdt32(token);
+}
+
+/* find name in strings block or append it */
+static u32 fdt_w_string(struct fdt_writer *w, const char *name) {
+  u32 off = 0, len = strlen(name) + 1;
+
+  while(off < w->strings_len) {
+    const char *s = w->dt_strings + off;
+
+    if(strcmp(s, name) == 0)
+      return off;
+
+    off += strlen(s) + 1;
+  }
+
+  if(w->strings_len + len > w->strings_size)
+    panic("fdt writer: strings overflow");
+
+  memcpy(w->dt_strings + w->strings_len, name, len);
+  w->strings_len += len;
+
+  return off;
+}
+
+void fdt_w_begin_node(struct fdt_writer *w, const char *name) {
+  u32 len = strlen(name) + 1;
+
+  fdt_w_token(w, FDT_BEGIN_NODE);
+  memcpy(fdt_w_grab(w, len), name, len);
+}
+
+void fdt_w_end_node(struct fdt_writer *w) {
+  fdt_w_token(w, FDT_END_NODE);
+}
+
+void fdt_w_prop(struct fdt_writer *w, const char *name, const void *data, u32 len) {
+  u32 nameoff = fdt_w_string(w, name);
+  struct fdt_property *prop = fdt_w_grab(w, sizeof(*prop));
+
+  prop->tag = u32_to_fdt32(FDT_PROP);
+  prop->len = u32_to_fdt32(len);
+  prop->nameoff = u32_to_fdt32(nameoff);
+
+  if(len)
+    memcpy(fdt_w_grab(w, len), data, len);
+}
+
+void fdt_w_prop_u32(struct fdt_writer *w, const char *name, u32 val) {
+  fdt32 v = u32_to_fdt32(val);
+
+  fdt_w_prop(w, name, &v, sizeof(v));
+}
+
+void fdt_w_prop_string(struct fdt_writer *w, const char *name, const char *str) {
+  fdt_w_prop(w, name, str, strlen(str) + 1);
+}
+
+/*
+ *  assemble header, memory reservation block, struct block and strings block to @out
+ *  return totalsize of fdt
+ */
+u32 fdt_w_finish(struct fdt_writer *w, void *out, u32 outsize, void *rsvmap,
+                 u32 boot_cpuid) {
+  struct fdthdr *hdr = out;
+  struct fdt_reserve_entry *rsv;
+  u32 off_rsvmap, rsvmap_len = 0, off_struct, off_strings, totalsize;
+
+  fdt_w_token(w, FDT_END);
+
+  /* reservation block is terminated by zero entry */
+  for(rsv = rsvmap; rsv && (rsv->address || rsv->size); rsv++)
+    rsvmap_len += sizeof(*rsv);
+  rsvmap_len += sizeof(*rsv);
+
+  off_rsvmap = (sizeof(*hdr) + 8 - 1) & ~(8 - 1);
+  off_struct = off_rsvmap + rsvmap_len;
+  off_strings = off_struct + w->struct_len;
+  totalsize = off_strings + w->strings_len;
+
+  if(totalsize > outsize)
+    panic("fdt writer: too big fdt");
+
+  memset(out, 0, off_struct);
+  if(rsvmap)
+    memcpy((char *)out + off_rsvmap, rsvmap, rsvmap_len);
+  memcpy((char *)out + off_struct, w->dt_struct, w->struct_len);
+  memcpy((char *)out + off_strings, w->dt_strings, w->strings_len);
+
+  hdr->magic = u32_to_fdt32(FDT_MAGIC);
+  hdr->totalsize = u32_to_fdt32(totalsize);
+  hdr->off_dt_struct = u32_to_fdt32(off_struct);
+  hdr->off_dt_strings = u32_to_fdt32(off_strings);
+  hdr->off_mem_rsvmap = u32_to_fdt32(off_rsvmap);
+  hdr->version = u32_to_fdt32(17);
+  hdr->last_comp_version = u32_to_fdt32(16);
+  hdr->boot_cpuid_phys = u32_to_fdt32(boot_cpuid);
+  hdr->size_dt_strings = u32_to_fdt32(w->strings_len);
+  hdr->size_dt_struct = u32_to_fdt32(w->struct_len);
+
+  return totalsize;
+}
@@ -19,6 +19,8 @@
 #include "iomem.h"
 #include "arch-timer.h"
 #include "panic.h"
+#include "msg-engine.h"
+#include "loopback.h"
 
 #define KiB   (1024)
 #define MiB   (1024 * 1024)
@@ -58,6 +60,11 @@ int vmm_init_secondary() {
 
   hcr_setup();
 
+#ifdef MSG_ENGINE_CPU
+  if(cpuid() == MSG_ENGINE_CPU)
+    msg_engine_main();
+#endif
+
   localnode.ctl->startcore();
 
   panic("unreachable");
@@ -96,14 +103,28 @@ int vmm_init_cpu0(void *fdt_phys) {
 
   peripheral_device_init();
 
+#ifdef LOOPBACK_SHM
+  /* nodes share a ram region: it replaces nic as transport */
+  loopback_init(iomap(LOOPBACK_SHM, LOOPBACK_SHM_SIZE), LOOPBACK_PORT);
+#endif
+
   hcr_setup();
 
   msg_sysinit();
 
   nodectl_init();
+#ifdef MSG_ENGINE_CPU
+  /* a vcpu per pcpu except the engine */
+  localvm_init(MSG_ENGINE_CPU, 256 * MiB, &virt_dtb);
+#else
   localvm_init(4, 256 * MiB, &virt_dtb);
+#endif
 
   localnode.ctl->init();
+
+#ifdef MSG_ENGINE_CPU
+  msg_engine_boot();
+#endif
   localnode.ctl->startcore();
 
   panic("unreachable");
@@ -6,6 +6,10 @@
 #include "pcpu.h"
 #include "localnode.h"
 #include "panic.h"
+#include "clocksync.h"
+#include "cluster-stat.h"
+#include "uart.h"
+#include "vsm.h"
 
 struct irq irqlist[NIRQ];
 
@@ -50,6 +54,9 @@ void irq_entry(int from_guest) {
   if(local_irq_enabled())  
     panic("local irq enabled?");
 
+  if(from_guest)
+    mycpu->nexit[VMEXIT_IRQ]++;
+
   irq_enter();
 
   localnode.irqchip->irq_handler(from_guest);
@@ -59,6 +66,19 @@ void irq_entry(int from_guest) {
   if(!msg_queue_empty(&mycpu->recv_waitq) && !in_interrupt() && local_lazyirq_enabled()) {
     do_recv_waitqueue();
   }
+
+  /* cluster statistics completed in irq are printed here */
+  cluster_stat_flush();
+
+  /* swap round kicked in irq */
+  vsm_swap_flush();
+
+  /* console hotkeys typed in irq */
+  uart_flush();
+
+  /* guest counter may have been stepped by clock sync */
+  if(from_guest)
+    clocksync_load_cntvoff();
 }
 
 void irqstats() {
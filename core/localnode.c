@@ -19,8 +19,10 @@ void localvm_initcore() {
 }
 
 void setup_node0_bootclock() {
-  if(current == vcpu0)
+  if(current == vcpu0) {
     localnode.bootclk = now_cycles();
+    localnode.cluster_bootclk = localnode.bootclk;
+  }
 }
 
 void localvm_init(int nvcpu, u64 nalloc, struct guest *guest_fdt) {
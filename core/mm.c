@@ -218,7 +218,7 @@ void dump_par_el1(u64 par) {
 u64 at_hva2pa(u64 hva) {
   u64 tmp = read_sysreg(par_el1);
 
-  asm volatile ("at s1e2r, %0" :: "r"(hva));
+  do_at_trans(hva, "s1e2r");
 
   u64 par = read_sysreg(par_el1);
 
@@ -0,0 +1,129 @@
+/*
+ *  protocol offload engine
+ *
+ *  with MSG_ENGINE_CPU=<n>, pcpu n is reserved for inter node communication
+ *  instead of running a vcpu.  the engine
+ *    - owns transport: rx irq is masked and frames are polled
+ *    - serves remote requests (MSG_SERVICE_CPU is the engine)
+ *    - runs reliable link: frames built by other cpus are passed through
+ *      their submission ring (struct msg_subq) and sent by the engine
+ *  replies are still handed to the waiting cpu via SGI_DO_RECVQ.
+ */
+
+#include "types.h"
+#include "aarch64.h"
+#include "pcpu.h"
+#include "msg.h"
+#include "msg-engine.h"
+#include "net.h"
+#include "transport.h"
+#include "memlayout.h"
+#include "log.h"
+#include "panic.h"
+
+#ifdef MSG_ENGINE_CPU
+
+static struct msg_subq subq[NCPU_MAX];
+
+/* other cpus send by themselves until engine is up */
+static volatile bool engine_running;
+
+void _start(void);
+
+/*
+ *  submit frames of a msg to engine: called with frames built (link and
+ *  ether headers pushed).  return false if engine is not running
+ */
+bool msg_engine_submit(u16 dst_id, u16 type, struct iobuf *buf, enum msg_prio prio,
+                       int flags) {
+  struct msg_subq *q = &subq[cpuid()];
+  struct msg_submission *e;
+  u64 irqflags;
+
+  if(!engine_running)
+    return false;
+
+  /* thread context and irq handlers of this cpu share the ring */
+  irqsave(irqflags);
+
+  /* full: wait for engine, the order of msgs must be kept */
+  while(q->tail - *(volatile u32 *)&q->head == MSG_SUBQ_SIZE)
+    ;
+
+  e = &q->ent[q->tail % MSG_SUBQ_SIZE];
+  e->buf = buf;
+  e->dst_id = dst_id;
+  e->type = type;
+  e->prio = prio;
+  e->flags = flags;
+
+  /* publish entry before tail */
+  dmb(ish);
+  *(volatile u32 *)&q->tail = q->tail + 1;
+
+  irqrestore(irqflags);
+
+  return true;
+}
+
+static int msg_engine_drain(struct msg_subq *q) {
+  u32 tail = *(volatile u32 *)&q->tail;
+  int n = 0;
+
+  /* read entries after tail */
+  dmb(ish);
+
+  while(q->head != tail) {
+    struct msg_submission *e = &q->ent[q->head % MSG_SUBQ_SIZE];
+
+    __msg_output(e->dst_id, e->type, e->buf, e->prio, e->flags);
+
+    /* entry is free to be reused */
+    dmb(ish);
+    *(volatile u32 *)&q->head = q->head + 1;
+    n++;
+  }
+
+  return n;
+}
+
+/* called on cpu0 after cluster is set up */
+void msg_engine_boot() {
+  struct pcpu *cpu = get_cpu(MSG_ENGINE_CPU);
+
+  if(MSG_ENGINE_CPU == 0 || MSG_ENGINE_CPU >= NCPU_MAX || !cpu->online)
+    panic("msg engine: cpu%d unavailable", MSG_ENGINE_CPU);
+
+  if(cpu_boot(cpu, (u64)V2P(_start)) < 0)
+    panic("msg engine: cpu%d boot failed", MSG_ENGINE_CPU);
+
+  while(!engine_running)
+    wfe();
+}
+
+void msg_engine_main() {
+  printf("cpu%d: msg engine start\n", cpuid());
+
+  transport_set_poll_owner(cpuid());
+
+  engine_running = true;
+  dsb(ish);
+  sev();
+
+  for(;;) {
+    local_irq_disable();
+
+    for(int i = 0; i < NCPU_MAX; i++)
+      msg_engine_drain(&subq[i]);
+
+    transport_poll();
+
+    if(!msg_queue_empty(&mycpu->recv_waitq))
+      do_recv_waitqueue();
+
+    /* link timers and SGIs */
+    local_irq_enable();
+  }
+}
+
+#endif  /* MSG_ENGINE_CPU */
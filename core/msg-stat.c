@@ -0,0 +1,220 @@
+/*
+ *  per-type, per-peer msg statistics
+ *
+ *  counters are per cpu and allocated lazily: only the cpu itself updates
+ *  them, without lock or atomic.  it does so both in thread and irq context,
+ *  so irqs are masked around allocation and update.  msg_stat_dump() sums
+ *  them over cpus.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "pcpu.h"
+#include "msg.h"
+#include "msg-stat.h"
+#include "allocpage.h"
+#include "localnode.h"
+#include "arch-timer.h"
+#include "printf.h"
+#include "lib.h"
+#include "mm.h"
+
+/* request types with rtt histogram */
+enum msg_rtt_class {
+  MRTT_FETCH,
+  MRTT_MMIO,
+  MRTT_CPU_WAKEUP,
+  NR_MRTT,
+};
+
+static const enum msgtype rtt_types[NR_MRTT] = {
+  [MRTT_FETCH]        MSG_FETCH,
+  [MRTT_MMIO]         MSG_MMIO_REQUEST,
+  [MRTT_CPU_WAKEUP]   MSG_CPU_WAKEUP,
+};
+
+struct msg_cpu_stat {
+  u64 count[NODE_MAX][NUM_MSG][NR_MSTAT];
+  u32 rtt_hist[NR_MRTT][MSTAT_RTT_BUCKETS];
+};
+
+static struct msg_cpu_stat *mstat[NCPU_MAX];
+
+static inline int rtt_class(int type) {
+  for(int i = 0; i < NR_MRTT; i++) {
+    if(rtt_types[i] == type)
+      return i;
+  }
+
+  return -1;
+}
+
+static inline int rtt_bucket(u64 cycles) {
+  int b = cycles ? 64 - __builtin_clzl(cycles) : 0;
+
+  return b < MSTAT_RTT_BUCKETS ? b : MSTAT_RTT_BUCKETS - 1;
+}
+
+static inline u64 cycles_to_nsecs(u64 cycles) {
+  return cycles_to_usecs(cycles * 1000);
+}
+
+/* must be called with irqs disabled */
+static struct msg_cpu_stat *mystat() {
+  struct msg_cpu_stat *st = mstat[cpuid()];
+
+  if(!st) {
+    st = alloc_pages(msg_body_order(sizeof(*st)));
+    mstat[cpuid()] = st;
+  }
+
+  return st;
+}
+
+static inline u64 *counters(int peer, int type) {
+  struct msg_cpu_stat *st;
+
+  if(peer < 0 || peer >= NODE_MAX || type < 0 || type >= NUM_MSG)
+    return NULL;
+
+  st = mystat();
+
+  return st ? st->count[peer][type] : NULL;
+}
+
+void msg_stat_sent(int peer, int type, u32 bytes) {
+  u64 *c, flags;
+
+  irqsave(flags);
+
+  if((c = counters(peer, type)) != NULL) {
+    c[MSTAT_SENT]++;
+    c[MSTAT_TX_BYTES] += bytes;
+  }
+
+  irqrestore(flags);
+}
+
+void msg_stat_recv(int peer, int type, u32 bytes, u64 queue, u64 handler) {
+  u64 *c, flags;
+
+  irqsave(flags);
+
+  if((c = counters(peer, type)) != NULL) {
+    c[MSTAT_RECV]++;
+    c[MSTAT_RX_BYTES] += bytes;
+    c[MSTAT_QUEUE_CYCLES] += queue;
+    c[MSTAT_HANDLER_CYCLES] += handler;
+  }
+
+  irqrestore(flags);
+}
+
+/* reply of request @type sent to @peer came back in @rtt cycles */
+void msg_stat_rtt(int peer, int type, u64 rtt) {
+  int cls = rtt_class(type);
+  u64 *c, flags;
+
+  irqsave(flags);
+
+  if((c = counters(peer, type)) != NULL) {
+    c[MSTAT_REPLIED]++;
+    c[MSTAT_RTT_CYCLES] += rtt;
+
+    if(cls >= 0)
+      mystat()->rtt_hist[cls][rtt_bucket(rtt)]++;
+  }
+
+  irqrestore(flags);
+}
+
+static void msg_stat_sum(u64 *sum, int peer, int type) {
+  memset(sum, 0, sizeof(u64) * NR_MSTAT);
+
+  for(int cpu = 0; cpu < NCPU_MAX; cpu++) {
+    if(!mstat[cpu])
+      continue;
+
+    for(int i = 0; i < NR_MSTAT; i++)
+      sum[i] += mstat[cpu]->count[peer][type][i];
+  }
+}
+
+/* counters of @type summed over peers: @sum has NR_MSTAT entries */
+void msg_stat_type_total(int type, u64 *sum) {
+  u64 c[NR_MSTAT];
+
+  memset(sum, 0, sizeof(u64) * NR_MSTAT);
+
+  for(int peer = 0; peer < NODE_MAX; peer++) {
+    msg_stat_sum(c, peer, type);
+
+    for(int i = 0; i < NR_MSTAT; i++)
+      sum[i] += c[i];
+  }
+}
+
+static u64 avg_nsecs(u64 cycles, u64 n) {
+  return n ? cycles_to_nsecs(cycles / n) : 0;
+}
+
+static void rtt_hist_dump(int cls) {
+  u64 hist[MSTAT_RTT_BUCKETS];
+  u64 n = 0, acc = 0, p50 = 0, p99 = 0;
+
+  memset(hist, 0, sizeof(hist));
+
+  for(int cpu = 0; cpu < NCPU_MAX; cpu++) {
+    if(!mstat[cpu])
+      continue;
+
+    for(int b = 0; b < MSTAT_RTT_BUCKETS; b++) {
+      hist[b] += mstat[cpu]->rtt_hist[cls][b];
+      n += mstat[cpu]->rtt_hist[cls][b];
+    }
+  }
+
+  if(!n)
+    return;
+
+  /* upper bound of bucket */
+  for(int b = 0; b < MSTAT_RTT_BUCKETS; b++) {
+    acc += hist[b];
+    if(!p50 && acc * 2 >= n)
+      p50 = cycles_to_nsecs(1ul << b);
+    if(!p99 && acc * 100 >= n * 99)
+      p99 = cycles_to_nsecs(1ul << b);
+  }
+
+  printf("msgrtt: %s n %lu p50 < %lu ns p99 < %lu ns\n", msg_type_name(rtt_types[cls]),
+         n, p50, p99);
+
+  for(int b = 0; b < MSTAT_RTT_BUCKETS; b++) {
+    if(hist[b])
+      printf("msgrtt:   < %lu ns %lu\n", cycles_to_nsecs(1ul << b), hist[b]);
+  }
+}
+
+void msg_stat_dump() {
+  u64 c[NR_MSTAT];
+
+  printf("msgstat: node     sent     recv  tx(KiB)  rx(KiB) queue(ns) handler(ns) rtt(ns) type\n");
+
+  for(int peer = 0; peer < NODE_MAX; peer++) {
+    for(int type = 0; type < NUM_MSG; type++) {
+      msg_stat_sum(c, peer, type);
+
+      if(!c[MSTAT_SENT] && !c[MSTAT_RECV])
+        continue;
+
+      printf("msgstat: %4d %8lu %8lu %8lu %8lu %9lu %11lu %7lu %s\n", peer,
+             c[MSTAT_SENT], c[MSTAT_RECV], c[MSTAT_TX_BYTES] >> 10, c[MSTAT_RX_BYTES] >> 10,
+             avg_nsecs(c[MSTAT_QUEUE_CYCLES], c[MSTAT_RECV]),
+             avg_nsecs(c[MSTAT_HANDLER_CYCLES], c[MSTAT_RECV]),
+             avg_nsecs(c[MSTAT_RTT_CYCLES], c[MSTAT_REPLIED]), msg_type_name(type));
+    }
+  }
+
+  for(int cls = 0; cls < NR_MRTT; cls++)
+    rtt_hist_dump(cls);
+}
@@ -11,12 +11,17 @@
 #include "mm.h"
 #include "spinlock.h"
 #include "ethernet.h"
+#include "transport.h"
 #include "msg.h"
+#include "msg-engine.h"
+#include "msg-stat.h"
 #include "lib.h"
 #include "malloc.h"
 #include "panic.h"
 #include "assert.h"
 #include "arch-timer.h"
+#include "param.h"
+#include "atomic.h"
 
 #define USE_SCATTER_GATHER
 
@@ -28,6 +33,10 @@ extern struct msg_handler_data __msg_handler_data_end[];
 
 static struct msg_data msg_data[NUM_MSG];
 
+static struct msg_link links[NODE_MAX];
+
+static struct msg_reasm reasm[NODE_MAX];
+
 static char *msmap[NUM_MSG] = {
   [MSG_NONE]            "msg:none",
   [MSG_INIT]            "msg:init",
@@ -48,8 +57,36 @@ static char *msmap[NUM_MSG] = {
   [MSG_SGI]             "msg:sgi",
   [MSG_PANIC]           "msg:panic",
   [MSG_BOOT_SIG]        "msg:boot_sig",
+  [MSG_REPLICATE]       "msg:replicate",
+  [MSG_REPLICA]         "msg:replica",
+  [MSG_PAGE_PUSH]       "msg:page_push",
+  [MSG_OWNER_QUERY]     "msg:owner_query",
+  [MSG_OWNER_REPLY]     "msg:owner_reply",
+  [MSG_BUNDLE]          "msg:bundle",
+  [MSG_TRACE]           "msg:trace",
+  [MSG_STAT_REQUEST]    "msg:stat_request",
+  [MSG_STAT_REPLY]      "msg:stat_reply",
+  [MSG_CLOCK_SYNC]      "msg:clock_sync",
+  [MSG_CLOCK_SYNC_REPLY] "msg:clock_sync_reply",
+  [MSG_SWAP_RESERVE]    "msg:swap_reserve",
+  [MSG_SWAP_RESERVE_REPLY] "msg:swap_reserve_reply",
+  [MSG_NODE_PING]       "msg:node_ping",
+  [MSG_NODE_PONG]       "msg:node_pong",
+  [MSG_NODE_RTT]        "msg:node_rtt",
+};
+
+struct bundle_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u32 nmsg;
 };
 
+const char *msg_type_name(int type) {
+  if(type < 0 || type >= NUM_MSG || !msmap[type])
+    return "msg:unknown";
+
+  return msmap[type];
+}
+
 static inline u32 msg_hdr_size(struct msg *msg) {
   if(msg->hdr->type < NUM_MSG)
     return msg_data[msg->hdr->type].msg_hdr_size;
@@ -57,58 +94,145 @@ static inline u32 msg_hdr_size(struct msg *msg) {
     panic("msg_hdr_size");
 }
 
+/* small msgs which can wait in tx bundle for MSG_COALESCE_US */
+static inline bool msg_type_coalescable(struct msg *msg) {
+  switch(msg->hdr->type) {
+    case MSG_FETCH:
+    case MSG_INVALIDATE:
+    case MSG_INVALIDATE_ACK:
+    case MSG_INTERRUPT:
+    case MSG_MMIO_REPLY:
+    case MSG_SGI:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* msgs exchanged before node ids are settled go without link seq */
+static inline bool msg_type_is_reliable(u16 type) {
+  switch(type) {
+    case MSG_INIT:
+    case MSG_INIT_ACK:
+    case MSG_CLUSTER_INFO:
+    case MSG_BOOT_SIG:
+    case MSG_PANIC:
+      return false;
+    default:
+      return true;
+  }
+}
+
 static inline bool msg_type_is_reply(struct msg *msg) {
   switch(msg->hdr->type) {
     case MSG_CPU_WAKEUP_ACK:
     case MSG_FETCH_REPLY:
     case MSG_MMIO_REPLY:
+    case MSG_OWNER_REPLY:
+    case MSG_STAT_REPLY:
+    case MSG_CLOCK_SYNC_REPLY:
+    case MSG_SWAP_RESERVE_REPLY:
+    case MSG_NODE_PONG:
       return true;
     default:
       return false;
   }
 }
 
+static enum msg_prio msg_type_prio(u16 type) {
+  switch(type) {
+    case MSG_CPU_WAKEUP_ACK:
+    case MSG_FETCH_REPLY:
+    case MSG_MMIO_REPLY:
+    case MSG_OWNER_REPLY:
+    case MSG_CLOCK_SYNC_REPLY:
+    case MSG_SWAP_RESERVE_REPLY:
+    case MSG_NODE_PONG:
+      return MSG_PRIO_REPLY;
+    case MSG_FETCH:
+    case MSG_MMIO_REQUEST:
+    case MSG_OWNER_QUERY:
+    case MSG_REPLICATE:
+    /*
+     *  manager forwards fetches to the new owner as soon as it pushed the
+     *  page: a push must not be overtaken by them
+     */
+    case MSG_PAGE_PUSH:
+      return MSG_PRIO_REQUEST;
+    case MSG_REPLICA:
+    case MSG_CLUSTER_INFO:
+    case MSG_TRACE:
+    case MSG_STAT_REPLY:
+      return MSG_PRIO_BULK;
+    default:
+      return MSG_PRIO_CONTROL;
+  }
+}
+
 void msg_queue_init(struct msg_queue *q) {
-  q->head = NULL;
-  q->tail = NULL;
-  spinlock_init(&q->lock);
+  for(int i = 0; i < NR_MSG_PRIO; i++) {
+    q->in[i] = NULL;
+    q->head[i] = NULL;
+    q->tail[i] = NULL;
+  }
 }
 
+/* any cpu, any context */
 static void msg_enqueue(struct msg_queue *q, struct msg *msg) {
-  u64 flags;
+  enum msg_prio prio = msg_type_prio(msg->hdr->type);
+  struct msg *top;
 
-  msg->next = NULL;
-
-  spin_lock_irqsave(&q->lock, flags); 
+  do {
+    top = *(struct msg * volatile *)&q->in[prio];
+    msg->next = top;
+  } while(!atomic_cmpxchg64((u64 *)&q->in[prio], (u64)top, (u64)msg));
+}
 
-  if(q->head == NULL)
-    q->head = msg;
+/*
+ *  batch drain: move all msgs pushed so far to consumer side in order of
+ *  arrival.  owner cpu of @q only
+ */
+static void msg_queue_drain(struct msg_queue *q) {
+  for(int i = 0; i < NR_MSG_PRIO; i++) {
+    struct msg *m, *next, *list = NULL, *last;
 
-  if(q->tail)
-    q->tail->next = msg;
+    if(!*(struct msg * volatile *)&q->in[i])
+      continue;
 
-  q->tail = msg;
+    m = (struct msg *)atomic_xchg64((u64 *)&q->in[i], 0);
 
-  spin_unlock_irqrestore(&q->lock, flags); 
-}
+    /* newest first -> oldest first */
+    for(last = m; m; m = next) {
+      next = m->next;
+      m->next = list;
+      list = m;
+    }
 
-static struct msg *msg_dequeue(struct msg_queue *q) {
-  u64 flags;
+    if(q->tail[i])
+      q->tail[i]->next = list;
+    else
+      q->head[i] = list;
 
-  while(msg_queue_empty(q))
-    wfi();
+    q->tail[i] = last;
+  }
+}
 
-  spin_lock_irqsave(&q->lock, flags); 
+/* take drained msg of the highest class: return NULL if none.  owner cpu of @q only */
+static struct msg *msg_queue_pop(struct msg_queue *q) {
+  struct msg *msg;
 
-  struct msg *msg = q->head;
-  q->head = q->head->next;
+  for(int i = 0; i < NR_MSG_PRIO; i++) {
+    if((msg = q->head[i]) != NULL) {
+      q->head[i] = msg->next;
 
-  if(!q->head)
-    q->tail = NULL;
+      if(!q->head[i])
+        q->tail[i] = NULL;
 
-  spin_unlock_irqrestore(&q->lock, flags); 
+      return msg;
+    }
+  }
 
-  return msg;
+  return NULL;
 }
 
 void msg_free(struct msg *msg) {
@@ -118,15 +242,89 @@ void msg_free(struct msg *msg) {
   free(msg);
 }
 
-static void set_reply_buf(struct msg *reply) {
-  assert(!current->reply_buf);
+/*
+ *  outstanding request table
+ *  only the cpu in connection id touches its table: from thread context with
+ *  irq disabled, or from do_recv_waitqueue()
+ */
+static struct msg_request *msg_request_alloc(u32 connid) {
+  struct msg_request_table *t = &mycpu->reqtable;
+  struct msg_request *req;
+  u64 flags;
+
+  assert((connid & 0x7) == cpuid());
+
+  irqsave(flags);
+
+  for(req = t->req; req < &t->req[MSG_REQ_MAX]; req++) {
+    if(!req->inuse) {
+      req->inuse = true;
+      req->async = false;
+      req->done = false;
+      req->connid = connid;
+      req->reply = NULL;
+      req->cb = NULL;
+      req->cb_arg = NULL;
+
+      irqrestore(flags);
+
+      return req;
+    }
+  }
+
+  panic("msg: too many outstanding requests");
+}
+
+static void msg_request_free(struct msg_request *req) {
+  u64 flags;
+
+  irqsave(flags);
+
+  req->inuse = false;
+
+  irqrestore(flags);
+}
+
+static struct msg_request *msg_request_lookup(u32 connid) {
+  struct msg_request_table *t = &mycpu->reqtable;
+  struct msg_request *req;
+
+  for(req = t->req; req < &t->req[MSG_REQ_MAX]; req++) {
+    if(req->inuse && req->connid == connid)
+      return req;
+  }
+
+  return NULL;
+}
+
+/* called from do_recv_waitqueue() */
+static void msg_complete_request(struct msg *reply) {
+  struct msg_request *req = msg_request_lookup(msg_connid(reply));
+
+  if(!req || req->done) {
+    vmm_warn("msg: drop late or duplicate reply %s conid %p from %d\n",
+             msmap[reply->hdr->type], msg_connid(reply), reply->hdr->src_id);
+    msg_free(reply);
+    return;
+  }
+
+  msg_stat_rtt(req->dst_id, req->type, reply->rxts - req->sent);
 
-  current->reply_buf = reply;
+  if(req->async) {
+    req->cb(reply, req->cb_arg);
+
+    msg_free(reply);
+    msg_request_free(req);
+  } else {
+    req->reply = reply;
+    req->done = true;
+  }
 }
 
 void do_recv_waitqueue() {
-  struct msg *m, *m_next, *head;
+  struct msg *m;
   void (*handler)(struct msg *);
+  u64 start;
 
   struct msg_queue *recvq = &mycpu->recv_waitq;
 
@@ -140,196 +338,1336 @@ void do_recv_waitqueue() {
   /* prevent nest handle_recv_waitqueue() */
   lazyirq_enter();
 
-restart:
-  spin_lock(&recvq->lock); 
-
-  head = recvq->head;
-
-  recvq->head = NULL;
-  recvq->tail = NULL;
-
-  spin_unlock(&recvq->lock); 
+  /*
+   *  one msg at a time in order of priority class, so that a reply arriving
+   *  while handling bulk msgs is not queued behind them
+   */
+  for(;;) {
+    /* take all msgs arrived so far at once */
+    msg_queue_drain(recvq);
 
-  local_irq_enable();
+    if((m = msg_queue_pop(recvq)) == NULL)
+      break;
 
-  for(m = head; m; m = m_next) {
     enum msgtype type = m->hdr->type;
-    m_next = m->next;
+    int src = m->hdr->src_id;
+    u64 rxts = m->rxts;
+
+    local_irq_enable();
 
     if(type >= NUM_MSG)
       panic("msg %d", type);
 
+    u32 len = msg_hdr_size(m) + m->body_len;
+
     handler = msg_data[type].recv_handler;
 
+    start = now_cycles();
+
     if(handler) {     // normal msg type
       vmm_log("msg handle %p %s %p\n", m, msmap[type], m->hdr->connectionid);
       handler(m);
 
       msg_free(m);
     } else {          // reply msg type
-      set_reply_buf(m);
+      msg_complete_request(m);
     }
-  }
 
-  local_irq_disable();
+    msg_stat_recv(src, type, len, start - rxts, now_cycles() - start);
 
-  /*
-   *  handle enqueued msg during in this function
-   */
-  if(!msg_queue_empty(recvq))
-    goto restart;
+    local_irq_disable();
+  }
 
   lazyirq_exit();
 }
 
-/* called by hardware rx irq */
-int msg_recv(u8 *src_mac, struct iobuf *buf) {
-  struct msg *msg = malloc(sizeof(*msg));
-  int rc = 0;
-  u32 body_len = 0;
-  void *body = NULL;
+/*
+ *  reliable link per peer node: go-back-N with cumulative ack.
+ *  a frame stays in the window (with its reference) until acked, and is
+ *  retransmitted with all following frames on retransmission timeout.
+ */
 
-  /* Packet 1 */
-  struct msg_header *hdr = buf->data;
-  msg->hdr = hdr;
-  msg->data = buf;
+#define seq_before(a, b)    ((i16)((u16)(a) - (u16)(b)) < 0)
 
-  // printf("msg recv %d %p\n", buf->len);
-  // bin_dump(buf->data, 128);
-  // bin_dump(buf->head, 128);
+static inline struct msg_link_header *frame_link_hdr(struct iobuf *buf) {
+  return (struct msg_link_header *)(buf->eth + 1);
+}
 
-  if(buf->len > 64) {
-    body = buf->data + 50;
-    body_len = buf->len - 54;
-  } else if(buf->body) {
-    body = buf->body;
-    body_len = buf->body_len;
-  }
+/* link header of frame being built (before pushed) */
+static inline struct msg_link_header *frame_link_hdr_tx(struct iobuf *buf) {
+  return (struct msg_link_header *)buf->data - 1;
+}
 
-  /* Packet 2 */
-  if(body) {
-    msg->body_len = body_len;
+/* frame: data points to msg hdr area, with room for link and ether header */
+static struct iobuf *msg_alloc_frame() {
+  struct iobuf *buf = alloc_iobuf_headsize(ETH_POCV2_MSG_HDR_SIZE,
+                         sizeof(struct etherheader) + sizeof(struct msg_link_header));
+  struct msg_link_header *lh = frame_link_hdr_tx(buf);
 
-    msg->body = alloc_page();
-    memcpy(msg->body, body, body_len);
+  memset(lh, 0, sizeof(*lh));
+  lh->src_id = local_nodeid();
 
-    dcache_flush_poc_range(msg->body, body_len);
-  }
+  return buf;
+}
 
-  if(msg_type_is_reply(msg)) {
-    int id = msg_cpu(msg);
-    struct pcpu *cpu = get_cpu(id);
+static inline int link_peer(struct msg_link *link) {
+  return link - links;
+}
 
-    msg_enqueue(&cpu->recv_waitq, msg);
+static u64 link_rto_clamp(u64 rto) {
+  u64 min = usecs_to_cycles(MSG_RTO_MIN_US);
+  u64 max = usecs_to_cycles(MSG_RTO_MAX_US);
 
-    if(cpu != mycpu) {
-      cpu_send_do_recvq_sgi(cpu);
-    }
+  if(rto < min)
+    return min;
+  if(rto > max)
+    return max;
+  return rto;
+}
+
+static void link_rtt_sample(struct msg_link *link, u64 rtt) {
+  if(!link->srtt) {
+    link->srtt = rtt;
+    link->rttvar = rtt / 2;
   } else {
-    msg_enqueue(&mycpu->recv_waitq, msg);
+    u64 err = link->srtt > rtt ? link->srtt - rtt : rtt - link->srtt;
+
+    link->rttvar = (3 * link->rttvar + err) / 4;
+    link->srtt = (7 * link->srtt + rtt) / 8;
   }
 
-  return rc;
+  link->rto = link_rto_clamp(link->srtt + 4 * link->rttvar);
 }
 
-static u32 new_connection(int reqcpu) {
-  static u32 conid = 0;
-  u32 c;
-  u64 flags;
+/*
+ *  credit advertised to a peer: free rx buffers reserved for the peer, or else
+ *  free rx buffers of transport shared by all peers.
+ *  at least 1 so that the peer always makes progress.
+ */
+static u16 link_rx_credit(struct msg_link *link) {
+  int room = transport_rx_room_from(node_macaddr(link_peer(link)));
+  int npeers = nr_cluster_nodes > 1 ? nr_cluster_nodes - 1 : 1;
+  int credit;
 
-  irqsave(flags);
+  if(room >= 0) {
+    credit = room;
+  } else {
+    room = transport_rx_room();
+    if(room < 0)
+      return MSG_LINK_WINDOW;
 
-  c = conid++;
+    credit = room / npeers;
+  }
 
-  irqrestore(flags);
+  if(credit < 1)
+    return 1;
+  if(credit > MSG_LINK_WINDOW)
+    return MSG_LINK_WINDOW;
+  return credit;
+}
 
-  return c << 3 | (reqcpu & 0x7);
+/* must be held link->lock */
+static void link_xmit_frame(struct msg_link *link, struct iobuf *buf) {
+  struct msg_link_header *lh = frame_link_hdr(buf);
+
+  /* piggyback ack and credit (multicast frame is shared by links) */
+  if(!(lh->flags & LINK_MCAST)) {
+    lh->ack = link->rcv_nxt;
+    lh->credit = link_rx_credit(link);
+    lh->flags |= LINK_ACK;
+    link->ack_pending = false;
+  }
+
+  /* reference for transport: dropped in tx completion */
+  iobuf_get(buf);
+
+  transport_xmit(buf);
 }
 
-static inline void __msginitcore(struct msg *msg, u16 dst_id, enum msgtype type,
-                                 struct msg_header *hdr, void *body, int body_len,
-                                 int cid) {
-  assert(msg);
-  assert(hdr);
+/* must be held link->lock */
+static void link_send_ack(struct msg_link *link) {
+  struct iobuf *buf = msg_alloc_frame();
+  struct msg_header *hdr = buf->data;
 
+  memset(hdr, 0, POCV2_MSG_HDR_AREA);
   hdr->src_id = local_nodeid();
-  hdr->type = type;
-  hdr->connectionid = cid;
+  hdr->type = MSG_NONE;
 
-  msg->hdr = hdr;
-  msg->dst_id = dst_id;
-  msg->body = body;
-  msg->body_len = body_len;
+  iobuf_push(buf, sizeof(struct msg_link_header));
+  transport_push_header(node_macaddr(link_peer(link)), POCV2_MSG_ETH_PROTO, buf);
+
+  link_xmit_frame(link, buf);
+  free_iobuf(buf);
+
+  link->stat.ack++;
 }
 
-void __msg_init(struct msg *msg, u16 dst_id, enum msgtype type,
-                struct msg_header *hdr, void *body, int body_len, int reqcpu) {
-  __msginitcore(msg, dst_id, type, hdr, body, body_len, new_connection(reqcpu));
+/*
+ *  timers of link are added on the cpu which armed it and never deleted:
+ *  the handler re-arms itself while needed
+ */
+static void link_arm_rtx(struct msg_link *link) {
+  if(!link->rtx_armed) {
+    link->rtx_armed = true;
+    timer_event_add(&link->rtx_timer, link->rtx_deadline);
+  }
 }
 
-void __msg_reply(struct msg *msg, enum msgtype type,
-                 struct msg_header *hdr, void *body, int body_len) {
-  struct msg reply;
+static void link_arm_delack(struct msg_link *link) {
+  if(!link->delack_armed) {
+    link->delack_armed = true;
+    timer_event_add(&link->delack_timer, now_cycles() + usecs_to_cycles(MSG_DELACK_US));
+  }
+}
 
-  __msginitcore(&reply, msg->hdr->src_id, type, hdr, body, body_len, msg->hdr->connectionid);
+/*
+ *  move frames in backlog into window and send them while the window and
+ *  credit from peer allow: must be held link->lock
+ */
+static void link_push(struct msg_link *link) {
+  struct msg_link_header *lh;
+  struct msg_link_slot *s;
+  struct iobuf *buf;
+  int prio;
+
+  while((u16)(link->snd_nxt - link->snd_una) < MSG_LINK_WINDOW &&
+        seq_before(link->snd_nxt, link->snd_limit)) {
+    /* fragments of a msg go back to back: no other class cuts in */
+    if((prio = link->chain_prio) < 0) {
+      for(prio = 0; prio < NR_MSG_PRIO && !link->backlog[prio]; prio++)
+        ;
+    }
 
-  send_msg(&reply);
+    if(prio == NR_MSG_PRIO || !(buf = link->backlog[prio]))
+      break;
+
+    link->backlog[prio] = buf->next;
+    if(!link->backlog[prio])
+      link->backlog_tail[prio] = NULL;
+    buf->next = NULL;
+
+    lh = frame_link_hdr(buf);
+    if((lh->flags & LINK_FRAG) && lh->frag_off + buf->body_len < lh->frag_total)
+      link->chain_prio = prio;
+    else
+      link->chain_prio = -1;
+
+    s = &link->window[link->snd_nxt % MSG_LINK_WINDOW];
+    s->buf = buf;
+    s->sent = now_cycles();
+    s->rexmit = false;
+
+    frame_link_hdr(buf)->seq = link->snd_nxt++;
+
+    /* window was empty */
+    if((u16)(link->snd_nxt - link->snd_una) == 1)
+      link->rtx_deadline = s->sent + link->rto;
+
+    link_xmit_frame(link, buf);
+    link->stat.tx++;
+
+    link_arm_rtx(link);
+  }
 }
 
-void __send_msg(struct msg *msg, void (*reply_cb)(struct msg *, void *),
-                void *cb_arg, int flags) {
-  u8 *dst_mac;
+/* must be held link->lock */
+static void link_ack(struct msg_link *link, u16 ack, u16 credit) {
+  struct msg_link_slot *s;
+  u64 now = now_cycles();
 
-  if(flags & M_BCAST) {
-    dst_mac = bcast_mac;
-  } else {
-    dst_mac = node_macaddr(msg->dst_id);
+  /* old or bogus ack */
+  if(seq_before(ack, link->snd_una) || seq_before(link->snd_nxt, ack))
+    return;
+
+  link->snd_limit = ack + credit;
+
+  if(ack == link->snd_una) {
+    /* no progress, but credit may have been opened */
+    link_push(link);
+    return;
   }
 
-  struct iobuf *buf = alloc_iobuf_headsize(64, sizeof(struct etherheader));
-  u16 type = POCV2_MSG_ETH_PROTO | (msg->hdr->type << 8);
+  while(link->snd_una != ack) {
+    s = &link->window[link->snd_una % MSG_LINK_WINDOW];
 
-  memcpy((u8 *)buf->data, msg->hdr, msg_hdr_size(msg));
+    /* Karn: no sample from retransmitted frame */
+    if((u16)(link->snd_una + 1) == ack && !s->rexmit)
+      link_rtt_sample(link, now - s->sent);
 
-  if(msg->body) {
-    buf->body = alloc_page();
-    memcpy(buf->body, msg->body, msg->body_len);
-    buf->body_len = msg->body_len;
+    free_iobuf(s->buf);
+    s->buf = NULL;
+
+    link->snd_una++;
   }
 
-  // printf("send msg %s\n", msmap[msg->hdr->type]);
+  link->retries = 0;
+  link->rtx_deadline = now + link->rto;
 
-  ether_send_packet(localnode.nic, dst_mac, type, buf);
+  link_push(link);
+}
 
-  if(reply_cb) {
-    struct msg *reply;
-    int timeout_us = 200000;
-    
-    while((reply = current->reply_buf) == NULL && timeout_us--)
-      usleep(1);
+static void link_rtx_timeout(struct timer_event *ev) {
+  struct msg_link *link = ev->arg;
+  struct msg_link_slot *s;
+  u64 flags, now = now_cycles();
 
-    if(current->reply_buf == NULL)
-      panic("deadlock?");
-    current->reply_buf = NULL;
+  spin_lock_irqsave(&link->lock, flags);
 
-    reply_cb(reply, cb_arg);
+  link->rtx_armed = false;
 
-    msg_free(reply);
+  if(link->snd_una == link->snd_nxt)
+    goto out;
+
+  if(now < link->rtx_deadline) {
+    link_arm_rtx(link);
+    goto out;
+  }
+
+  if(++link->retries > MSG_RETRY_MAX)
+    panic("msg: Node %d not responding", link_peer(link));
+
+  link->stat.timeout++;
+  link->rto = link_rto_clamp(link->rto * 2);
+
+  vmm_warn("msg: retransmit to Node %d seq %d-%d\n", link_peer(link),
+           link->snd_una, (u16)(link->snd_nxt - 1));
+
+  /* go back N */
+  for(u16 seq = link->snd_una; seq != link->snd_nxt; seq++) {
+    s = &link->window[seq % MSG_LINK_WINDOW];
+    s->rexmit = true;
+
+    link_xmit_frame(link, s->buf);
+    link->stat.rexmit++;
   }
+
+  link->rtx_deadline = now + link->rto;
+  link_arm_rtx(link);
+
+out:
+  spin_unlock_irqrestore(&link->lock, flags);
 }
 
-void msg_sysinit() {
-  struct msg_size_data *sd;
-  struct msg_handler_data *hd;
+static void link_delack_timeout(struct timer_event *ev) {
+  struct msg_link *link = ev->arg;
+  u64 flags;
 
-  for(sd = __msg_size_data_start; sd < __msg_size_data_end; sd++) {
-    printf("pocv2-msg found: %s(%d) sizeof %d\n", msmap[sd->type], sd->type, sd->msg_hdr_size);
-    msg_data[sd->type].type = sd->type;
-    msg_data[sd->type].msg_hdr_size = sd->msg_hdr_size;
+  spin_lock_irqsave(&link->lock, flags);
+
+  link->delack_armed = false;
+
+  if(link->ack_pending)
+    link_send_ack(link);
+
+  spin_unlock_irqrestore(&link->lock, flags);
+}
+
+static bool msg_link_backlog_empty(struct msg_link *link) {
+  for(int i = 0; i < NR_MSG_PRIO; i++) {
+    if(link->backlog[i])
+      return false;
   }
 
-  for(hd = __msg_handler_data_start; hd < __msg_handler_data_end; hd++) {
-    printf("pocv2-msg func: %s(%d) %p\n", msmap[hd->type], hd->type, hd->recv_handler);
-    msg_data[hd->type].recv_handler = hd->recv_handler;
+  return true;
+}
+
+/*
+ *  queue frames @buf (link and ether header pushed, chained) to peer @dst_id
+ *  in backlog of class @prio
+ */
+static void msg_link_send(u16 dst_id, struct iobuf *buf, enum msg_prio prio) {
+  struct msg_link *link = &links[dst_id];
+  struct iobuf *tail;
+  u64 flags;
+
+  for(tail = buf; ; tail = tail->next) {
+    frame_link_hdr(tail)->flags |= LINK_SEQ;
+    if(!tail->next)
+      break;
+  }
+
+  spin_lock_irqsave(&link->lock, flags);
+
+  if(link->backlog_tail[prio])
+    link->backlog_tail[prio]->next = buf;
+  else
+    link->backlog[prio] = buf;
+  link->backlog_tail[prio] = tail;
+
+  link_push(link);
+
+  /* wait for credit (or window) locally rather than overrun the peer */
+  if(link->backlog[prio])
+    link->stat.stall++;
+
+  spin_unlock_irqrestore(&link->lock, flags);
+}
+
+/* unicast copy of multicast frame @buf to @dst_id */
+static struct iobuf *msg_frame_clone(struct iobuf *buf, u16 dst_id) {
+  struct iobuf *c = alloc_iobuf(ETH_POCV2_MSG_HDR_SIZE);
+  struct msg_link_header *lh;
+
+  memcpy(c->data, buf->eth, ETH_POCV2_MSG_HDR_SIZE);
+  c->eth = c->data;
+  memcpy(c->eth->dst, node_macaddr(dst_id), 6);
+
+  lh = frame_link_hdr(c);
+  lh->flags &= ~LINK_MCAST;
+  lh->frag_off = lh->frag_total = 0;
+
+  if(buf->body) {
+    c->body = alloc_page();
+    memcpy(c->body, buf->body, buf->body_len);
+    c->body_len = buf->body_len;
+  }
+
+  return c;
+}
+
+/*
+ *  send multicast frame @buf to nodes in @mask: the frame takes a seq in
+ *  link of every member and is retransmitted to the group until acked by all.
+ *  if a link of the group has backlog or no room, unicast copies are queued
+ *  instead to keep the order of frames per link.
+ */
+static void msg_link_send_mcast(u8 mask, struct iobuf *buf, enum msg_prio prio) {
+  struct msg_link_header *lh = frame_link_hdr(buf);
+  struct msg_link *link;
+  bool ready = true;
+  u64 flags;
+  int i;
+
+  lh->flags |= LINK_SEQ | LINK_MCAST;
+
+  irqsave(flags);
+
+  /* in order of node id: no other path holds two links */
+  for(i = 0; i < MSG_MCAST_NODES; i++) {
+    if(!(mask & (1 << i)))
+      continue;
+
+    link = &links[i];
+    spin_lock(&link->lock);
+
+    if(link->chain_prio >= 0 || !msg_link_backlog_empty(link) ||
+       (u16)(link->snd_nxt - link->snd_una) >= MSG_LINK_WINDOW ||
+       !seq_before(link->snd_nxt, link->snd_limit))
+      ready = false;
+  }
+
+  if(ready) {
+    for(i = 0; i < MSG_MCAST_NODES; i++) {
+      struct msg_link_slot *s;
+
+      if(!(mask & (1 << i)))
+        continue;
+
+      link = &links[i];
+      s = &link->window[link->snd_nxt % MSG_LINK_WINDOW];
+      s->buf = iobuf_get(buf);
+      s->sent = now_cycles();
+      s->rexmit = false;
+
+      lh->mcast_seq[i] = link->snd_nxt++;
+
+      if((u16)(link->snd_nxt - link->snd_una) == 1)
+        link->rtx_deadline = s->sent + link->rto;
+
+      link->stat.tx++;
+      link_arm_rtx(link);
+    }
+
+    iobuf_get(buf);
+    transport_xmit(buf);
   }
+
+  for(i = MSG_MCAST_NODES - 1; i >= 0; i--) {
+    if(mask & (1 << i))
+      spin_unlock(&links[i].lock);
+  }
+
+  irqrestore(flags);
+
+  if(!ready) {
+    for(i = 0; i < MSG_MCAST_NODES; i++) {
+      if(mask & (1 << i))
+        msg_link_send(i, msg_frame_clone(buf, i), prio);
+    }
+  }
+
+  free_iobuf(buf);
+}
+
+/*
+ *  true if frames to @nodeid are queued locally for lack of credit or window.
+ *  optional traffic (e.g. prefetch) should back off then.
+ */
+bool msg_peer_congested(int nodeid) {
+  if(nodeid < 0 || nodeid >= NODE_MAX)
+    return false;
+
+  return !msg_link_backlog_empty(&links[nodeid]);
+}
+
+/*
+ *  handle link header of received frame
+ *  return true if the frame should be delivered to msg layer
+ */
+static bool msg_link_recv(struct iobuf *buf) {
+  struct msg_link_header *lh = iobuf_pull(buf, sizeof(*lh));
+  struct msg_link *link;
+  bool accept = false;
+  u64 flags;
+  u16 seq;
+
+  if(!lh)
+    return false;
+
+  /* unreliable frame */
+  if(!(lh->flags & (LINK_SEQ | LINK_ACK)))
+    return true;
+
+  if(lh->src_id >= NODE_MAX)
+    return false;
+
+  if(lh->flags & LINK_MCAST) {
+    if(local_nodeid() >= MSG_MCAST_NODES)
+      return false;
+
+    seq = lh->mcast_seq[local_nodeid()];
+  } else {
+    seq = lh->seq;
+  }
+
+  link = &links[lh->src_id];
+
+  spin_lock_irqsave(&link->lock, flags);
+
+  if(lh->flags & LINK_ACK)
+    link_ack(link, lh->ack, lh->credit);
+
+  if(lh->flags & LINK_SEQ) {
+    if(seq == link->rcv_nxt) {
+      link->rcv_nxt++;
+      link->stat.rx++;
+
+      accept = true;
+
+      link->ack_pending = true;
+      link_arm_delack(link);
+    } else {
+      if(seq_before(seq, link->rcv_nxt))
+        link->stat.dup++;
+      else
+        link->stat.ooo++;
+
+      /* our ack or a frame was lost: tell where we are at once */
+      link_send_ack(link);
+    }
+  }
+
+  spin_unlock_irqrestore(&link->lock, flags);
+
+  return accept;
+}
+
+static void msg_link_init() {
+  for(struct msg_link *link = links; link < &links[NODE_MAX]; link++) {
+    spinlock_init(&link->lock);
+    link->rto = usecs_to_cycles(MSG_RTO_INIT_US);
+    link->snd_limit = MSG_LINK_WINDOW;
+    link->chain_prio = -1;
+
+    timer_event_init(&link->rtx_timer, link_rtx_timeout, link);
+    timer_event_init(&link->delack_timer, link_delack_timeout, link);
+  }
+
+  for(struct msg_reasm *r = reasm; r < &reasm[NODE_MAX]; r++)
+    spinlock_init(&r->lock);
+}
+
+void msg_link_stat_dump() {
+  printf("msglink: node      tx      rx  rexmit timeout     dup     ooo     ack   stall srtt(us) rto(us)\n");
+
+  for(struct msg_link *link = links; link < &links[NODE_MAX]; link++) {
+    struct msg_link_stat *st = &link->stat;
+
+    if(!st->tx && !st->rx)
+      continue;
+
+    printf("msglink: %4d %7d %7d %7d %7d %7d %7d %7d %7d %8d %7d\n",
+           link_peer(link), st->tx, st->rx, st->rexmit, st->timeout, st->dup,
+           st->ooo, st->ack, st->stall, cycles_to_usecs(link->srtt), cycles_to_usecs(link->rto));
+  }
+}
+
+/* counters of all links */
+void msg_link_stat_total(struct msg_link_stat *sum) {
+  memset(sum, 0, sizeof(*sum));
+
+  for(struct msg_link *link = links; link < &links[NODE_MAX]; link++) {
+    sum->tx += link->stat.tx;
+    sum->rx += link->stat.rx;
+    sum->rexmit += link->stat.rexmit;
+    sum->timeout += link->stat.timeout;
+    sum->dup += link->stat.dup;
+    sum->ooo += link->stat.ooo;
+    sum->ack += link->stat.ack;
+    sum->stall += link->stat.stall;
+  }
+}
+
+static inline bool msg_cpu_serving(struct pcpu *cpu) {
+  return cpu->online && cpu->wakeup;
+}
+
+/*
+ *  pick a cpu to serve request @msg about a page: MSG_SERVICE_CPU if
+ *  configured, otherwise hash of ipa over running cpus.
+ *  all requests about one page go to the same cpu, so they are served in
+ *  order of arrival and the page metadata stays in its cache.
+ */
+static int msg_steer_cpu(struct msg *msg) {
+  struct msg_ipa_hdr *h = (struct msg_ipa_hdr *)msg->hdr;
+  u64 key;
+  int n = 0;
+
+  if(MSG_SERVICE_CPU >= 0 && MSG_SERVICE_CPU < NCPU_MAX &&
+     msg_cpu_serving(get_cpu(MSG_SERVICE_CPU)))
+    return MSG_SERVICE_CPU;
+
+  for(int i = 0; i < NCPU_MAX; i++) {
+    if(msg_cpu_serving(get_cpu(i)))
+      n++;
+  }
+
+  if(n <= 1)
+    return cpuid();
+
+  key = h->ipa >> PAGESHIFT;
+  key ^= key >> 9;    /* spread neighbouring pages of a 2 MiB region */
+  key %= n;
+
+  for(int i = 0; i < NCPU_MAX; i++) {
+    if(msg_cpu_serving(get_cpu(i)) && key-- == 0)
+      return i;
+  }
+
+  return cpuid();
+}
+
+/* target cpu of received @msg */
+static int msg_recv_cpu(struct msg *msg) {
+  if(msg_type_is_reply(msg))
+    return msg_cpu(msg);
+
+  switch(msg->hdr->type) {
+    case MSG_FETCH:
+    case MSG_INVALIDATE:
+    case MSG_REPLICATE:
+    case MSG_REPLICA:
+    case MSG_PAGE_PUSH:
+    case MSG_OWNER_QUERY:
+      return msg_steer_cpu(msg);
+    default:
+      return cpuid();
+  }
+}
+
+static void msg_dispatch(struct msg *msg) {
+  struct pcpu *cpu = get_cpu(msg_recv_cpu(msg));
+
+  msg->rxts = now_cycles();
+
+  msg_enqueue(&cpu->recv_waitq, msg);
+
+  if(cpu != mycpu) {
+    cpu_send_do_recvq_sgi(cpu);
+  }
+}
+
+/* unpack msgs in MSG_BUNDLE and dispatch each of them */
+static void msg_unbundle(struct msg *bundle) {
+  struct bundle_hdr *bh = (struct bundle_hdr *)bundle->hdr;
+  struct msg_bundle_rec *rec;
+  u8 *p = bundle->body;
+  u8 *end = p + bundle->body_len;
+
+  for(u32 i = 0; i < bh->nmsg; i++) {
+    struct iobuf *buf;
+    struct msg *msg;
+
+    rec = (struct msg_bundle_rec *)p;
+    if(p + sizeof(*rec) > end || p + sizeof(*rec) + rec->size > end ||
+       rec->size > POCV2_MSG_HDR_AREA) {
+      vmm_warn("msg: broken bundle from %d\n", bh->hdr.src_id);
+      break;
+    }
+
+    /* keep msg hdr 8 byte aligned as in rx buffer of nic */
+    buf = alloc_iobuf_headsize(2 + ETH_POCV2_MSG_HDR_SIZE, 2 + sizeof(struct etherheader));
+    buf->eth = (struct etherheader *)((u8 *)buf->head + 2);
+    memcpy(buf->eth, msg_eth(bundle), sizeof(struct etherheader));
+    memcpy(buf->data, rec + 1, rec->size);
+
+    msg = malloc(sizeof(*msg));
+    msg->hdr = buf->data;
+    msg->data = buf;
+    msg->body = NULL;
+    msg->body_len = 0;
+
+    msg_dispatch(msg);
+
+    p += ALIGN_UP(sizeof(*rec) + rec->size, 8);
+  }
+
+  free_page(bundle->body);
+  msg_free(bundle);
+}
+
+static void msg_reasm_reset(struct msg_reasm *r) {
+  if(r->body)
+    free_pages(r->body, r->order);
+  if(r->msg)
+    msg_free(r->msg);
+
+  r->msg = NULL;
+  r->body = NULL;
+}
+
+/*
+ *  put fragment @msg into reassembly buffer of its source node.
+ *  fragments of a msg arrive back to back and in order (see msg_output()),
+ *  so a gap means a fragment was lost: the whole msg is dropped then.
+ *  return the reassembled msg when the last fragment arrived, or NULL
+ */
+static struct msg *msg_reassemble(struct msg_link_header *lh, struct msg *msg) {
+  u32 off = lh->frag_off, total = lh->frag_total;
+  struct msg *done = NULL;
+  struct msg_reasm *r;
+  u64 flags;
+
+  if(lh->src_id >= NODE_MAX || total > MSG_BODY_MAX || !msg->body ||
+     off + msg->body_len > total) {
+    vmm_warn("msg: broken fragment from %d\n", lh->src_id);
+    goto drop;
+  }
+
+  r = &reasm[lh->src_id];
+
+  spin_lock_irqsave(&r->lock, flags);
+
+  if(off == 0) {
+    if(r->msg) {
+      vmm_warn("msg: incomplete msg from %d dropped\n", lh->src_id);
+      msg_reasm_reset(r);
+    }
+
+    r->order = msg_body_order(total);
+    r->body = alloc_pages(r->order);
+    if(!r->body) {
+      spin_unlock_irqrestore(&r->lock, flags);
+      goto drop;
+    }
+
+    r->msg = msg;
+    r->total = total;
+    r->received = 0;
+  } else if(!r->msg || off != r->received || total != r->total) {
+    vmm_warn("msg: lost fragment from %d\n", lh->src_id);
+    msg_reasm_reset(r);
+    spin_unlock_irqrestore(&r->lock, flags);
+    goto drop;
+  }
+
+  memcpy((u8 *)r->body + off, msg->body, msg->body_len);
+  r->received += msg->body_len;
+
+  free_page(msg->body);
+  msg->body = NULL;
+
+  if(msg != r->msg)
+    msg_free(msg);
+
+  if(r->received == r->total) {
+    done = r->msg;
+    done->body = r->body;
+    done->body_len = r->total;
+
+    r->msg = NULL;
+    r->body = NULL;
+  }
+
+  spin_unlock_irqrestore(&r->lock, flags);
+
+  return done;
+
+drop:
+  if(msg->body)
+    free_page(msg->body);
+  msg_free(msg);
+  return NULL;
+}
+
+/* called by hardware rx irq */
+int msg_recv(u8 *src_mac, struct iobuf *buf) {
+  struct msg_link_header *lh = buf->data;
+  struct msg *msg;
+  int rc = 0;
+
+  /* pure ack, duplicated or out of order frame */
+  if(!msg_link_recv(buf)) {
+    free_iobuf(buf);
+    return 0;
+  }
+
+  msg = malloc(sizeof(*msg));
+
+  /* Packet 1 */
+  struct msg_header *hdr = buf->data;
+  msg->hdr = hdr;
+  msg->data = buf;
+  msg->body = NULL;
+  msg->body_len = 0;
+
+  // printf("msg recv %d %p\n", buf->len);
+  // bin_dump(buf->data, 128);
+  // bin_dump(buf->head, 128);
+
+  /* Packet 2 */
+  if(buf->len > POCV2_MSG_HDR_AREA + 4) {
+    /* body follows header (and fcs) in the same buffer: copy it out to a page */
+    msg->body_len = buf->len - POCV2_MSG_HDR_AREA - 4;
+    msg->body = alloc_page();
+    memcpy(msg->body, buf->data + POCV2_MSG_HDR_AREA, msg->body_len);
+  } else if(buf->body && buf->body_len) {
+    /*
+     *  nic received body into its own page frame: take it without copy.
+     *  receiver may map it into guest as is (e.g. fetch reply).
+     */
+    msg->body = buf->body;
+    msg->body_len = buf->body_len;
+
+    buf->body = NULL;
+  }
+
+  if(msg->body)
+    dcache_flush_poc_range(msg->body, msg->body_len);
+
+  if(lh->flags & LINK_FRAG) {
+    msg = msg_reassemble(lh, msg);
+    if(!msg)
+      return rc;
+  }
+
+  if(hdr->type == MSG_BUNDLE)
+    msg_unbundle(msg);
+  else
+    msg_dispatch(msg);
+
+  return rc;
+}
+
+static u32 new_connection(int reqcpu) {
+  static u32 conid = 0;
+  u32 c;
+  u64 flags;
+
+  irqsave(flags);
+
+  c = conid++;
+
+  irqrestore(flags);
+
+  return c << 3 | (reqcpu & 0x7);
+}
+
+static inline void __msginitcore(struct msg *msg, u16 dst_id, enum msgtype type,
+                                 struct msg_header *hdr, void *body, int body_len,
+                                 int cid) {
+  assert(msg);
+  assert(hdr);
+
+  hdr->src_id = local_nodeid();
+  hdr->type = type;
+  hdr->connectionid = cid;
+
+  msg->hdr = hdr;
+  msg->dst_id = dst_id;
+  msg->body = body;
+  msg->body_len = body_len;
+}
+
+void __msg_init(struct msg *msg, u16 dst_id, enum msgtype type,
+                struct msg_header *hdr, void *body, int body_len, int reqcpu) {
+  __msginitcore(msg, dst_id, type, hdr, body, body_len, new_connection(reqcpu));
+}
+
+void __msg_init_conn(struct msg *msg, u16 dst_id, enum msgtype type,
+                     struct msg_header *hdr, void *body, int body_len, u32 connid) {
+  __msginitcore(msg, dst_id, type, hdr, body, body_len, connid);
+}
+
+void __msg_reply(struct msg *msg, enum msgtype type,
+                 struct msg_header *hdr, void *body, int body_len) {
+  struct msg reply;
+
+  __msginitcore(&reply, msg->hdr->src_id, type, hdr, body, body_len, msg->hdr->connectionid);
+
+  send_msg(&reply);
+}
+
+/* hand frames to link or transport: on the engine if MSG_ENGINE_CPU */
+void __msg_output(u16 dst_id, u16 type, struct iobuf *buf, enum msg_prio prio, int flags) {
+  if(flags & M_MCAST) {
+    msg_link_send_mcast(dst_id, buf, prio);
+    return;
+  }
+
+  if(!(flags & M_BCAST) && msg_type_is_reliable(type)) {
+    msg_link_send(dst_id, buf, prio);
+    return;
+  }
+
+  transport_xmit_batch(buf);
+}
+
+/*
+ *  push link and ether header to frames @buf (chained by buf->next) and send
+ *  them. frames of one call are sent back to back on a reliable link.
+ */
+static void msg_output(u16 dst_id, u16 type, struct iobuf *buf, enum msg_prio prio,
+                       int flags) {
+  u16 ethtype = POCV2_MSG_ETH_PROTO | (type << 8);
+  u8 *dst_mac = flags & M_BCAST ? bcast_mac : node_macaddr(dst_id);
+  u8 mcast_mac[6];
+
+  if(flags & M_MCAST) {
+    msg_mcast_mac(mcast_mac, dst_id);
+    dst_mac = mcast_mac;
+  }
+
+  for(struct iobuf *b = buf; b; b = b->next) {
+    iobuf_push(b, sizeof(struct msg_link_header));
+    transport_push_header(dst_mac, ethtype, b);
+  }
+
+#ifdef MSG_ENGINE_CPU
+  if(cpuid() != MSG_ENGINE_CPU && msg_engine_submit(dst_id, type, buf, prio, flags))
+    return;
+#endif
+
+  __msg_output(dst_id, type, buf, prio, flags);
+}
+
+/* send out msgs held in @b: must be called on the cpu of @b with irq disabled */
+static void msg_bundle_flush(struct msg_bundle *b) {
+  struct bundle_hdr hdr;
+  struct iobuf *buf;
+
+  if(!b->nmsg)
+    return;
+
+  timer_event_del(&b->flush);
+
+  hdr.hdr.src_id = local_nodeid();
+  hdr.hdr.type = MSG_BUNDLE;
+  hdr.hdr.connectionid = new_connection(cpuid());
+  hdr.nmsg = b->nmsg;
+
+  buf = msg_alloc_frame();
+  memcpy(buf->data, &hdr, sizeof(hdr));
+
+  /* pass the page to frame: freed with it */
+  buf->body = b->page;
+  buf->body_len = b->len;
+
+  b->page = NULL;
+  b->len = 0;
+  b->nmsg = 0;
+
+  msg_output(b->dst_id, MSG_BUNDLE, buf, b->prio, 0);
+}
+
+static void msg_bundle_flush_all() {
+  for(int i = 0; i < NODE_MAX; i++)
+    msg_bundle_flush(&mycpu->txbundle[i]);
+}
+
+static void msg_bundle_timeout(struct timer_event *ev) {
+  u64 flags;
+
+  irqsave(flags);
+
+  msg_bundle_flush(ev->arg);
+
+  irqrestore(flags);
+}
+
+/* must be called with irq disabled */
+static bool msg_bundle_add(struct msg_bundle *b, struct msg *msg) {
+  struct msg_bundle_rec *rec;
+  enum msg_prio prio;
+  u32 size = msg_hdr_size(msg);
+  u32 rsize = ALIGN_UP(sizeof(*rec) + size, 8);
+
+  if(b->len + rsize > MSG_BUNDLE_SIZE)
+    msg_bundle_flush(b);
+
+  if(!b->page) {
+    b->page = alloc_page();
+    if(!b->page)
+      return false;
+
+    b->dst_id = msg->dst_id;
+    timer_event_init(&b->flush, msg_bundle_timeout, b);
+  }
+
+  prio = msg_type_prio(msg->hdr->type);
+  if(!b->nmsg || prio < b->prio)
+    b->prio = prio;
+
+  rec = (struct msg_bundle_rec *)((u8 *)b->page + b->len);
+  rec->size = size;
+  memcpy(rec + 1, msg->hdr, size);
+
+  b->len += rsize;
+
+  if(b->nmsg++ == 0)
+    timer_event_add(&b->flush, now_cycles() + usecs_to_cycles(MSG_COALESCE_US));
+
+  return true;
+}
+
+/*
+ *  hold @msg in tx bundle of its destination if possible.
+ *  with M_FLUSH, msgs held already go out together with @msg now.
+ */
+static bool msg_coalesce(struct msg *msg, int flags) {
+  struct msg_bundle *b;
+  bool held = false;
+  u64 irqflags;
+
+  if(flags & M_BCAST || msg->body || !msg_type_coalescable(msg))
+    return false;
+
+  irqsave(irqflags);
+
+  b = &mycpu->txbundle[msg->dst_id];
+
+  /* nothing to piggyback on */
+  if(!(flags & M_FLUSH) || b->nmsg) {
+    held = msg_bundle_add(b, msg);
+
+    if(held && (flags & M_FLUSH))
+      msg_bundle_flush(b);
+  }
+
+  irqrestore(irqflags);
+
+  return held;
+}
+
+/* body size carried by one frame: fits in mtu and in a rx page */
+static u32 msg_frag_size() {
+  int mtu = transport_mtu();
+  int room = mtu - (ETH_POCV2_MSG_HDR_SIZE - sizeof(struct etherheader));
+
+  if(mtu <= 0 || room >= PAGESIZE)
+    return PAGESIZE;
+
+  if(room < 256)
+    panic("msg: too small mtu %d", mtu);
+
+  return room & ~7;
+}
+
+static void msg_frame_set_body(struct iobuf *buf, void *body, u32 len, int flags) {
+  if((flags & M_ZCOPY) && PAGE_ALIGNED(body) && len == PAGESIZE && page_pin(body)) {
+    /*
+     *  zero-copy: nic dmas directly from the page frame.
+     *  the frame is pinned until the iobuf is freed (acked and tx completed),
+     *  so the sender may free it right after send (freed by that path then).
+     *  a retransmission sends the frame again: nobody may write it meanwhile,
+     *  so only a frame the sender unmapped from the guest goes without copy.
+     */
+    buf->body = body;
+    buf->body_pinned = true;
+  } else {
+    buf->body = alloc_page();
+    memcpy(buf->body, body, len);
+  }
+
+  buf->body_len = len;
+}
+
+static void msg_xmit(struct msg *msg, int flags) {
+  u64 irqflags;
+
+  if(flags & M_BCAST) {
+    for(int i = 0; i < nr_cluster_nodes; i++) {
+      if(i != local_nodeid())
+        msg_stat_sent(i, msg->hdr->type, msg_hdr_size(msg) + msg->body_len);
+    }
+  } else {
+    msg_stat_sent(msg->dst_id, msg->hdr->type, msg_hdr_size(msg) + msg->body_len);
+  }
+
+  if(msg_coalesce(msg, flags))
+    return;
+
+  /* msgs held in tx bundle go out first to keep the order */
+  irqsave(irqflags);
+
+  if(flags & M_BCAST)
+    msg_bundle_flush_all();
+  else
+    msg_bundle_flush(&mycpu->txbundle[msg->dst_id]);
+
+  irqrestore(irqflags);
+
+  struct iobuf *head = NULL, **tail = &head;
+  u32 fsize = msg_frag_size();
+  u32 off = 0;
+
+  if(msg->body_len > MSG_BODY_MAX)
+    panic("msg: too large body %s %d", msmap[msg->hdr->type], msg->body_len);
+
+  /* one frame per fragment of body, each with a copy of msg hdr */
+  do {
+    struct iobuf *buf = msg_alloc_frame();
+    u32 len = 0;
+
+    memcpy((u8 *)buf->data, msg->hdr, msg_hdr_size(msg));
+
+    if(msg->body) {
+      len = msg->body_len - off < fsize ? msg->body_len - off : fsize;
+      msg_frame_set_body(buf, (u8 *)msg->body + off, len, flags);
+
+      if(msg->body_len > fsize) {
+        struct msg_link_header *lh = frame_link_hdr_tx(buf);
+
+        lh->flags = LINK_FRAG;
+        lh->frag_off = off;
+        lh->frag_total = msg->body_len;
+      }
+    }
+
+    *tail = buf;
+    tail = &buf->next;
+    off += len;
+  } while(off < msg->body_len);
+
+  // printf("send msg %s\n", msmap[msg->hdr->type]);
+
+  msg_output(msg->dst_id, msg->hdr->type, head, msg_type_prio(msg->hdr->type), flags);
+}
+
+/*
+ *  poll rx ring for reply of @req for @us without waiting for rx irq
+ *  return true if @req is done
+ */
+static bool msg_busy_poll(struct msg_request *req, u64 us) {
+  u64 end = now_cycles() + usecs_to_cycles(us);
+
+  local_irq_disable();
+
+  while(!req->done && now_cycles() < end) {
+    if(transport_poll() < 0)
+      break;
+
+    /* reply received by this cpu is completed here */
+    if(!msg_queue_empty(&mycpu->recv_waitq) && local_lazyirq_enabled())
+      do_recv_waitqueue();
+
+    /* handle SGI_DO_RECVQ and timers */
+    local_irq_enable();
+    local_irq_disable();
+  }
+
+  local_irq_enable();
+
+  return req->done;
+}
+
+/*
+ *  wait for reply of @req and hand it to @cb
+ */
+void msg_wait_reply(struct msg_request *req, void (*cb)(struct msg *, void *),
+                    void *cb_arg) {
+  struct msg *reply;
+
+  assert(!req->async);
+  assert(local_irq_enabled());
+
+  /* reply often comes back within a round trip: poll rx ring meanwhile */
+  if(msg_busy_poll(req, MSG_BUSY_POLL_US))
+    goto done;
+
+  /* woken up by do_recv_waitqueue at irq exit (SGI_DO_RECVQ or rx irq) */
+  if(!wait_event_timeout(req->done, MSG_REPLY_TIMEOUT_US))
+    panic("msg: no reply: conid %p (deadlock?)", req->connid);
+
+done:
+
+  reply = req->reply;
+
+  /* a reply arriving after here is dropped as duplicate */
+  msg_request_free(req);
+
+  if(cb)
+    cb(reply, cb_arg);
+
+  msg_free(reply);
+}
+
+/*
+ *  send request and return its future: caller waits by msg_wait_reply()
+ *  so that several requests can be in flight at once
+ */
+static void msg_request_start(struct msg_request *req, struct msg *msg) {
+  req->type = msg->hdr->type;
+  req->dst_id = msg->dst_id;
+  req->sent = now_cycles();
+}
+
+struct msg_request *send_msg_req(struct msg *msg) {
+  /* register before sending: reply may arrive at once */
+  struct msg_request *req = msg_request_alloc(msg_connid(msg));
+
+  msg_request_start(req, msg);
+
+  /* somebody waits for reply: do not hold it in tx bundle */
+  msg_xmit(msg, M_FLUSH);
+
+  return req;
+}
+
+/*
+ *  send request; @cb is called in receive path when reply arrives
+ */
+void send_msg_async(struct msg *msg, void (*cb)(struct msg *, void *), void *cb_arg) {
+  struct msg_request *req = msg_request_alloc(msg_connid(msg));
+
+  req->async = true;
+  req->cb = cb;
+  req->cb_arg = cb_arg;
+
+  msg_request_start(req, msg);
+
+  msg_xmit(msg, 0);
+}
+
+void __send_msg(struct msg *msg, void (*reply_cb)(struct msg *, void *),
+                void *cb_arg, int flags) {
+  struct msg_request *req;
+
+  if(!reply_cb) {
+    msg_xmit(msg, flags);
+    return;
+  }
+
+  assert(!(flags & M_BCAST));
+
+  req = send_msg_req(msg);
+
+  msg_wait_reply(req, reply_cb, cb_arg);
+}
+
+/*
+ *  send @msg to every node in @nodemask by one frame to their multicast group.
+ *  falls back to unicast if the group cannot be addressed or the body does
+ *  not fit in a frame.
+ */
+void send_msg_mcast(struct msg *msg, u64 nodemask) {
+  struct iobuf *buf;
+  u64 flags;
+  int n;
+
+  nodemask &= ~(1ul << local_nodeid());
+
+  if(nodemask == 0)
+    return;
+
+  if(!transport_has_cap(TRANSPORT_CAP_MCAST) ||
+     (nodemask >> MSG_MCAST_NODES) || !(nodemask & (nodemask - 1)) ||
+     !msg_type_is_reliable(msg->hdr->type) || msg->body_len > msg_frag_size())
+    goto unicast;
+
+  /* msgs held in tx bundles go out first to keep the order */
+  irqsave(flags);
+
+  for(n = 0; n < MSG_MCAST_NODES; n++) {
+    if(nodemask & (1 << n))
+      msg_bundle_flush(&mycpu->txbundle[n]);
+  }
+
+  irqrestore(flags);
+
+  buf = msg_alloc_frame();
+  memcpy((u8 *)buf->data, msg->hdr, msg_hdr_size(msg));
+
+  if(msg->body)
+    msg_frame_set_body(buf, msg->body, msg->body_len, 0);
+
+  for(n = 0; n < MSG_MCAST_NODES; n++) {
+    if(nodemask & (1 << n))
+      msg_stat_sent(n, msg->hdr->type, msg_hdr_size(msg) + msg->body_len);
+  }
+
+  msg_output(nodemask, msg->hdr->type, buf, msg_type_prio(msg->hdr->type), M_MCAST);
+  return;
+
+unicast:
+  for(n = 0; nodemask; n++, nodemask >>= 1) {
+    if(nodemask & 1) {
+      msg->dst_id = n;
+      msg_xmit(msg, 0);
+    }
+  }
+}
+
+/* receive frames to every multicast group including this node */
+void msg_mcast_join() {
+  u8 macs[1 << (MSG_MCAST_NODES - 1)][6];
+  int me = local_nodeid();
+  int n = 0;
+
+  if(me >= MSG_MCAST_NODES)
+    return;
+
+  for(u8 mask = 0; mask < (1 << MSG_MCAST_NODES); mask++) {
+    /* a group of 2 or more nodes */
+    if((mask & (1 << me)) && (mask & (mask - 1)))
+      msg_mcast_mac(macs[n++], mask);
+  }
+
+  if(transport_set_mcast_filter(macs, n) < 0)
+    vmm_warn("msg: %s cannot filter multicast\n", localnode.transport->name);
+}
+
+DEFINE_POCV2_MSG(MSG_BUNDLE, struct bundle_hdr, NULL);
+
+void msg_sysinit() {
+  struct msg_size_data *sd;
+  struct msg_handler_data *hd;
+
+  for(sd = __msg_size_data_start; sd < __msg_size_data_end; sd++) {
+    printf("pocv2-msg found: %s(%d) sizeof %d\n", msmap[sd->type], sd->type, sd->msg_hdr_size);
+    if(sd->msg_hdr_size > POCV2_MSG_HDR_AREA)
+      panic("%s: too large header", msmap[sd->type]);
+
+    msg_data[sd->type].type = sd->type;
+    msg_data[sd->type].msg_hdr_size = sd->msg_hdr_size;
+  }
+
+  for(hd = __msg_handler_data_start; hd < __msg_handler_data_end; hd++) {
+    printf("pocv2-msg func: %s(%d) %p\n", msmap[hd->type], hd->type, hd->recv_handler);
+    msg_data[hd->type].recv_handler = hd->recv_handler;
+  }
+
+  msg_link_init();
+
+  transport_set_recv_callback(msg_recv);
 }
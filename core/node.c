@@ -20,6 +20,8 @@
 #include "panic.h"
 #include "arch-timer.h"
 #include "assert.h"
+#include "numa.h"
+#include "clocksync.h"
 
 static void __node0 broadcast_init_request();
 static void __node0 broadcast_cluster_info();
@@ -29,6 +31,7 @@ static void __subnode init_ack(u8 *node0_mac, int nvcpu, u64 allocated);
 static void __subnode recv_init_request_intr(struct msg *msg);
 static void __subnode send_setup_done_notify(u8 status);
 static void __subnode recv_cluster_info_intr(struct msg *msg);
+static void __node0 measure_cluster_rtt();
 
 static int cluster_node_me_setup();
 
@@ -95,7 +98,7 @@ static inline void wait_for_all_node_ready() {
 /*
  *  Node0 ack Node0(me) or sub-node
  */
-static void __node0 node0_ack_node(u8 *mac, int nvcpus, u64 allocated) {
+static void __node0 node0_ack_node(u8 *mac, int nvcpus, u64 allocated, u32 spare) {
   int nodeid = alloc_nodeid();
   struct cluster_node *c = cluster_node(nodeid);
 
@@ -104,6 +107,8 @@ static void __node0 node0_ack_node(u8 *mac, int nvcpus, u64 allocated) {
   node_set_online(nodeid, true);
 
   c->nodeid = nodeid;
+  c->rtt = 0;
+  c->spare = spare;
   if(mac)
     memcpy(c->mac, mac, 6);
   setup_vsm_memrange(&c->mem, allocated);
@@ -114,7 +119,7 @@ static void __node0 node0_ack_node(u8 *mac, int nvcpus, u64 allocated) {
 
 static void __node0 cluster_node0_init(u8 *mac, int nvcpu, u64 allocated) {
   /* Node0 acked Node0 */
-  node0_ack_node(mac, nvcpu, allocated);
+  node0_ack_node(mac, nvcpu, allocated, vsm_spare_pages(allocated));
 }
 
 /*
@@ -136,6 +141,7 @@ static void __node0 cluster_node0_init(u8 *mac, int nvcpu, u64 allocated) {
  * 2': Node0 collects information about this cluster
  * 3:  broadcast cluster information
  * 4:  sub-node initialization and send done signal
+ * 4': Node0 measures rtt to each sub-node and sends rtt of all nodes
  * 5:  VM is booted! signal
  *
  */
@@ -143,10 +149,10 @@ static void __node0 cluster_node0_init(u8 *mac, int nvcpu, u64 allocated) {
 void __node0 cluster_init() {
   u8 *mac;
 
-  if(localnode.nic) {
-    mac = localnode.nic->mac;
+  if(localnode.transport) {
+    mac = localnode.transport->addr;
   } else {
-    vmm_warn("nic?\n");
+    vmm_warn("transport?\n");
     mac = NULL;
   }
 
@@ -169,6 +175,11 @@ void __node0 cluster_init() {
     panic("node0 setup failed");
 
   wait_for_all_node_ready();
+
+  /* 4'. */
+  measure_cluster_rtt();
+
+  numa_init();
 }
 
 /* 5: called from main/node.c */
@@ -179,6 +190,8 @@ void __node0 broadcast_boot_signal() {
   struct msg msg;
   struct boot_sig_hdr hdr;
 
+  hdr.bootclk = localnode.bootclk;
+
   msg_init(&msg, 0, MSG_BOOT_SIG, &hdr, NULL, 0);
 
   send_msg_bcast(&msg);
@@ -204,6 +217,9 @@ void __subnode subnode_cluster_init() {
   /* sub-node setup */
   int status = cluster_node_me_setup();
 
+  /* align counter with Node0 before the guest boots */
+  clocksync_init();
+
   /* 4. sub-node setup done! */
   send_setup_done_notify(status);
 }
@@ -248,6 +264,8 @@ static int cluster_node_me_setup() {
 
   vcpuid_init(me->vcpus, me->nvcpu);
 
+  msg_mcast_join();
+
   node_set_active(me->nodeid, true);
 
   return 0;
@@ -326,6 +344,7 @@ static void __subnode init_ack(u8 *node0_mac, int nvcpu, u64 allocated) {
 
   hdr.nvcpu = nvcpu;
   hdr.allocated = allocated;
+  hdr.spare = vsm_spare_pages(allocated);
 
   msg_init(&msg, 0, MSG_INIT_ACK, &hdr, NULL, 0);
 
@@ -336,7 +355,7 @@ static void __node0 recv_init_ack_intr(struct msg *msg) {
   struct init_ack_hdr *i = (struct init_ack_hdr *)msg->hdr;
   u8 *src_mac = msg_eth(msg)->src;
 
-  node0_ack_node(src_mac, i->nvcpu, i->allocated);
+  node0_ack_node(src_mac, i->nvcpu, i->allocated, i->spare);
 
   vmm_log("Node 1: %d vcpus %p bytes\n", i->nvcpu, i->allocated);
 }
@@ -355,11 +374,84 @@ static void __node0 recv_sub_setup_done_notify_intr(struct msg *msg) {
   vmm_log("node %d READY!\n", src_nodeid);
 }
 
+static void __node0 recv_node_pong(struct msg *reply, void *arg) {
+  u64 *rtt = arg;
+
+  *rtt = reply->rxts - *rtt;
+}
+
+/*
+ *  sub-node is idle after setup: a ping measures the path alone.
+ *  the smallest of NODE_RTT_SAMPLES saw the least queueing.
+ */
+static u32 __node0 node_ping_rtt(int nodeid) {
+  struct node_ping_hdr hdr;
+  struct msg msg;
+  u64 rtt, min = ~0ul;
+
+  for(int i = 0; i < NODE_RTT_SAMPLES; i++) {
+    msg_init(&msg, nodeid, MSG_NODE_PING, &hdr, NULL, 0);
+
+    rtt = now_cycles();
+
+    send_msg_cb(&msg, recv_node_pong, &rtt);
+
+    if(rtt < min)
+      min = rtt;
+  }
+
+  return min;
+}
+
+static void __node0 measure_cluster_rtt() {
+  static struct node_rtt_body body;
+  struct cluster_node *node;
+  struct node_rtt_hdr hdr;
+  struct msg msg;
+
+  foreach_cluster_node(node) {
+    if(node != cluster_me())
+      node->rtt = node_ping_rtt(node->nodeid);
+
+    body.rtt[node->nodeid] = node->rtt;
+  }
+
+  hdr.nnodes = nr_cluster_nodes;
+
+  foreach_cluster_node(node) {
+    if(node == cluster_me())
+      continue;
+
+    msg_init(&msg, node->nodeid, MSG_NODE_RTT, &hdr, &body, sizeof(body));
+
+    send_msg(&msg);
+  }
+}
+
+static void __subnode recv_node_ping_intr(struct msg *msg) {
+  struct node_ping_hdr pong;
+
+  msg_reply(msg, MSG_NODE_PONG, &pong, NULL, 0);
+}
+
+static void __subnode recv_node_rtt_intr(struct msg *msg) {
+  struct node_rtt_hdr *h = (struct node_rtt_hdr *)msg->hdr;
+  struct node_rtt_body *b = msg->body;
+
+  if(!b)
+    panic("node rtt: no body");
+
+  for(int i = 0; i < h->nnodes; i++)
+    cluster_node(i)->rtt = b->rtt[i];
+
+  numa_init();
+}
+
 static void __subnode recv_init_request_intr(struct msg *msg) {
   u8 *node0_mac = msg_eth(msg)->src;
 
   vmm_log("node0 mac address: %m\n", node0_mac);
-  vmm_log("me mac address: %m\n", localnode.nic->mac);
+  vmm_log("me mac address: %m\n", localnode.transport->addr);
   vmm_log("sub: %d vcpu %p byte RAM\n", localvm.nvcpu, localvm.nalloc);
 
   init_ack(node0_mac, localvm.nvcpu, localvm.nalloc);
@@ -382,9 +474,13 @@ void node_panic_signal(void) {
 }
 
 static void recv_boot_sig_intr(struct msg *msg) {
+  struct boot_sig_hdr *h = (struct boot_sig_hdr *)msg->hdr;
+
   assert(!localnode.bootclk);
 
-  localnode.bootclk = now_cycles();
+  /* not the arrival time: that is late by the one way latency */
+  localnode.cluster_bootclk = h->bootclk;
+  localnode.bootclk = cluster_to_local(h->bootclk);
 }
 
 static void recv_panic_intr(struct msg *msg) {
@@ -403,3 +499,6 @@ DEFINE_POCV2_MSG_RECV_NODE0(MSG_SETUP_DONE, struct setup_done_hdr, recv_sub_setu
 DEFINE_POCV2_MSG_RECV_SUBNODE(MSG_INIT, struct init_req_hdr, recv_init_request_intr);
 DEFINE_POCV2_MSG_RECV_SUBNODE(MSG_CLUSTER_INFO, struct cluster_info_hdr, recv_cluster_info_intr);
 DEFINE_POCV2_MSG_RECV_SUBNODE(MSG_BOOT_SIG, struct boot_sig_hdr, recv_boot_sig_intr);
+DEFINE_POCV2_MSG_RECV_SUBNODE(MSG_NODE_PING, struct node_ping_hdr, recv_node_ping_intr);
+DEFINE_POCV2_MSG(MSG_NODE_PONG, struct node_ping_hdr, NULL);
+DEFINE_POCV2_MSG_RECV_SUBNODE(MSG_NODE_RTT, struct node_rtt_hdr, recv_node_rtt_intr);
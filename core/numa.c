@@ -0,0 +1,316 @@
+/*
+ *  numa topology of the cluster
+ *
+ *  distance between nodes is derived from round trip time measured
+ *  by Node0 with ping after all nodes are set up (see core/node.c).
+ *  Node0 exports the topology to the guest via device tree.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "numa.h"
+#include "node.h"
+#include "fdt.h"
+#include "guest.h"
+#include "allocpage.h"
+#include "printf.h"
+#include "log.h"
+#include "lib.h"
+#include "mm.h"
+
+static u8 distance_map[NODE_MAX][NODE_MAX];
+
+/*
+ *  only rtt between Node0 and each node is known.
+ *  assume that nodes are connected via a switch: rtt(i, j) ~ (rtt(0, i) + rtt(0, j)) / 2
+ */
+static u32 node_rtt(int from, int to) {
+  u32 rf = cluster_node(from)->rtt;
+  u32 rt = cluster_node(to)->rtt;
+
+  if(from == 0)
+    return rt;
+  if(to == 0)
+    return rf;
+
+  return (rf + rt) / 2;
+}
+
+void numa_init() {
+  u32 min_rtt = 0, rtt;
+  int i, j;
+
+  for(i = 0; i < nr_cluster_nodes; i++) {
+    for(j = 0; j < nr_cluster_nodes; j++) {
+      rtt = node_rtt(i, j);
+      if(i != j && rtt && (!min_rtt || rtt < min_rtt))
+        min_rtt = rtt;
+    }
+  }
+
+  /* the nearest remote node is REMOTE_DISTANCE; the others are scaled by rtt */
+  for(i = 0; i < nr_cluster_nodes; i++) {
+    for(j = 0; j < nr_cluster_nodes; j++) {
+      u64 d;
+
+      if(i == j) {
+        d = LOCAL_DISTANCE;
+      } else if(!min_rtt || !(rtt = node_rtt(i, j))) {
+        d = REMOTE_DISTANCE;
+      } else {
+        d = (u64)REMOTE_DISTANCE * rtt / min_rtt;
+        d = min(max(d, REMOTE_DISTANCE), MAX_DISTANCE);
+      }
+
+      distance_map[i][j] = d;
+    }
+  }
+
+  for(i = 0; i < nr_cluster_nodes; i++) {
+    printf("numa: Node %d distance:", i);
+    for(j = 0; j < nr_cluster_nodes; j++)
+      printf(" %d", distance_map[i][j]);
+    printf("\n");
+  }
+}
+
+int node_distance(int from, int to) {
+  if(from == to)
+    return LOCAL_DISTANCE;
+
+  if(from >= nr_cluster_nodes || to >= nr_cluster_nodes || !distance_map[from][to])
+    return REMOTE_DISTANCE;
+
+  return distance_map[from][to];
+}
+
+static char *hexstr(char *buf, u64 x) {
+  char tmp[17];
+  int n = 0;
+
+  do {
+    tmp[n++] = "0123456789abcdef"[x & 0xf];
+  } while(x >>= 4);
+
+  while(n > 0)
+    *buf++ = tmp[--n];
+
+  *buf = '\0';
+
+  return buf;
+}
+
+static fdt32 *put_cells(fdt32 *c, u64 val, int ncells) {
+  if(ncells == 2)
+    *c++ = u32_to_fdt32(val >> 32);
+
+  *c++ = u32_to_fdt32(val & 0xffffffff);
+
+  return c;
+}
+
+static void __node0 numa_fdt_memory_nodes(struct fdt_writer *w, int acells, int scells) {
+  struct cluster_node *node;
+  char name[32];
+  fdt32 reg[4], *c;
+
+  foreach_cluster_node(node) {
+    strcpy(name, "memory@");
+    hexstr(name + 7, node->mem.start);
+
+    c = put_cells(reg, node->mem.start, acells);
+    c = put_cells(c, node->mem.size, scells);
+
+    fdt_w_begin_node(w, name);
+    fdt_w_prop_string(w, "device_type", "memory");
+    fdt_w_prop(w, "reg", reg, (c - reg) * sizeof(fdt32));
+    fdt_w_prop_u32(w, "numa-node-id", node->nodeid);
+    fdt_w_end_node(w);
+  }
+}
+
+static void __node0 numa_fdt_distance_map(struct fdt_writer *w) {
+  int n = nr_cluster_nodes;
+  fdt32 *matrix = alloc_page(), *c = matrix;
+
+  if(!matrix || n * n * 3 * sizeof(fdt32) > PAGESIZE)
+    panic("numa: distance-matrix");
+
+  for(int i = 0; i < n; i++) {
+    for(int j = 0; j < n; j++) {
+      *c++ = u32_to_fdt32(i);
+      *c++ = u32_to_fdt32(j);
+      *c++ = u32_to_fdt32(node_distance(i, j));
+    }
+  }
+
+  fdt_w_begin_node(w, "distance-map");
+  fdt_w_prop_string(w, "compatible", "numa-distance-map-v1");
+  fdt_w_prop(w, "distance-matrix", matrix, (c - matrix) * sizeof(fdt32));
+  fdt_w_end_node(w);
+
+  free_page(matrix);
+}
+
+static int size_order(u64 size) {
+  int order = 0;
+
+  while((PAGESIZE << order) < size)
+    order++;
+
+  return order;
+}
+
+static inline bool strprefix(const char *s, const char *prefix) {
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+#define FDT_MAX_DEPTH   16
+
+/*
+ *  rebuild guest fdt from @img with the topology of the cluster:
+ *    - a memory node per cluster node with numa-node-id
+ *    - numa-node-id in each cpu node
+ *    - distance-map
+ *  memory nodes and distance-map in @img are dropped.
+ */
+struct guest *__node0 numa_guest_fdt(struct guest *img) {
+  static struct guest numa_dtb = {
+    .name = "numa-dtb",
+  };
+  struct fdt fdt;
+  struct fdt_writer w;
+  const char *stack[FDT_MAX_DEPTH];
+  int depth = 0, skip = 0, acells = 2, scells = 2;
+  bool in_cpu = false;
+  u32 cpu_reg = 0, token;
+  fdt32 *cur;
+  char *sbuf, *strings, *out;
+  int sorder, strorder, outorder;
+
+  if(!img)
+    return NULL;
+
+  fdt_probe(&fdt, (void *)img->start);
+
+  sorder = size_order(fdt.size_dt_struct + PAGESIZE);
+  strorder = size_order(fdt.size_dt_strings + 128);
+  outorder = size_order(fdt.size_dt_struct + fdt.size_dt_strings + 2 * PAGESIZE);
+
+  sbuf = alloc_pages(sorder);
+  strings = alloc_pages(strorder);
+  out = alloc_pages(outorder);
+  if(!sbuf || !strings || !out)
+    panic("numa fdt: nomem");
+
+  fdt_writer_init(&w, sbuf, PAGESIZE << sorder, strings, PAGESIZE << strorder);
+
+  cur = (fdt32 *)((char *)fdt.data + fdt.off_dt_struct);
+
+  while((token = fdt32_to_u32(*cur)) != FDT_END) {
+    switch(token) {
+      case FDT_BEGIN_NODE: {
+        struct fdt_node_header *hdr = (struct fdt_node_header *)cur;
+        const char *name = hdr->name;
+
+        cur += 1 + ((strlen(name) + 1 + 4 - 1) >> 2);
+
+        if(skip) {
+          skip++;
+          break;
+        }
+
+        if(depth == 1 && (strprefix(name, "memory") || strcmp(name, "distance-map") == 0)) {
+          skip = 1;
+          break;
+        }
+
+        if(depth >= FDT_MAX_DEPTH)
+          panic("numa fdt: too deep");
+
+        in_cpu = depth == 2 && strcmp(stack[1], "cpus") == 0 && strprefix(name, "cpu@");
+        cpu_reg = 0;
+
+        stack[depth++] = name;
+        fdt_w_begin_node(&w, name);
+        break;
+      }
+
+      case FDT_END_NODE:
+        cur += 1;
+
+        if(skip) {
+          skip--;
+          break;
+        }
+
+        if(in_cpu) {
+          int nodeid = vcpuid_to_nodeid(cpu_reg);
+
+          /* vcpu out of cluster never boots: put it on Node 0 */
+          fdt_w_prop_u32(&w, "numa-node-id", nodeid < 0 ? 0 : nodeid);
+          in_cpu = false;
+        }
+
+        if(depth == 1) {    /* end of root */
+          numa_fdt_memory_nodes(&w, acells, scells);
+          numa_fdt_distance_map(&w);
+        }
+
+        depth--;
+        fdt_w_end_node(&w);
+        break;
+
+      case FDT_PROP: {
+        struct fdt_property *prop = (struct fdt_property *)cur;
+        u32 len = fdt32_to_u32(prop->len);
+        const char *name = (char *)fdt.data + fdt.off_dt_strings +
+                           fdt32_to_u32(prop->nameoff);
+
+        cur += 3 + ((len + 4 - 1) >> 2);
+
+        if(skip)
+          break;
+
+        if(depth == 1) {
+          if(strcmp(name, "#address-cells") == 0)
+            acells = fdt32_to_u32(*(fdt32 *)prop->data);
+          else if(strcmp(name, "#size-cells") == 0)
+            scells = fdt32_to_u32(*(fdt32 *)prop->data);
+        }
+
+        if(in_cpu) {
+          if(strcmp(name, "numa-node-id") == 0)
+            break;
+          if(strcmp(name, "reg") == 0 && len >= sizeof(fdt32))
+            cpu_reg = fdt32_to_u32(((fdt32 *)prop->data)[len / sizeof(fdt32) - 1]);
+        }
+
+        fdt_w_prop(&w, name, prop->data, len);
+        break;
+      }
+
+      case FDT_NOP:
+        cur += 1;
+        break;
+
+      default:
+        panic("numa fdt: parser error %d", token);
+    }
+  }
+
+  if(acells > 2 || scells > 2)
+    panic("numa fdt: #address-cells %d #size-cells %d", acells, scells);
+
+  numa_dtb.start = (u64)out;
+  numa_dtb.size = fdt_w_finish(&w, out, PAGESIZE << outorder,
+                               (char *)fdt.data + fdt_off_mem_rsvmap(fdt.data),
+                               fdt_boot_cpuid_phys(fdt.data));
+
+  free_pages(sbuf, sorder);
+  free_pages(strings, strorder);
+
+  printf("numa fdt: %d nodes, %d byte\n", nr_cluster_nodes, numa_dtb.size);
+
+  return &numa_dtb;
+}
@@ -113,6 +113,7 @@ static int __vprintf(const char *fmt, va_list ap, void (*putc)(char)) {
   void *p;
   int digit = 0;
   enum printopt opt;
+  bool l;
 
   for(; *fmt; fmt++) {
     char c = *fmt;
@@ -120,12 +121,16 @@ static int __vprintf(const char *fmt, va_list ap, void (*putc)(char)) {
       fmt++;
       fmt = fetch_digit(fmt, &digit, &opt);
 
+      /* %ld %lu: 64 bit */
+      if((l = *fmt == 'l'))
+        fmt++;
+
       switch(c = *fmt) {
         case 'd':
-          printiu64(va_arg(ap, i32), 10, true, digit, opt, putc);
+          printiu64(l ? va_arg(ap, i64) : va_arg(ap, i32), 10, true, digit, opt, putc);
           break;
         case 'u':
-          printiu64(va_arg(ap, u32), 10, false, digit, opt, putc);
+          printiu64(l ? va_arg(ap, u64) : va_arg(ap, u32), 10, false, digit, opt, putc);
           break;
         case 'x':
           printiu64(va_arg(ap, u64), 16, false, digit, opt, putc);
@@ -15,6 +15,8 @@
 #include "panic.h"
 #include "tlb.h"
 #include "assert.h"
+#include "vsm.h"
+#include "cache.h"
 
 int s2_root_level;
 u64 *vttbr;
@@ -228,8 +230,7 @@ void s2_page_invalidate(ipa_t ipa) {
 
 void guest_icache_invalidate(void *p, u64 size) {
   // cache_sync_pou_range(p, PAGESIZE);
-  asm volatile("ic ialluis");
-  dsb(ish);
+  icache_flush_all_pou();
   isb();
 }
 
@@ -246,7 +247,19 @@ void s2_page_ro(ipa_t ipa) {
 
 void copy_to_guest(ipa_t to_ipa, char *from, u64 len, bool alloc) {
   while(len > 0) {
-    void *hva = ipa2hva(to_ipa);
+    void *hva;
+
+    if(!alloc && !s2_rwable_pte(PAGE_ADDRESS(to_ipa))) {
+      /* lazy or remote page: fetch it through vsm */
+      char *page = vsm_write_fetch_page(PAGE_ADDRESS(to_ipa));
+      if(!page)
+        panic("copy_to_guest: no page to_ipa: %p", to_ipa);
+
+      hva = page + PAGE_OFFSET(to_ipa);
+    } else {
+      hva = ipa2hva(to_ipa);
+    }
+
     if(hva == 0) {
       if(!alloc)
         panic("copy_to_guest hva == 0 to_ipa: %p", to_ipa);
@@ -0,0 +1,160 @@
+/*
+ *  transport of inter node frames
+ */
+
+#include "types.h"
+#include "transport.h"
+#include "ethernet.h"
+#include "localnode.h"
+#include "msg.h"
+#include "lib.h"
+#include "log.h"
+#include "panic.h"
+
+static u8 zeromac[6] = {0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
+
+static transport_recv_fn recv_fn;
+
+static inline struct transport *local_transport() {
+  struct transport *tp = localnode.transport;
+
+  if(!tp)
+    panic("no transport");
+
+  return tp;
+}
+
+/* the last registered transport is used: backends registered later override */
+void transport_register(struct transport *tp) {
+  if(localnode.transport)
+    printf("transport: %s replaces %s\n", tp->name, localnode.transport->name);
+
+  localnode.transport = tp;
+
+  printf("transport: %s @%m mtu %d\n", tp->name, tp->addr, tp->mtu);
+}
+
+void transport_set_recv_callback(transport_recv_fn fn) {
+  recv_fn = fn;
+}
+
+/* multicast group of msg layer which this node joins */
+static bool transport_mcast_member(u8 *addr) {
+  u8 mask;
+
+  return msg_mcast_group(addr, &mask) && local_nodeid() < MSG_MCAST_NODES &&
+         (mask & (1 << local_nodeid()));
+}
+
+/* frame received by backend @tp: called in interrupt context or by polling */
+void transport_recv(struct transport *tp, struct iobuf *buf) {
+  struct etherheader *eth = iobuf_pull(buf, sizeof(struct etherheader));
+
+  buf->eth = eth;
+
+  vmm_log("%s: recv from %m %p\n", tp->name, eth->src, eth->type);
+
+  if(memcmp(eth->dst, bcast_mac, 6) == 0 || memcmp(eth->dst, tp->addr, 6) == 0 ||
+     transport_mcast_member(eth->dst)) {
+    if((eth->type & 0xff) == 0x19 && recv_fn) {
+      recv_fn(eth->src, buf);
+
+      return;
+    }
+  } else if(memcmp(eth->dst, zeromac, 6) == 0) {
+    panic("packet from hell!");
+  }
+
+  free_iobuf(buf);
+}
+
+void transport_push_header(u8 *dst, u16 type, struct iobuf *buf) {
+  struct etherheader *eth = iobuf_push(buf, sizeof(struct etherheader));
+  if(!eth)
+    panic("eth");
+
+  memcpy(eth->dst, dst, 6);
+  memcpy(eth->src, local_transport()->addr, 6);
+  eth->type = type;
+
+  buf->eth = eth;
+}
+
+/* send a frame @buf: reference of caller is taken */
+void transport_xmit(struct iobuf *buf) {
+  struct transport *tp = local_transport();
+
+  tp->ops->xmit(tp, buf);
+}
+
+/* send frames chained by buf->next */
+void transport_xmit_batch(struct iobuf *buf) {
+  struct transport *tp = local_transport();
+  struct iobuf *next;
+
+  if(tp->ops->xmit_batch) {
+    tp->ops->xmit_batch(tp, buf);
+    return;
+  }
+
+  for(; buf; buf = next) {
+    next = buf->next;
+    buf->next = NULL;
+
+    tp->ops->xmit(tp, buf);
+  }
+}
+
+int transport_rx_room() {
+  struct transport *tp = local_transport();
+
+  if(!tp->ops->rx_room)
+    return -1;
+
+  return tp->ops->rx_room(tp);
+}
+
+int transport_rx_room_from(u8 *src) {
+  struct transport *tp = local_transport();
+
+  if(!tp->ops->rx_room_from)
+    return -1;
+
+  return tp->ops->rx_room_from(tp, src);
+}
+
+/* return number of frames received, or -1 if transport cannot be polled */
+int transport_poll() {
+  struct transport *tp = local_transport();
+
+  if(!(tp->caps & TRANSPORT_CAP_POLL))
+    return -1;
+
+  return tp->ops->poll(tp);
+}
+
+void transport_set_poll_owner(int cpu) {
+  struct transport *tp = local_transport();
+
+  if(!(tp->caps & TRANSPORT_CAP_POLL))
+    panic("transport: %s cannot be polled", tp->name);
+
+  tp->ops->set_poll_owner(tp, cpu);
+}
+
+int transport_set_mcast_filter(u8 (*addrs)[6], int n) {
+  struct transport *tp = local_transport();
+
+  if(!tp->ops->set_mcast_filter)
+    return -1;
+
+  return tp->ops->set_mcast_filter(tp, addrs, n);
+}
+
+int transport_mtu() {
+  return local_transport()->mtu;
+}
+
+bool transport_has_cap(u32 cap) {
+  return !!(local_transport()->caps & cap);
+}
@@ -13,6 +13,8 @@
 #include "s2mm.h"
 #include "vmmio.h"
 #include "vpsci.h"
+#include "vsm-hint.h"
+#include "vsm-trace.h"
 #include "node.h"
 #include "emul.h"
 #include "vsysreg.h"
@@ -111,6 +113,9 @@ static int vm_iabort(struct vcpu *vcpu, u64 esr) {
   if(vcpu->reg.elr == 0)
     panic("? %p %p %p", faultipa, far, vcpu->reg.elr);
 
+  if(vsm_trace_enabled)
+    vsm_trace_fault(vcpu->vcpuid, faultipa, s1ptw ? VTRACE_READ | VTRACE_S1PTW : VTRACE_EXEC);
+
   if(s1ptw) {
     /* fetch pagetable */
     vmm_log("\tiabort fetch pagetable ipa %p %p\n", faultipa, vcpu->reg.elr);
@@ -151,6 +156,11 @@ static int vm_dabort(struct vcpu *vcpu, u64 esr) {
 
   vmm_log("VM DABORT !!!! %p %p elr %p\n", far, fipa_page, vcpu->reg.elr);
 
+  /* mmio is not a dsm fault */
+  if(vsm_trace_enabled && vsm_in_guest_memory(fipa_page))
+    vsm_trace_fault(vcpu->vcpuid, fipa_page,
+                    s1ptw ? VTRACE_READ | VTRACE_S1PTW : wnr ? VTRACE_WRITE : VTRACE_READ);
+
   if(s1ptw) {
     /* fetch pagetable */
     vmm_log("\tdabort fetch pagetable ipa %p %p\n", fipa_page, vcpu->reg.elr);
@@ -241,11 +251,25 @@ static void vpsci_handler(struct vcpu *vcpu) {
   vcpu->reg.x[0] = vpsci_emulate(vcpu, &argv);
 }
 
+static void vsm_hint_handler(struct vcpu *vcpu) {
+  struct vsm_hint_argv argv = {
+    .funcid = (u32)vcpu->reg.x[0],
+    .ipa = vcpu->reg.x[1],
+    .size = vcpu->reg.x[2],
+    .arg = vcpu->reg.x[3],
+  };
+
+  vcpu->reg.x[0] = vsm_hint_emulate(vcpu, &argv);
+}
+
 static int hvc_handler(struct vcpu *vcpu, int imm) {
   switch(imm) {
     case 0:
       vpsci_handler(vcpu);
       return 0;
+    case VSM_HINT_HVC_IMM:
+      vsm_hint_handler(vcpu);
+      return 0;
     default:
       return -1;
   }
@@ -299,23 +323,27 @@ void vm_sync_handler() {
 
   switch(ec) {
     case 0x1:     /* trap WF* */
+      mycpu->nexit[VMEXIT_WFX]++;
       // vmm_log("wf* trapped\n");
       current->reg.elr += 4;
       break;
 
     case 0x16:    /* trap hvc */
+      mycpu->nexit[VMEXIT_HVC]++;
       if(hvc_handler(current, iss) < 0)
         panic("unknown hvc #%d", iss);
 
       break;
 
     case 0x17:    /* trap smc */
+      mycpu->nexit[VMEXIT_SMC]++;
       if(hvc_handler(current, iss) < 0)
         panic("unknown smc #%d", iss);
 
       break;
 
     case 0x18:    /* trap system regsiter */
+      mycpu->nexit[VMEXIT_SYSREG]++;
       if(vsysreg_emulate(current, iss) < 0)
         panic("unknown msr/mrs access %p", iss);
 
@@ -324,6 +352,7 @@ void vm_sync_handler() {
       break;
 
     case 0x20:    /* instruction abort */
+      mycpu->nexit[VMEXIT_IABORT]++;
       if(vm_iabort(current, esr) < 0) {
         iabort_iss_dump(iss);
         panic("iabort");
@@ -333,6 +362,7 @@ void vm_sync_handler() {
 
     case 0x24: {  /* trap EL0/1 data abort */
       int redo;
+      mycpu->nexit[VMEXIT_DABORT]++;
       if((redo = vm_dabort(current, esr)) < 0) {
         dabort_iss_dump(iss);
         panic("unexcepted dabort");
@@ -14,6 +14,7 @@
 #include "arch-timer.h"
 #include "memlayout.h"
 #include "s2mm.h"
+#include "clocksync.h"
 
 struct vcpu *vcpu0;
 
@@ -65,7 +66,7 @@ void vcpu_entry() {
   write_sysreg(vpidr_el2, vpidr);
 
   printf("vmm_boot_clk: %p\n", localnode.bootclk);
-  write_sysreg(cntvoff_el2, localnode.bootclk);
+  clocksync_load_cntvoff();
 
   write_sysreg(vtcr_el2, localvm.vtcr);
 
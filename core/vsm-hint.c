@@ -0,0 +1,111 @@
+/*
+ *  paravirtual vsm hint interface
+ *  a cooperating guest tells placement and coherence of its memory
+ */
+
+#include "types.h"
+#include "vsm-hint.h"
+#include "vsm.h"
+#include "s2mm.h"
+#include "node.h"
+#include "numa.h"
+#include "localnode.h"
+#include "log.h"
+#include "mm.h"
+
+typedef void (*hint_page_fn)(u64 page_ipa, u64 arg);
+
+static void hint_local(u64 page_ipa, u64 __unused arg) {
+  vsm_page_set_flags(page_ipa, PD_LOCAL, PD_MIGRATORY);
+
+  if(!s2_rwable_pte(page_ipa))
+    vsm_write_fetch_page(page_ipa);
+}
+
+static void hint_replicated(u64 page_ipa, u64 __unused arg) {
+  vsm_page_set_flags(page_ipa, 0, PD_LOCAL | PD_MIGRATORY);
+  vsm_replicate_page(page_ipa);
+}
+
+static void hint_migratory(u64 page_ipa, u64 on) {
+  if(on)
+    vsm_page_set_flags(page_ipa, PD_MIGRATORY, PD_LOCAL);
+  else
+    vsm_page_set_flags(page_ipa, 0, PD_MIGRATORY);
+}
+
+static void hint_release(u64 page_ipa, u64 __unused arg) {
+  vsm_page_set_flags(page_ipa, 0, PD_LOCAL);
+  vsm_release_page(page_ipa);
+}
+
+static bool hint_range_valid(struct vsm_hint_argv *argv) {
+  u64 end = argv->ipa + argv->size;
+
+  if(argv->size == 0 || argv->size > VSM_HINT_MAX_RANGE || end < argv->ipa)
+    return false;
+
+  return vsm_in_guest_memory(PAGE_ADDRESS(argv->ipa)) && vsm_in_guest_memory(end - 1);
+}
+
+static i64 hint_range(struct vsm_hint_argv *argv, hint_page_fn fn) {
+  u64 end = argv->ipa + argv->size;
+  u64 p;
+
+  if(!hint_range_valid(argv))
+    return VSM_HINT_INVALID_PARAMS;
+
+  for(p = PAGE_ADDRESS(argv->ipa); p < end; p += PAGESIZE)
+    fn(p, argv->arg);
+
+  return VSM_HINT_SUCCESS;
+}
+
+/* fetches of the range are in flight together */
+static i64 hint_prefetch(struct vsm_hint_argv *argv) {
+  if(!hint_range_valid(argv))
+    return VSM_HINT_INVALID_PARAMS;
+
+  vsm_prefetch_range(argv->ipa, argv->size, !!argv->arg);
+
+  return VSM_HINT_SUCCESS;
+}
+
+static i64 hint_query(struct vcpu *vcpu, struct vsm_hint_argv *argv) {
+  u64 page_ipa = PAGE_ADDRESS(argv->ipa);
+  int owner;
+
+  if(!vsm_in_guest_memory(page_ipa))
+    return VSM_HINT_INVALID_PARAMS;
+
+  owner = vsm_page_owner(page_ipa);
+  if(owner < 0)
+    return VSM_HINT_INVALID_PARAMS;
+
+  vcpu->reg.x[1] = node_distance(local_nodeid(), owner);
+
+  return owner;
+}
+
+i64 vsm_hint_emulate(struct vcpu *vcpu, struct vsm_hint_argv *argv) {
+  vmm_log("vsm hint %d: %p %p %p\n", argv->funcid, argv->ipa, argv->size, argv->arg);
+
+  switch(argv->funcid) {
+    case VSM_HINT_VERSION:
+      return VSM_HINT_VERSION_1_0;
+    case VSM_HINT_PREFETCH:
+      return hint_prefetch(argv);
+    case VSM_HINT_LOCAL:
+      return hint_range(argv, hint_local);
+    case VSM_HINT_REPLICATED:
+      return hint_range(argv, hint_replicated);
+    case VSM_HINT_MIGRATORY:
+      return hint_range(argv, hint_migratory);
+    case VSM_HINT_RELEASE:
+      return hint_range(argv, hint_release);
+    case VSM_HINT_QUERY:
+      return hint_query(vcpu, argv);
+    default:
+      return VSM_HINT_NOT_SUPPORTED;
+  }
+}
@@ -0,0 +1,182 @@
+/*
+ *  per-page access statistics for vsm
+ *
+ *  counters are shared by all cpus and allocated lazily per 2 MiB region of
+ *  guest memory, 64 bytes a page.  they are updated by atomic add, so an irq
+ *  or another cpu may count the same page at the same time.
+ *  vsm_stat_dump() prints them with last owners as a binary snapshot in hex lines:
+ *
+ *    vsmstat-begin <version> <nodeid> <record size>
+ *    <struct vsm_stat_record in hex>
+ *    ...
+ *    vsmstat-end <nrecords>
+ *
+ *  tools/vsmstat.py decodes it.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "pcpu.h"
+#include "vsm-stat.h"
+#include "allocpage.h"
+#include "spinlock.h"
+#include "atomic.h"
+#include "localnode.h"
+#include "printf.h"
+#include "assert.h"
+#include "lib.h"
+#include "mm.h"
+
+#define VSTAT_IPA_BASE        0x40000000
+#define VSTAT_REGION_SIZE     SZ_2MiB
+#define VSTAT_REGION_PAGES    (VSTAT_REGION_SIZE >> PAGESHIFT)
+#define NR_VSTAT_REGIONS      (GVM_MEMORY / VSTAT_REGION_SIZE)
+
+/* 512 * sizeof(struct vsm_page_stat) = 32 KiB */
+#define VSTAT_CHUNK_ORDER     3
+
+static struct vsm_page_stat *pstat[NR_VSTAT_REGIONS];
+static spinlock_t pstat_lock = SPINLOCK_INIT;
+
+/* last owner (+1) of page: updated under page lock, so shared by all cpus */
+static u8 *owner_table[NR_VSTAT_REGIONS];
+static spinlock_t owner_table_lock = SPINLOCK_INIT;
+
+static inline int ipa_to_region(u64 ipa) {
+  return (ipa - VSTAT_IPA_BASE) / VSTAT_REGION_SIZE;
+}
+
+static inline int ipa_to_index(u64 ipa) {
+  return ((ipa - VSTAT_IPA_BASE) % VSTAT_REGION_SIZE) >> PAGESHIFT;
+}
+
+static inline bool vstat_ipa_valid(u64 ipa) {
+  return VSTAT_IPA_BASE <= ipa && ipa < VSTAT_IPA_BASE + GVM_MEMORY;
+}
+
+void vsm_stat_add(u64 ipa, enum vsm_stat_counter c, u64 n) {
+  struct vsm_page_stat *chunk;
+  int region;
+  u64 flags;
+
+  if(!vstat_ipa_valid(ipa))
+    return;
+
+  region = ipa_to_region(ipa);
+
+  chunk = pstat[region];
+  if(!chunk) {
+    spin_lock_irqsave(&pstat_lock, flags);
+
+    if(!(chunk = pstat[region]))
+      chunk = pstat[region] = alloc_pages(VSTAT_CHUNK_ORDER);
+
+    spin_unlock_irqrestore(&pstat_lock, flags);
+
+    if(!chunk)
+      return;
+  }
+
+  atomic_fetch_add64(&chunk[ipa_to_index(ipa)].count[c], n);
+}
+
+void vsm_stat_set_owner(u64 ipa, int owner) {
+  u8 *tbl;
+  u64 flags;
+  int region;
+
+  if(!vstat_ipa_valid(ipa))
+    return;
+
+  region = ipa_to_region(ipa);
+
+  tbl = owner_table[region];
+  if(!tbl) {
+    spin_lock_irqsave(&owner_table_lock, flags);
+
+    if(!(tbl = owner_table[region]))
+      tbl = owner_table[region] = alloc_page();
+
+    spin_unlock_irqrestore(&owner_table_lock, flags);
+
+    if(!tbl)
+      return;
+  }
+
+  tbl[ipa_to_index(ipa)] = owner + 1;
+}
+
+static void vstat_print_record(struct vsm_stat_record *rec) {
+  char line[sizeof(*rec) * 2 + 1];
+  u8 *p = (u8 *)rec;
+
+  for(int i = 0; i < sizeof(*rec); i++) {
+    line[i * 2] = "0123456789abcdef"[p[i] >> 4];
+    line[i * 2 + 1] = "0123456789abcdef"[p[i] & 0xf];
+  }
+
+  line[sizeof(*rec) * 2] = '\0';
+
+  printf("%s\n", line);
+}
+
+static bool vstat_merge(struct vsm_stat_record *rec, int region, int idx) {
+  struct vsm_page_stat *chunk = pstat[region];
+  bool used = false;
+
+  memset(rec, 0, sizeof(*rec));
+
+  rec->ipa = VSTAT_IPA_BASE + (u64)region * VSTAT_REGION_SIZE + ((u64)idx << PAGESHIFT);
+  rec->last_owner = VSTAT_NO_OWNER;
+
+  if(chunk) {
+    for(int c = 0; c < NR_VSTAT; c++) {
+      if((rec->count[c] = chunk[idx].count[c]) != 0)
+        used = true;
+    }
+  }
+
+  if(owner_table[region] && owner_table[region][idx]) {
+    rec->last_owner = owner_table[region][idx] - 1;
+    used = true;
+  }
+
+  return used;
+}
+
+/* sum of counters over pages: @sum has NR_VSTAT entries */
+void vsm_stat_total(u64 *sum) {
+  memset(sum, 0, sizeof(u64) * NR_VSTAT);
+
+  for(int region = 0; region < NR_VSTAT_REGIONS; region++) {
+    struct vsm_page_stat *chunk = pstat[region];
+    if(!chunk)
+      continue;
+
+    for(int idx = 0; idx < VSTAT_REGION_PAGES; idx++) {
+      for(int c = 0; c < NR_VSTAT; c++)
+        sum[c] += chunk[idx].count[c];
+    }
+  }
+}
+
+void vsm_stat_dump() {
+  struct vsm_stat_record rec;
+  int nrec = 0;
+
+  printf("vsmstat-begin %d %d %d\n", VSTAT_SNAPSHOT_VERSION, local_nodeid(), sizeof(rec));
+
+  for(int region = 0; region < NR_VSTAT_REGIONS; region++) {
+    if(!pstat[region] && !owner_table[region])
+      continue;
+
+    for(int idx = 0; idx < VSTAT_REGION_PAGES; idx++) {
+      if(vstat_merge(&rec, region, idx)) {
+        vstat_print_record(&rec);
+        nrec++;
+      }
+    }
+  }
+
+  printf("vsmstat-end %d\n", nrec);
+}
@@ -0,0 +1,310 @@
+/*
+ *  trace of guest stage 2 faults
+ *
+ *  every cpu appends records to its own ring: the fault path takes no lock
+ *  and issues no atomic instruction.  a ring has a single producer (its cpu)
+ *  and drainers (streaming on the same cpu, vsm_trace_dump() on any cpu)
+ *  which exclude each other by ring->draining.  a full ring drops new
+ *  records and counts them, so recording never waits for a drainer.
+ *
+ *  a sub-node sends every VTRACE_BATCH records to Node0 by MSG_TRACE, Node0
+ *  keeps the latest VTRACE_COLLECT_MAX pages of them until the next dump,
+ *  overwriting the oldest ones.
+ *
+ *  off unless built with VSM_TRACE.
+ */
+
+#include "types.h"
+#include "param.h"
+#include "aarch64.h"
+#include "pcpu.h"
+#include "vsm-trace.h"
+#include "allocpage.h"
+#include "spinlock.h"
+#include "atomic.h"
+#include "localnode.h"
+#include "node.h"
+#include "msg.h"
+#include "arch-timer.h"
+#include "clocksync.h"
+#include "printf.h"
+#include "log.h"
+#include "lib.h"
+#include "mm.h"
+
+/* 64 KiB, 4096 records per cpu */
+#define VTRACE_RING_ORDER     4
+#define VTRACE_RING_NREC      ((PAGESIZE << VTRACE_RING_ORDER) / sizeof(struct vsm_trace_rec))
+
+/* records in a MSG_TRACE: a page */
+#define VTRACE_BATCH          (PAGESIZE / sizeof(struct vsm_trace_rec))
+
+/* pages of records from sub-nodes Node0 keeps until dump: 1 MiB */
+#define VTRACE_COLLECT_MAX    256
+
+/* records per line of dump */
+#define VTRACE_LINE_NREC      4
+
+struct vsm_trace_ring {
+  struct vsm_trace_rec *rec;
+  u32 head;       /* written by drainer */
+  u32 tail;       /* written by producer */
+  u32 dropped;    /* written by producer */
+  u32 sent_dropped;
+  u8 draining;
+} __cacheline_aligned;
+
+struct trace_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u32 nrec;
+  /* records dropped by the sender since last MSG_TRACE */
+  u32 dropped;
+};
+
+struct vtrace_page {
+  struct vsm_trace_rec *rec;
+  u32 nrec;
+};
+
+#ifdef VSM_TRACE
+bool vsm_trace_enabled = true;
+#else
+bool vsm_trace_enabled = false;
+#endif
+
+static struct vsm_trace_ring rings[NCPU_MAX];
+
+/* ring of pages: ncollected pages from collect_head */
+static struct vtrace_page collected[VTRACE_COLLECT_MAX];
+static int collect_head;
+static int ncollected;
+static u32 collect_dropped;
+static spinlock_t collect_lock = SPINLOCK_INIT;
+
+static void vsm_trace_stream(struct vsm_trace_ring *r);
+
+static inline u32 ring_used(struct vsm_trace_ring *r) {
+  return r->tail - r->head;
+}
+
+/* called in the abort handler: keep it short */
+void vsm_trace_fault(int vcpuid, u64 ipa, u8 flags) {
+  struct vsm_trace_ring *r = &rings[cpuid()];
+  struct vsm_trace_rec *rec;
+
+  if(!vsm_trace_enabled)
+    return;
+
+  if(unlikely(!r->rec)) {
+    r->rec = alloc_pages(VTRACE_RING_ORDER);
+    if(!r->rec)
+      return;
+  }
+
+  if(ring_used(r) == VTRACE_RING_NREC) {
+    r->dropped++;
+    return;
+  }
+
+  rec = &r->rec[r->tail % VTRACE_RING_NREC];
+
+  rec->ts = cluster_now();
+  rec->ipfn = ipa >> PAGESHIFT;
+  rec->vcpuid = vcpuid;
+  rec->nodeid = local_nodeid();
+  rec->flags = flags;
+
+  /* record is visible to drainers before tail */
+  dmb(ish);
+
+  r->tail++;
+
+  if(local_nodeid() != 0 && ring_used(r) >= VTRACE_BATCH)
+    vsm_trace_stream(r);
+}
+
+/* contiguous records from head of @r, at most @max */
+static u32 ring_peek(struct vsm_trace_ring *r, struct vsm_trace_rec **recs, u32 max) {
+  u32 idx = r->head % VTRACE_RING_NREC;
+  u32 n = ring_used(r);
+
+  /* read records after tail */
+  dmb(ish);
+
+  if(n > VTRACE_RING_NREC - idx)
+    n = VTRACE_RING_NREC - idx;
+  if(n > max)
+    n = max;
+
+  *recs = &r->rec[idx];
+
+  return n;
+}
+
+static inline void ring_consume(struct vsm_trace_ring *r, u32 n) {
+  /* records are read before producer reuses slots */
+  dmb(ish);
+
+  r->head += n;
+}
+
+static void send_trace(struct vsm_trace_rec *recs, u32 n, u32 dropped) {
+  struct msg msg;
+  struct trace_hdr hdr;
+  void *page;
+
+  /* do not let msg layer pin the ring: producer reuses it */
+  page = alloc_page();
+  if(!page)
+    return;
+
+  memcpy(page, recs, n * sizeof(*recs));
+
+  hdr.nrec = n;
+  hdr.dropped = dropped;
+
+  msg_init(&msg, 0, MSG_TRACE, &hdr, page, n * sizeof(*recs));
+
+  send_msg(&msg);
+
+  /* freed after tx if msg layer pinned it */
+  free_page(page);
+}
+
+static void vsm_trace_stream(struct vsm_trace_ring *r) {
+  struct vsm_trace_rec *recs;
+  u32 n, dropped;
+
+  /* dump is draining the ring */
+  if(atomic_trylock8(&r->draining, 1) != 0)
+    return;
+
+  while(ring_used(r) >= VTRACE_BATCH) {
+    n = ring_peek(r, &recs, VTRACE_BATCH);
+
+    dropped = r->dropped - r->sent_dropped;
+    r->sent_dropped += dropped;
+
+    send_trace(recs, n, dropped);
+
+    ring_consume(r, n);
+  }
+
+  atomic_release8(&r->draining);
+}
+
+static void __node0 recv_trace_intr(struct msg *msg) {
+  struct trace_hdr *h = (struct trace_hdr *)msg->hdr;
+  struct vtrace_page *p;
+  void *page;
+  u64 flags;
+
+  if(h->nrec * sizeof(struct vsm_trace_rec) > msg->body_len) {
+    vmm_warn("trace: broken msg from Node%d\n", msg->hdr->src_id);
+    return;
+  }
+
+  /* reused the oldest page once full */
+  page = ncollected < VTRACE_COLLECT_MAX ? alloc_page() : NULL;
+
+  spin_lock_irqsave(&collect_lock, flags);
+
+  collect_dropped += h->dropped;
+
+  if(ncollected == VTRACE_COLLECT_MAX) {
+    /* overwrite the oldest records */
+    p = &collected[collect_head];
+    collect_head = (collect_head + 1) % VTRACE_COLLECT_MAX;
+    collect_dropped += p->nrec;
+  } else if(page) {
+    p = &collected[(collect_head + ncollected++) % VTRACE_COLLECT_MAX];
+    p->rec = page;
+    page = NULL;
+  } else {
+    collect_dropped += h->nrec;
+    p = NULL;
+  }
+
+  if(p) {
+    memcpy(p->rec, msg->body, h->nrec * sizeof(struct vsm_trace_rec));
+    p->nrec = h->nrec;
+  }
+
+  spin_unlock_irqrestore(&collect_lock, flags);
+
+  if(page)
+    free_page(page);
+}
+
+static void print_recs(struct vsm_trace_rec *recs, u32 n) {
+  char line[sizeof(*recs) * 2 * VTRACE_LINE_NREC + 1];
+
+  while(n > 0) {
+    u32 nline = n < VTRACE_LINE_NREC ? n : VTRACE_LINE_NREC;
+    u8 *p = (u8 *)recs;
+    int len = nline * sizeof(*recs);
+
+    for(int i = 0; i < len; i++) {
+      line[i * 2] = "0123456789abcdef"[p[i] >> 4];
+      line[i * 2 + 1] = "0123456789abcdef"[p[i] & 0xf];
+    }
+
+    line[len * 2] = '\0';
+
+    printf("%s\n", line);
+
+    recs += nline;
+    n -= nline;
+  }
+}
+
+/* drain my rings and records from sub-nodes to console */
+void vsm_trace_dump() {
+  struct vsm_trace_rec *recs;
+  u32 nrec = 0, dropped = 0, n;
+  u64 flags;
+
+  printf("vsmtrace-begin %d %d %d %d\n", VTRACE_VERSION, local_nodeid(),
+         sizeof(struct vsm_trace_rec), read_sysreg(cntfrq_el0));
+
+  for(struct vsm_trace_ring *r = rings; r < &rings[NCPU_MAX]; r++) {
+    if(!r->rec)
+      continue;
+
+    /* being streamed to Node0 (maybe by this cpu): records go there */
+    if(atomic_trylock8(&r->draining, 1) != 0)
+      continue;
+
+    while((n = ring_peek(r, &recs, VTRACE_RING_NREC)) > 0) {
+      print_recs(recs, n);
+      ring_consume(r, n);
+      nrec += n;
+    }
+
+    dropped += r->dropped - r->sent_dropped;
+    r->sent_dropped = r->dropped;
+
+    atomic_release8(&r->draining);
+  }
+
+  spin_lock_irqsave(&collect_lock, flags);
+
+  for(int i = 0; i < ncollected; i++) {
+    struct vtrace_page *p = &collected[(collect_head + i) % VTRACE_COLLECT_MAX];
+
+    print_recs(p->rec, p->nrec);
+    nrec += p->nrec;
+    free_page(p->rec);
+  }
+
+  collect_head = 0;
+  ncollected = 0;
+  dropped += collect_dropped;
+  collect_dropped = 0;
+
+  spin_unlock_irqrestore(&collect_lock, flags);
+
+  printf("vsmtrace-end %d %d\n", nrec, dropped);
+}
+
+DEFINE_POCV2_MSG_RECV_NODE0(MSG_TRACE, struct trace_hdr, recv_trace_intr);
@@ -22,8 +22,10 @@
 #include "assert.h"
 #include "compiler.h"
 #include "vsm-log.h"
+#include "vsm-stat.h"
 #include "memlayout.h"
 #include "cache.h"
+#include "atomic.h"
 
 #define ipa_to_pfn(ipa)       (((ipa) - 0x40000000) >> PAGESHIFT)
 #define ipa_to_desc(ipa)      (&ptable[ipa_to_pfn(ipa)])
@@ -37,6 +39,9 @@ static u64 w_copyset = 0;
 static u64 w_roowner = 0;
 static u64 w_inv = 0;
 
+/* pages of my memrange not backed by a frame yet */
+static u32 swap_nlazy;
+
 static const char *pte_state[4] = {
   [0]   "INV",
   [1]   " RO",
@@ -53,6 +58,9 @@ enum {
   READ_SERVER           = 0,
   WRITE_SERVER          = 1,
   INV_SERVER            = 2,
+  REPLICATE_SERVER      = 3,
+  REPLICA_SERVER        = 4,
+  PUSH_SERVER           = 5,
 };
 
 struct vsm_rw_data {
@@ -63,12 +71,17 @@ struct vsm_rw_data {
 
 static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *d);
 static void *__vsm_read_fetch_page(struct page_desc *page, struct vsm_rw_data *d);
-static void send_fetch_req(u8 req, u8 dst, u64 ipa, enum fetch_type type,
-                           bool waitreply, int req_cpu);
+static void send_fetch_req(u8 req, u8 dst, u64 ipa, enum fetch_type type);
+static void forward_fetch_req(u8 req, u8 dst, u64 ipa, enum fetch_type type, u32 connid);
 
 static void vsm_read_server_process(struct vsm_server_proc *proc);
 static void vsm_write_server_process(struct vsm_server_proc *proc);
 static void vsm_invalidate_server_process(struct vsm_server_proc *proc);
+static void vsm_replicate_server_process(struct vsm_server_proc *proc);
+static void vsm_replica_server_process(struct vsm_server_proc *proc);
+static void vsm_push_server_process(struct vsm_server_proc *proc);
+static void vsm_page_touch(struct page_desc *page);
+static int __vsm_push_page(u64 page_ipa, int dst);
 
 /*
  *  memory fetch message
@@ -94,6 +107,8 @@ struct fetch_reply_hdr {
   u64 ipa;
   u64 copyset;
   bool wnr;     // 0 read 1 write fetch
+  bool retry;   // page is being pushed to request node
+  u16 epoch;    // of page: incremented when ownership moves
 };
 
 struct fetch_reply_body {
@@ -107,24 +122,94 @@ struct invalidate_hdr {
   u8 from_nodeid;
 };
 
+/*
+ *  replication message
+ *  replicate request: Node n1 ---> manager ---> owner
+ *    send
+ *      - intermediate physical address(ipa)
+ *
+ *  replica:           owner ---> every node not in copyset
+ *    send
+ *      - intermediate physical address(ipa)
+ *      - epoch of page
+ *      - 4KB page corresponding to ipa
+ *
+ *  a replica goes in bulk class and may arrive after the page has come to
+ *  the node and gone away again by fetch replies: every ownership change
+ *  increments the epoch of page carried with it, and a replica older than
+ *  the epoch the node has seen is dropped.
+ */
+
+struct replicate_req_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u64 ipa;
+  u8 req_nodeid;
+};
+
+struct replica_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u64 ipa;
+  u8 owner;
+  u16 epoch;
+};
+
+/*
+ *  page push message (hand ownership over to other node)
+ *  push:     owner ---> manager (---> dst)
+ *    send
+ *      - intermediate physical address(ipa)
+ *      - copyset
+ *      - destination node of page
+ *      - 4KB page corresponding to ipa
+ */
+
+struct page_push_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u64 ipa;
+  u64 copyset;
+  u8 dst_nodeid;
+  u16 epoch;
+};
+
+struct owner_query_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u64 ipa;
+};
+
+struct owner_reply_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  i32 owner;
+};
+
+struct swap_reserve_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u32 nr;
+};
+
+struct swap_reserve_reply_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u32 granted;
+  u32 spare;      /* frames left to grant */
+};
+
 static inline void send_read_fetch_req(int from_node, int to_node,
                                        ipa_t page_ipa) {
-  send_fetch_req(from_node, to_node, page_ipa, READ_FETCH, true, cpuid());
+  send_fetch_req(from_node, to_node, page_ipa, READ_FETCH);
 }
 
 static inline void send_write_fetch_req(int from_node, int to_node,
                                         ipa_t page_ipa) {
-  send_fetch_req(from_node, to_node, page_ipa, WRITE_FETCH, true, cpuid());
+  send_fetch_req(from_node, to_node, page_ipa, WRITE_FETCH);
 }
 
 static inline void forward_read_fetch_req(int from_node, int to_node,
-                                          ipa_t page_ipa, int req_cpu) {
-  send_fetch_req(from_node, to_node, page_ipa, READ_FETCH, false, req_cpu);
+                                          ipa_t page_ipa, u32 connid) {
+  forward_fetch_req(from_node, to_node, page_ipa, READ_FETCH, connid);
 }
 
 static inline void forward_write_fetch_req(int from_node, int to_node,
-                                           ipa_t page_ipa, int req_cpu) {
-  send_fetch_req(from_node, to_node, page_ipa, WRITE_FETCH, false, req_cpu);
+                                           ipa_t page_ipa, u32 connid) {
+  forward_fetch_req(from_node, to_node, page_ipa, WRITE_FETCH, connid);
 }
 
 /*
@@ -132,20 +217,9 @@ static inline void forward_write_fetch_req(int from_node, int to_node,
  *  else:    return 1
  */
 static inline int page_trylock(struct page_desc *page) {
-  u8 *lock = &page->lock;
-  u8 r, l = cpuid() + 1;
-
   vmm_log("%p page trylock\n", page_desc_addr(page));
 
-  asm volatile(
-    "ldaxrb %w0, [%1]\n"
-    "cbnz   %w0, 1f\n"
-    "stxrb  %w0, %w2, [%1]\n"
-    "1:\n"
-    : "=&r"(r) : "r"(lock), "r"(l) : "memory"
-  );
-
-  return r;
+  return atomic_trylock8(&page->lock, cpuid() + 1);
 }
 
 static inline bool page_locked(struct page_desc *page) {
@@ -153,20 +227,13 @@ static inline bool page_locked(struct page_desc *page) {
 }
 
 static inline void page_spinlock(struct page_desc *page) {
-  u8 *lock = &page->lock;
-  u8 r, l = cpuid() + 1;
+  u64 start = now_cycles();
 
   vmm_log("%p page spinlock\n", page_desc_addr(page));
 
-  asm volatile(
-    "sevl\n"
-    "1: wfe\n"
-    "2: ldaxrb %w0, [%1]\n"
-    "cbnz   %w0, 1b\n"
-    "stxrb  %w0, %w2, [%1]\n"
-    "cbnz   %w0, 2b\n"
-    : "=&r"(r) : "r"(lock), "r"(l) : "memory"
-  );
+  atomic_lock8(&page->lock, 0xff, cpuid() + 1);
+
+  vsm_stat_add(page_desc_addr(page), VSTAT_LOCKWAIT, now_cycles() - start);
 
   vmm_log("%p page spinlock OK\n", page_desc_addr(page));
 }
@@ -175,54 +242,47 @@ static inline void page_spinlock(struct page_desc *page) {
  *  cpu that locked page and cpu that unlocked page must be the same
  */
 static inline void page_unlock(struct page_desc *page) {
-  u16 *l = &page->ll;
-
-  asm volatile("stlrh wzr, [%0]" :: "r"(l) : "memory");
+  atomic_release16(&page->ll);
   vmm_log("%p page unlock\n", page_desc_addr(page));
 }
 
+/* epoch @a is older than @b: epochs wrap around */
+static inline bool epoch_before(u16 a, u16 b) {
+  return (i16)(a - b) < 0;
+}
+
+/*
+ *  page came with @epoch
+ *  must be held page->lock
+ */
+static inline void vsm_page_seen_epoch(struct page_desc *page, u16 epoch) {
+  if(epoch_before(page->epoch, epoch))
+    page->epoch = epoch;
+}
+
 /*
  *  lock page and vsm_waitqueue
  */
 static inline void page_vwq_lock(struct page_desc *page) {
-  u16 tmp, l = 0x0100 | ((cpuid() + 1) & 0xff);
+  u16 l = 0x0100 | ((cpuid() + 1) & 0xff);
 
   vmm_log("page_vwq_lock %p %p\n", page_desc_addr(page), page->ll);
 
-  asm volatile(
-    "sevl\n"
-    "1: wfe\n"
-    "2: ldaxrh %w0, [%1]\n"
-    "cbnz   %w0, 1b\n"
-    "stxrh  %w0, %w2, [%1]\n"
-    "cbnz   %w0, 2b\n"
-    : "=&r"(tmp) : "r"(&page->ll), "r"(l) : "memory"
-  );
+  atomic_lock16(&page->ll, 0xffff, l);
 }
 
 /*
  *  lock vsm_waitqueue; if page is unlocked, re-lock page and return 1
  */
 static inline bool vwq_lock(struct page_desc *page) {
-  u16 tmp, lk, wlk, l = 0x0101;
-
-  asm volatile(
-    "sevl\n"
-    "1: wfe\n"
-    "2: ldaxrh %w0, [%3]\n"
-    "and    %w1, %w0, #0x00ff\n"    // w1 = page->lock
-    "and    %w2, %w0, #0xff00\n"    // w2 = page->wqlock
-    "cbnz   %w2, 1b\n"
-    "stxrh  %w0, %w4, [%3]\n"
-    "cbnz   %w0, 2b\n"
-    : "=&r"(tmp), "=&r"(lk), "=&r"(wlk) : "r"(&page->ll), "r"(l) : "memory"
-  );
+  /* page->wqlock is the upper byte of page->ll */
+  u16 old = atomic_lock16(&page->ll, 0xff00, 0x0101);
 
-  return !lk;
+  return !(old & 0x00ff);
 }
 
 static inline void vwq_unlock(struct page_desc *page) {
-  asm volatile("stlrb wzr, [%0]" :: "r"(&page->wqlock) : "memory");
+  atomic_release8(&page->wqlock);
 }
 
 static inline bool vwq_locked(struct page_desc *page) {
@@ -234,7 +294,7 @@ static inline void vwqinit(struct vsm_waitqueue *wq) {
 }
 
 static struct vsm_server_proc *new_vsm_server_proc(u64 page_ipa, int req_nodeid,
-                                                   enum fetch_type type, int req_cpu) {
+                                                   enum fetch_type type, u32 connid) {
   struct vsm_server_proc *p = malloc(sizeof(*p));
 
   p->type = type;
@@ -242,7 +302,8 @@ static struct vsm_server_proc *new_vsm_server_proc(u64 page_ipa, int req_nodeid,
   p->req_nodeid = req_nodeid;
   p->do_process = type == READ_FETCH ? vsm_read_server_process
                                      : vsm_write_server_process;
-  p->req_cpu = req_cpu;
+  p->req_connid = connid;
+  p->bounced = false;
 
   return p;
 }
@@ -260,6 +321,47 @@ static struct vsm_server_proc *new_vsm_inv_server_proc(u64 page_ipa, int from_no
   return p;
 }
 
+static struct vsm_server_proc *new_vsm_replicate_server_proc(u64 page_ipa, int req_nodeid) {
+  struct vsm_server_proc *p = malloc(sizeof(*p));
+
+  p->type = REPLICATE_SERVER;
+  p->page_ipa = page_ipa;
+  p->req_nodeid = req_nodeid;
+  p->do_process = vsm_replicate_server_process;
+
+  return p;
+}
+
+static struct vsm_server_proc *new_vsm_replica_server_proc(u64 page_ipa, int owner,
+                                                           void *page, u16 epoch) {
+  struct vsm_server_proc *p = malloc(sizeof(*p));
+
+  p->type = REPLICA_SERVER;
+  p->page_ipa = page_ipa;
+  p->req_nodeid = owner;
+  p->page = page;
+  p->epoch = epoch;
+  p->do_process = vsm_replica_server_process;
+
+  return p;
+}
+
+static struct vsm_server_proc *new_vsm_push_server_proc(u64 page_ipa, int src, int dst,
+                                                        u64 copyset, void *page, u16 epoch) {
+  struct vsm_server_proc *p = malloc(sizeof(*p));
+
+  p->type = PUSH_SERVER;
+  p->page_ipa = page_ipa;
+  p->req_nodeid = src;
+  p->dst_nodeid = dst;
+  p->copyset = copyset;
+  p->page = page;
+  p->epoch = epoch;
+  p->do_process = vsm_push_server_process;
+
+  return p;
+}
+
 /*
  *  return value:
  *    0: nothing to do
@@ -312,6 +414,7 @@ reprocess:
 
   for(p = head; p; p = p_next) {
     vmm_log("processing queue..... %p %p\n", p, page_desc_addr(page));
+    vsm_page_touch(page);
     p->do_process(p);
 
     p_next = p->next;
@@ -353,6 +456,26 @@ static void vsm_process_waitqueue(struct page_desc *page) {
   irqrestore(flags);
 }
 
+/*
+ *  process server_proc now if page is unlocked, or leave it to the page lock holder
+ */
+static void vsm_serve(struct vsm_server_proc *p) {
+  struct page_desc *page = ipa_to_desc(p->page_ipa);
+
+  if(page_trylock(page)) {
+    bool proc_myself = vsm_enqueue_proc(p);
+    if(proc_myself)
+      vsm_process_waitqueue(page);
+
+    return;
+  }
+
+  vsm_page_touch(page);
+  p->do_process(p);
+  free(p);
+  vsm_process_waitqueue(page);
+}
+
 static inline struct manager_page *ipa_manager_page(u64 ipa) {
   assert(in_memrange(&cluster_me()->mem, ipa));
 
@@ -370,15 +493,38 @@ static inline int page_manager(u64 ipa) {
   return -1;
 }
 
-static inline u64 *vsm_wait_for_recv_timeout(u64 page_ipa) {
-  int timeout_us = 3000000;   // wait for 3s
+/* return page's pte if I am owner of page */
+static inline u64 *vsm_owner_pte(u64 ipa) {
   u64 *pte;
 
-  while(!(pte = s2_accessible_pte(page_ipa)) && timeout_us--) {
-    usleep(1);
-  }
+  if((pte = s2_rwable_pte(ipa)) != NULL)
+    return pte;
+  if((pte = s2_ro_pte(ipa)) != NULL && s2pte_copyset(pte) != 0)
+    return pte;
+
+  return NULL;
+}
+
+/*
+ *  a write to replicated page: fall back to normal coherence
+ *  must be held page->lock
+ */
+static void vsm_replica_break(struct page_desc *page) {
+  if(!(page->flags & PD_REPLICATED))
+    return;
+
+  vmm_log("replica break %p\n", page_desc_addr(page));
+
+  page->flags &= ~PD_REPLICATED;
+  if(page->nfallback < 0xff)
+    page->nfallback++;
+}
 
-  if(unlikely(!pte))
+static inline u64 *vsm_wait_for_recv_timeout(u64 page_ipa) {
+  u64 *pte = NULL;
+
+  /* page is mapped by receive path at irq exit: wait for 3s */
+  if(unlikely(!wait_event_timeout(pte = s2_accessible_pte(page_ipa), 3000000)))
     panic("vsm timeout: failed @%p", page_ipa);
 
   return pte;
@@ -428,6 +574,77 @@ static void vsm_set_cache_fast(u64 ipa_page, u8 copyset, u8 *page) {
   s2_map_page_copyset(ipa_page, page_phys, copyset);
 }
 
+/* stage 2 pte of page regardless of its access flag */
+static inline u64 *vsm_page_pte(u64 ipa) {
+  return pagewalk(vttbr, ipa, s2_root_level, 0);
+}
+
+/*
+ *  allocate a frame for guest page;
+ *  cold pages are pushed out to peers later if free frames are running out.
+ *  with no frame left, the fault path waits for swap rounds to free one
+ */
+static void *vsm_alloc_frame() {
+  void *p;
+
+  vsm_swap_balance();
+
+  if((p = alloc_page()) != NULL)
+    return p;
+
+  /* rounds run at the end of irq_entry(): a server proc cannot wait for them */
+  if(in_interrupt() || in_lazyirq() || !local_irq_enabled())
+    panic("vsm: out of memory");
+
+  /* frames come back as peers ack pushed pages */
+  if(!wait_event_timeout((vsm_swap_balance(), p = alloc_page()) != NULL, VSM_SWAP_WAIT_US))
+    panic("vsm: out of memory (no frame swapped out)");
+
+  return p;
+}
+
+/*
+ *  restore access flag cleared by swap scanner
+ *  must be held page->lock
+ */
+static void vsm_page_warm(struct page_desc *page) {
+  u64 *pte;
+
+  if(!(page->flags & PD_COLD))
+    return;
+
+  pte = vsm_page_pte(page_desc_addr(page));
+  assert(pte);
+
+  *pte |= PTE_AF;
+  page->flags &= ~PD_COLD;
+}
+
+/*
+ *  make page servable: warm cold page and back lazy page with a zeroed frame
+ *  must be held page->lock
+ */
+static void vsm_page_touch(struct page_desc *page) {
+  u64 page_ipa = page_desc_addr(page);
+  u64 *pte;
+
+  vsm_page_warm(page);
+
+  if(page->flags & PD_LAZY) {
+    vsm_set_cache_fast(page_ipa, 0, vsm_alloc_frame());
+
+    pte = s2_accessible_pte(page_ipa);
+    assert(pte);
+
+    s2pte_rw(pte);
+
+    page->flags &= ~PD_LAZY;
+    atomic_fetch_add32(&swap_nlazy, -1);
+
+    vsm_stat_set_owner(page_ipa, local_nodeid());
+  }
+}
+
 /*
  *  already has ptable[ipa].lock
  */
@@ -442,19 +659,15 @@ static void vsm_invalidate(u64 ipa, u64 copyset) {
   hdr.copyset = copyset;
   hdr.from_nodeid = local_nodeid();
 
-  int node = 0;
-  do {
-    if((copyset & 1) && (node != local_nodeid())) {
-      vmm_log("invalidate request %p %d -> %d\n", ipa, local_nodeid(), node);
- 
-      msg_init(&msg, node, MSG_INVALIDATE, &hdr, NULL, 0);
+  vmm_log("invalidate request %p %d -> %p\n", ipa, local_nodeid(), copyset);
 
-      send_msg(&msg);
-    }
+  /* one frame to the multicast group of copyset */
+  msg_init(&msg, 0, MSG_INVALIDATE, &hdr, NULL, 0);
+
+  send_msg_mcast(&msg, copyset);
 
-    copyset >>= 1;
-    node++;
-  } while(copyset);
+  copyset &= ~(1ul << local_nodeid());
+  vsm_stat_add(ipa, VSTAT_INV_OUT, __builtin_popcountll(copyset));
 }
 
 static void vsm_invalidate_server_process(struct vsm_server_proc *proc) {
@@ -467,18 +680,22 @@ static void vsm_invalidate_server_process(struct vsm_server_proc *proc) {
 
   if(!s2_accessible(ipa)) {
     // panic("invalidate already: %p", ipa);
+    /* a replica in flight may be older than this invalidate */
+    page->flags |= PD_INVALIDATED;
     return;
   }
 
-  if((pte = s2_rwable_pte(ipa)) != NULL ||
-      (((pte = s2_ro_pte(ipa)) != NULL) && s2pte_copyset(pte) != 0)) {
+  if((pte = vsm_owner_pte(ipa)) != NULL) {
     /* I'm already owner, ignore invalidate request */
     return;
   }
 
   vmm_log("inv server %p: from %d -> %d\n", ipa, from_nodeid, local_nodeid()); 
 
+  vsm_replica_break(page);
   s2_page_invalidate(ipa);
+
+  vsm_stat_inc(ipa, VSTAT_INV_IN);
 }
 
 void *vsm_read_fetch_page_imm(u64 page_ipa, u64 offset, char *buf, u64 size)  {
@@ -490,12 +707,23 @@ void *vsm_read_fetch_page_imm(u64 page_ipa, u64 offset, char *buf, u64 size)  {
     .size = size,
   };
 
+  vsm_stat_inc(page_ipa, VSTAT_READ_FAULT);
+
   return __vsm_read_fetch_page(page, &d);
 }
 
 void *vsm_read_fetch_page(u64 page_ipa) {
   struct page_desc *page = ipa_to_desc(page_ipa);
 
+  if(page->flags & PD_MIGRATORY) {
+    /* will be written soon: take ownership now */
+    vsm_stat_inc(page_ipa, VSTAT_WRITE_FAULT);
+
+    return __vsm_write_fetch_page(page, NULL);
+  }
+
+  vsm_stat_inc(page_ipa, VSTAT_READ_FAULT);
+
   return __vsm_read_fetch_page(page, NULL);
 }
 
@@ -503,12 +731,21 @@ void *vsm_read_fetch_instr(u64 page_ipa) {
   void *p;
   struct page_desc *page = ipa_to_desc(page_ipa);
 
+  vsm_stat_inc(page_ipa, VSTAT_INSTR_FAULT);
+
   p = __vsm_read_fetch_page(page, NULL);
   if(!p)
     return NULL;
 
   guest_icache_invalidate(p, PAGESIZE);
 
+  /*
+   *  instruction page: replicate it to all nodes so that
+   *  no node faults on it again until somebody writes it
+   */
+  if(!(page->flags & PD_REPLICATED) && page->nfallback < VSM_REPLICA_FALLBACK_MAX)
+    vsm_replicate_page(page_ipa);
+
   return p;
 }
 
@@ -523,8 +760,11 @@ static void *__vsm_read_fetch_page(struct page_desc *page, struct vsm_rw_data *d
   if(manager < 0)
     return NULL;
 
+retry:
   page_spinlock(page);
 
+  vsm_page_touch(page);
+
   vmm_log("read request occured: %p %p\n", page_ipa, read_sysreg(elr_el2));
 
   /*
@@ -551,7 +791,13 @@ static void *__vsm_read_fetch_page(struct page_desc *page, struct vsm_rw_data *d
   }
 
   pte = s2_accessible_pte(page_ipa);
-  assert(pte);
+  if(!pte) {
+    /* pushed page is in my waitqueue: map it and retry */
+    vsm_process_waitqueue(page);
+    goto retry;
+  }
+
+  page->flags &= ~PD_INVALIDATED;
 
   page_pa = PTE_PA(*pte);
 
@@ -567,6 +813,8 @@ static void *__vsm_read_fetch_page(struct page_desc *page, struct vsm_rw_data *d
 end:
   vsm_process_waitqueue(page);
 
+  vsm_swap_balance();
+
   return P2V(page_pa);
 }
 
@@ -579,12 +827,16 @@ void *vsm_write_fetch_page_imm(u64 page_ipa, u64 offset, char *buf, u64 size) {
     .size = size,
   };
 
+  vsm_stat_inc(page_ipa, VSTAT_WRITE_FAULT);
+
   return __vsm_write_fetch_page(page, &d);
 }
 
 void *vsm_write_fetch_page(u64 page_ipa) {
   struct page_desc *page = ipa_to_desc(page_ipa);
 
+  vsm_stat_inc(page_ipa, VSTAT_WRITE_FAULT);
+
   return __vsm_write_fetch_page(page, NULL);
 }
 
@@ -600,8 +852,11 @@ static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *
   if(manager < 0)
     return NULL;
 
+retry:
   page_spinlock(page);
 
+  vsm_page_touch(page);
+
   vmm_log("write request occured: %p %p\n", page_ipa, read_sysreg(elr_el2));
 
   /*
@@ -622,6 +877,7 @@ static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *
       /* Invalidate copyset */
       vsm_invalidate(page_ipa, copyset);
       s2pte_clear_copyset(pte);
+      vsm_replica_break(page);
 
       goto page_acquired;
     }
@@ -637,6 +893,8 @@ static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *
     tlb_s2_flush_all();
 
     free_page(P2V(pa));
+
+    vsm_replica_break(page);
   }
 
   if(manager == local_nodeid()) {   /* I am manager */
@@ -655,7 +913,13 @@ static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *
   }
 
   pte = s2_accessible_pte(page_ipa);
-  assert(pte);
+  if(!pte) {
+    /* pushed page is in my waitqueue: map it and retry */
+    vsm_process_waitqueue(page);
+    goto retry;
+  }
+
+  page->flags &= ~PD_INVALIDATED;
 
   vmm_log("write request %p: get remote page!\n", page_ipa);
 
@@ -663,6 +927,8 @@ static void *__vsm_write_fetch_page(struct page_desc *page, struct vsm_rw_data *
   s2pte_clear_copyset(pte);
 
 page_acquired:
+  vsm_stat_set_owner(page_ipa, local_nodeid());
+
   page_pa = PTE_PA(*pte);
   vmm_log("write request: page_pa %p\n", page_pa);
 
@@ -675,6 +941,8 @@ page_acquired:
 end:
   vsm_process_waitqueue(page);
 
+  vsm_swap_balance();
+
   return P2V(page_pa);
 }
 
@@ -699,8 +967,16 @@ static void recv_fetch_reply(struct msg *reply, void * __unused arg) {
   struct fetch_reply_body *b = reply->body;
   // vmm_log("recv remote ipa %p ----> pa %p\n", a->ipa, b->page);
 
+  if(a->retry)
+    return;
+
   if(b) {       // recv page (and ownership)
     vsm_set_cache_fast(a->ipa, a->copyset, b->page);
+    vsm_page_seen_epoch(ipa_to_desc(a->ipa), a->epoch);
+
+    vsm_stat_inc(a->ipa, VSTAT_FETCH_IN);
+    if(!a->wnr)
+      vsm_stat_set_owner(a->ipa, reply->hdr->src_id);
   } else {      // recv ownership only
     assert(a->wnr);
     panic("get ownership only\n");
@@ -711,8 +987,7 @@ static void recv_fetch_reply(struct msg *reply, void * __unused arg) {
  *  @req: request nodeid
  *  @dst: fetch request destination
  */
-static void send_fetch_req(u8 req, u8 dst, u64 ipa, enum fetch_type type,
-                           bool waitreply, int req_cpu) {
+static void send_fetch_req(u8 req, u8 dst, u64 ipa, enum fetch_type type) {
   struct msg msg;
   struct fetch_req_hdr hdr;
 
@@ -720,37 +995,56 @@ static void send_fetch_req(u8 req, u8 dst, u64 ipa, enum fetch_type type,
   hdr.req_nodeid = req;
   hdr.type = type;
 
-  msg_init_reqcpu(&msg, dst, MSG_FETCH, &hdr, NULL, 0, req_cpu);
+  msg_init(&msg, dst, MSG_FETCH, &hdr, NULL, 0);
 
-  if(waitreply) {
-    send_msg_cb(&msg, recv_fetch_reply, NULL);
-  } else {
-    send_msg(&msg);
-  }
+  send_msg_cb(&msg, recv_fetch_reply, NULL);
+}
+
+/*
+ *  forwarded request keeps connection id of the original request,
+ *  so the reply from the owner completes the requester's outstanding request
+ */
+static void forward_fetch_req(u8 req, u8 dst, u64 ipa, enum fetch_type type, u32 connid) {
+  struct msg msg;
+  struct fetch_req_hdr hdr;
+
+  hdr.ipa = ipa;
+  hdr.req_nodeid = req;
+  hdr.type = type;
+
+  msg_init_conn(&msg, dst, MSG_FETCH, &hdr, NULL, 0, connid);
+
+  send_msg(&msg);
 }
 
-static void send_read_fetch_reply(u8 dst_nodeid, u64 ipa, void *page, int req_cpu) {
+static void send_read_fetch_reply(u8 dst_nodeid, u64 ipa, void *page, u32 connid) {
   struct msg msg;
   struct fetch_reply_hdr hdr;
 
   hdr.ipa = ipa;
   hdr.wnr = 0;
   hdr.copyset = 0;
+  hdr.retry = false;
+  hdr.epoch = ipa_to_desc(ipa)->epoch;
 
-  msg_init_reqcpu(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, page, PAGESIZE, req_cpu);
+  msg_init_conn(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, page, PAGESIZE, connid);
   vmm_log("send read fetch reply %p\n", page);
 
   send_msg(&msg);
+
+  vsm_stat_inc(ipa, VSTAT_FETCH_OUT);
 }
 
 static void send_write_fetch_reply(u8 dst_nodeid, u64 ipa, void *page,
-                                   bool send_page, u8 copyset, int req_cpu) {
+                                   bool send_page, u8 copyset, u32 connid) {
   struct msg msg;
   struct fetch_reply_hdr hdr;
 
   hdr.ipa = ipa;
   hdr.wnr = 1;
   hdr.copyset = copyset;
+  hdr.retry = false;
+  hdr.epoch = ipa_to_desc(ipa)->epoch;
 
   /*
   if(ipa == 0x406c2000) {
@@ -760,9 +1054,29 @@ static void send_write_fetch_reply(u8 dst_nodeid, u64 ipa, void *page,
   */
 
   if(send_page)
-    msg_init_reqcpu(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, page, PAGESIZE, req_cpu);
+    msg_init_conn(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, page, PAGESIZE, connid);
   else
-    msg_init_reqcpu(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, NULL, 0, req_cpu);
+    msg_init_conn(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, NULL, 0, connid);
+
+  /* owner invalidated its mapping and frees the page */
+  send_msg_zcopy(&msg);
+
+  if(send_page)
+    vsm_stat_inc(ipa, VSTAT_FETCH_OUT);
+  vsm_stat_set_owner(ipa, dst_nodeid);
+}
+
+static void send_fetch_retry_reply(u8 dst_nodeid, u64 ipa, bool wnr, u32 connid) {
+  struct msg msg;
+  struct fetch_reply_hdr hdr;
+
+  hdr.ipa = ipa;
+  hdr.wnr = wnr;
+  hdr.copyset = 0;
+  hdr.retry = true;
+  hdr.epoch = ipa_to_desc(ipa)->epoch;
+
+  msg_init_conn(&msg, dst_nodeid, MSG_FETCH_REPLY, &hdr, NULL, 0, connid);
 
   send_msg(&msg);
 }
@@ -780,8 +1094,7 @@ static void vsm_read_server_process(struct vsm_server_proc *proc) {
   if(manager < 0)
     panic("dare");
 
-  if((pte = s2_rwable_pte(page_ipa)) != NULL ||
-      (((pte = s2_ro_pte(page_ipa)) != NULL) && s2pte_copyset(pte) != 0)) {
+  if((pte = vsm_owner_pte(page_ipa)) != NULL) {
     s2pte_ro(pte);
     tlb_s2_flush_ipa(page_ipa);
 
@@ -794,21 +1107,30 @@ static void vsm_read_server_process(struct vsm_server_proc *proc) {
     vmm_log("read server %p: %d -> %d: I am owner!\n", page_ipa, req_nodeid, local_nodeid());
 
     /* send p */
-    send_read_fetch_reply(req_nodeid, page_ipa, P2V(pa), proc->req_cpu);
+    send_read_fetch_reply(req_nodeid, page_ipa, P2V(pa), proc->req_connid);
   } else if(local_nodeid() == manager) {  /* I am manager */
     struct manager_page *p = ipa_manager_page(page_ipa);
     int p_owner = p->owner;
 
     vmm_log("read server %p: %d -> %d: forward read request\n", page_ipa, req_nodeid, p_owner);
 
-    if(req_nodeid == p_owner)
-      panic("read server: req_nodeid(%d) == p_owner(%d)", req_nodeid, p_owner);
+    if(req_nodeid == p_owner) {
+      /* page has been pushed to request node */
+      send_fetch_retry_reply(req_nodeid, page_ipa, false, proc->req_connid);
+      return;
+    }
 
     /* forward request to p's owner */
-    forward_read_fetch_req(req_nodeid, p_owner, page_ipa, proc->req_cpu);
+    forward_read_fetch_req(req_nodeid, p_owner, page_ipa, proc->req_connid);
   } else {
-    printf("read server: read %p (manager %d) from Node %d", page_ipa, manager, req_nodeid);
-    panic("unreachable");
+    /* I pushed the page away: ask manager again */
+    vmm_log("read server %p: %d -> %d: not owner, bounce to manager\n",
+            page_ipa, req_nodeid, manager);
+
+    if(req_nodeid == manager)   /* pushed page is on the way to manager */
+      send_fetch_retry_reply(req_nodeid, page_ipa, false, proc->req_connid);
+    else
+      forward_read_fetch_req(req_nodeid, manager, page_ipa, proc->req_connid);
   }
 }
 
@@ -826,8 +1148,7 @@ static void vsm_write_server_process(struct vsm_server_proc *proc) {
   if(manager < 0)
     panic("dare w");
 
-  if((pte = s2_rwable_pte(page_ipa)) != NULL ||
-      (((pte = s2_ro_pte(page_ipa)) != NULL) && s2pte_copyset(pte) != 0)) {
+  if((pte = vsm_owner_pte(page_ipa)) != NULL) {
     /* I am owner */
     u64 pa = PTE_PA(*pte);
     u64 copyset = s2pte_copyset(pte);
@@ -835,6 +1156,9 @@ static void vsm_write_server_process(struct vsm_server_proc *proc) {
     s2pte_invalidate(pte);
     tlb_s2_flush_ipa(page_ipa);
 
+    /* ownership moves to request node */
+    page->epoch++;
+
     vmm_log("write server %p %d -> %d I am owner! copyset %p\n",
             page_ipa, req_nodeid, local_nodeid(), copyset);
 
@@ -845,11 +1169,14 @@ static void vsm_write_server_process(struct vsm_server_proc *proc) {
 
     // send p and copyset;
     send_write_fetch_reply(req_nodeid, page_ipa, P2V(pa), send_page,
-                           copyset, proc->req_cpu);
+                           copyset, proc->req_connid);
 
     free_page(P2V(pa));
 
-    if(local_nodeid() == manager) {
+    /*
+     *  a bounced request was counted in owner already when I forwarded it
+     */
+    if(local_nodeid() == manager && !proc->bounced) {
       struct manager_page *p = ipa_manager_page(page_ipa);
 
       p->owner = req_nodeid;
@@ -860,73 +1187,910 @@ static void vsm_write_server_process(struct vsm_server_proc *proc) {
 
     vmm_log("write server %p %d -> %d forward write request\n", page_ipa, req_nodeid, p_owner);
 
-    if(req_nodeid == p_owner)
-      panic("write server: req_nodeid(%d) == p_owner(%d) fetch request from owner!",
-              req_nodeid, p_owner);
+    if(req_nodeid == p_owner) {
+      /* page has been pushed to request node */
+      send_fetch_retry_reply(req_nodeid, page_ipa, true, proc->req_connid);
+      return;
+    }
 
     /* forward request to p's owner */
-    forward_write_fetch_req(req_nodeid, p_owner, page_ipa, proc->req_cpu);
+    forward_write_fetch_req(req_nodeid, p_owner, page_ipa, proc->req_connid);
 
     /* now owner is request node */
     p->owner = req_nodeid;
   } else {
-    panic("write server: %p (manager %d) %d unreachable", page_ipa, manager, req_nodeid);
+    /* I pushed the page away: ask manager again */
+    vmm_log("write server %p: %d -> %d: not owner, bounce to manager\n",
+            page_ipa, req_nodeid, manager);
+
+    if(req_nodeid == manager)   /* pushed page is on the way to manager */
+      send_fetch_retry_reply(req_nodeid, page_ipa, true, proc->req_connid);
+    else
+      forward_write_fetch_req(req_nodeid, manager, page_ipa, proc->req_connid);
   }
 }
 
-static void recv_fetch_request_intr(struct msg *msg) {
-  struct fetch_req_hdr *a = (struct fetch_req_hdr *)msg->hdr;
-  struct vsm_server_proc *p = new_vsm_server_proc(a->ipa, a->req_nodeid,
-                                                  a->type, msg_cpu(msg));
+static void send_replicate_req(u8 dst, u64 ipa, u8 req) {
+  struct msg msg;
+  struct replicate_req_hdr hdr;
 
-  struct page_desc *page = ipa_to_desc(a->ipa);
+  hdr.ipa = ipa;
+  hdr.req_nodeid = req;
 
-  if(page_trylock(page)) {
-    bool proc_myself = vsm_enqueue_proc(p);
-    if(proc_myself)
-      vsm_process_waitqueue(page);
-    
-    return;
-  }
+  msg_init(&msg, dst, MSG_REPLICATE, &hdr, NULL, 0);
 
-  p->do_process(p);
-  free(p);
-  vsm_process_waitqueue(page);
+  send_msg(&msg);
 }
 
-static void recv_invalidate_intr(struct msg *msg) {
-  struct invalidate_hdr *h = (struct invalidate_hdr *)msg->hdr;
-  struct vsm_server_proc *p = new_vsm_inv_server_proc(h->ipa, h->from_nodeid, h->copyset);
+/* @nodes: mask of nodes */
+static void send_replica(u64 nodes, u64 ipa, void *page) {
+  struct msg msg;
+  struct replica_hdr hdr;
 
-  struct page_desc *page = ipa_to_desc(h->ipa);
+  hdr.ipa = ipa;
+  hdr.owner = local_nodeid();
+  hdr.epoch = ipa_to_desc(ipa)->epoch;
 
-  if(page_trylock(page)) {
-    bool proc_myself = vsm_enqueue_proc(p);
-    if(proc_myself)
-      vsm_process_waitqueue(page);
+  msg_init(&msg, 0, MSG_REPLICA, &hdr, page, PAGESIZE);
 
-    return;
-  }
+  send_msg_mcast(&msg, nodes);
 
-  p->do_process(p);
-  free(p);
-  vsm_process_waitqueue(page);
+  vsm_stat_add(ipa, VSTAT_FETCH_OUT, __builtin_popcountll(nodes));
 }
 
-void vsm_node_init(struct memrange *mem) {
-  u64 start = mem->start, size = mem->size;
-  u64 p;
+/*
+ *  make page read-only and push a copy to every node not in copyset yet.
+ *  must be held page->lock and be owner of page
+ */
+static void vsm_replicate(u64 page_ipa, u64 *pte) {
+  struct page_desc *page = ipa_to_desc(page_ipa);
+  struct cluster_node *node;
+  void *p = P2V(PTE_PA(*pte));
+  int copyset;
+  u64 targets = 0;
 
-  for(p = 0; p < size; p += PAGESIZE) {
-    char *page = alloc_page();
-    if(!page)
-      panic("ram");
+  s2pte_ro(pte);
+  tlb_s2_flush_ipa(page_ipa);
 
-    guest_map_page(start + p, V2P(page), PAGE_NORMAL | PAGE_RW);
-  }
+  copyset = s2pte_copyset(pte);
+
+  foreach_cluster_node(node) {
+    int nodeid = node->nodeid;
+
+    /* copyset can hold only S2PTE_COPYSET_NODES nodes */
+    if(nodeid == local_nodeid() || nodeid >= S2PTE_COPYSET_NODES)
+      continue;
+    if(copyset & (1 << nodeid))
+      continue;
+
+    vmm_log("replicate %p: %d -> %d\n", page_ipa, local_nodeid(), nodeid);
+
+    targets |= 1 << nodeid;
+    s2pte_add_copyset(pte, nodeid);
+  }
+
+  /* one frame to the multicast group of new sharers */
+  if(targets)
+    send_replica(targets, page_ipa, p);
+
+  page->flags |= PD_REPLICATED;
+}
+
+/*
+ *  replicate read-only page to all nodes.
+ *  replicas stay mapped until the page is written.
+ */
+void vsm_replicate_page(u64 page_ipa) {
+  struct page_desc *page = ipa_to_desc(page_ipa);
+  int manager;
+  u64 *pte;
+
+  manager = page_manager(page_ipa);
+  if(manager < 0)
+    return;
+
+  page_spinlock(page);
+
+  vsm_page_touch(page);
+
+  if((pte = vsm_owner_pte(page_ipa)) != NULL) {
+    vsm_replicate(page_ipa, pte);
+  } else {
+    int dst = manager;
+
+    if(manager == local_nodeid())
+      dst = ipa_manager_page(page_ipa)->owner;
+
+    /* count a later write as fallback even if no replica comes to me */
+    page->flags |= PD_REPLICATED;
+
+    send_replicate_req(dst, page_ipa, local_nodeid());
+  }
+
+  vsm_process_waitqueue(page);
+}
+
+void vsm_replicate_range(u64 ipa, u64 size) {
+  u64 p;
+
+  for(p = PAGE_ADDRESS(ipa); p < ipa + size; p += PAGESIZE)
+    vsm_replicate_page(p);
+}
+
+/* replicate server */
+static void vsm_replicate_server_process(struct vsm_server_proc *proc) {
+  u64 page_ipa = proc->page_ipa;
+  struct page_desc *page = ipa_to_desc(page_ipa);
+  int req_nodeid = proc->req_nodeid;
+  u64 *pte;
+
+  assert(page_locked(page));
+
+  int manager = page_manager(page_ipa);
+  if(manager < 0)
+    panic("dare r");
+
+  if((pte = vsm_owner_pte(page_ipa)) != NULL) {
+    vsm_replicate(page_ipa, pte);
+  } else if(local_nodeid() == manager) {
+    int p_owner = ipa_manager_page(page_ipa)->owner;
+
+    /* request node has become owner in the meantime */
+    if(req_nodeid == p_owner)
+      return;
+
+    vmm_log("replicate server %p: forward to %d\n", page_ipa, p_owner);
+
+    send_replicate_req(p_owner, page_ipa, req_nodeid);
+  } else {
+    /* ownership has moved during forwarding; replication is only a hint */
+    vmm_log("replicate server %p: not owner, drop\n", page_ipa);
+  }
+}
+
+/* replica server */
+static void vsm_replica_server_process(struct vsm_server_proc *proc) {
+  u64 page_ipa = proc->page_ipa;
+  struct page_desc *page = ipa_to_desc(page_ipa);
+  u64 *pte;
+
+  assert(page_locked(page));
+
+  if(s2_accessible(page_ipa)) {
+    /* already have a copy */
+    page->flags |= PD_REPLICATED;
+    free_page(proc->page);
+    return;
+  }
+
+  if(page->flags & PD_INVALIDATED) {
+    /* replica may have been overtaken by invalidate request: drop it */
+    page->flags &= ~PD_INVALIDATED;
+    free_page(proc->page);
+    return;
+  }
+
+  if(epoch_before(proc->epoch, page->epoch)) {
+    /* page has come here and gone away since the replica was sent */
+    vmm_log("replica %p: stale epoch %d < %d\n", page_ipa, proc->epoch, page->epoch);
+    free_page(proc->page);
+    return;
+  }
+
+  vsm_set_cache_fast(page_ipa, 0, proc->page);
+
+  pte = s2_accessible_pte(page_ipa);
+  assert(pte);
+
+  s2pte_ro(pte);
+  tlb_s2_flush_ipa(page_ipa);
+
+  guest_icache_invalidate(proc->page, PAGESIZE);
+
+  page->flags |= PD_REPLICATED;
+
+  vsm_stat_inc(page_ipa, VSTAT_FETCH_IN);
+}
+
+void vsm_page_set_flags(u64 page_ipa, u8 set, u8 clear) {
+  struct page_desc *page = ipa_to_desc(page_ipa);
+
+  page_spinlock(page);
+
+  page->flags = (page->flags & ~clear) | set;
+
+  vsm_process_waitqueue(page);
+}
+
+bool vsm_in_guest_memory(u64 ipa) {
+  return page_manager(ipa) >= 0;
+}
+
+/* fetch of page would be queued behind backlog to its manager */
+bool vsm_fetch_congested(u64 ipa) {
+  int manager = page_manager(ipa);
+
+  return manager >= 0 && manager != local_nodeid() && msg_peer_congested(manager);
+}
+
+/*
+ *  prefetched page arrived: map it as the fault handler does.
+ *  called in receive path on the cpu which locked the page
+ */
+static void recv_prefetch_reply(struct msg *reply, void *arg) {
+  struct fetch_reply_hdr *a = (struct fetch_reply_hdr *)reply->hdr;
+  struct page_desc *page = ipa_to_desc(a->ipa);
+  volatile u32 *pending = arg;
+  u64 *pte;
+
+  recv_fetch_reply(reply, NULL);
+
+  /* retried: page is being pushed here, or left to the next fault */
+  if((pte = s2_accessible_pte(a->ipa)) != NULL) {
+    page->flags &= ~PD_INVALIDATED;
+
+    if(a->wnr) {
+      vsm_invalidate(a->ipa, s2pte_copyset(pte));
+      s2pte_clear_copyset(pte);
+      vsm_stat_set_owner(a->ipa, local_nodeid());
+      s2pte_rw(pte);
+    } else {
+      s2pte_ro(pte);
+      tlb_s2_flush_all(a->ipa);
+    }
+  }
+
+  vsm_process_waitqueue(page);
+
+  (*pending)--;
+}
+
+/*
+ *  start fetch of @page_ipa without waiting for it.
+ *  the page stays locked until recv_prefetch_reply()
+ */
+static void vsm_prefetch_page(u64 page_ipa, bool wr, volatile u32 *pending) {
+  struct page_desc *page = ipa_to_desc(page_ipa);
+  int manager = page_manager(page_ipa);
+  struct msg msg;
+  struct fetch_req_hdr hdr;
+
+  /* only a hint: do not add to backlog of a congested link */
+  if(manager < 0 || vsm_fetch_congested(page_ipa))
+    return;
+
+  /* other cpu is faulting on it */
+  if(page_trylock(page))
+    return;
+
+  vsm_page_touch(page);
+
+  if(wr ? s2_rwable_pte(page_ipa) != NULL : s2_accessible(page_ipa)) {
+    vsm_process_waitqueue(page);
+    return;
+  }
+
+  if(s2_accessible(page_ipa)) {
+    /* write to a read-only copy: fault handler invalidates other copies */
+    vsm_process_waitqueue(page);
+    vsm_write_fetch_page(page_ipa);
+    return;
+  }
+
+  vsm_stat_inc(page_ipa, wr ? VSTAT_WRITE_FAULT : VSTAT_READ_FAULT);
+
+  hdr.ipa = page_ipa;
+  hdr.req_nodeid = local_nodeid();
+  hdr.type = wr ? WRITE_FETCH : READ_FETCH;
+
+  /* manager asks owner itself, as the fault handler does */
+  if(manager == local_nodeid())
+    manager = ipa_manager_page(page_ipa)->owner;
+
+  msg_init(&msg, manager, MSG_FETCH, &hdr, NULL, 0);
+
+  (*pending)++;
+
+  send_msg_async(&msg, recv_prefetch_reply, (void *)pending);
+}
+
+/*
+ *  fetch pages in [@ipa, @ipa + @size) before the guest touches them.
+ *  up to VSM_PREFETCH_BATCH fetches are in flight at once, so a range costs
+ *  about a round trip per batch instead of a round trip per page.
+ *  every page is completed on its own as its reply arrives.
+ */
+void vsm_prefetch_range(u64 ipa, u64 size, bool wr) {
+  volatile u32 pending = 0;
+  u64 p;
+
+  assert(local_irq_enabled());
+
+  for(p = PAGE_ADDRESS(ipa); p < ipa + size; p += PAGESIZE) {
+    if(pending == VSM_PREFETCH_BATCH &&
+       !wait_event_timeout(pending < VSM_PREFETCH_BATCH, MSG_REPLY_TIMEOUT_US))
+      panic("vsm: prefetch: no reply");
+
+    vsm_prefetch_page(p, wr, &pending);
+  }
+
+  /* replies refer to @pending on my stack */
+  if(pending && !wait_event_timeout(pending == 0, MSG_REPLY_TIMEOUT_US))
+    panic("vsm: prefetch: no reply");
+
+  vsm_swap_balance();
+}
+
+/*
+ *  @to: next hop of page (manager or destination)
+ */
+static void send_page_push(u8 to, u64 ipa, void *page, u64 copyset, u8 dst, u16 epoch) {
+  struct msg msg;
+  struct page_push_hdr hdr;
+
+  hdr.ipa = ipa;
+  hdr.copyset = copyset;
+  hdr.dst_nodeid = dst;
+  hdr.epoch = epoch;
+
+  msg_init(&msg, to, MSG_PAGE_PUSH, &hdr, page, PAGESIZE);
+
+  send_msg_zcopy(&msg);
+
+  vsm_stat_inc(ipa, VSTAT_FETCH_OUT);
+}
+
+/*
+ *  map pushed page as owner
+ *  must be held page->lock
+ */
+static void vsm_push_map(u64 page_ipa, void *p, u64 copyset, u16 epoch) {
+  struct page_desc *page = ipa_to_desc(page_ipa);
+  u64 *pte;
+
+  copyset &= ~(1ul << local_nodeid());
+
+  if((pte = s2_accessible_pte(page_ipa)) != NULL) {
+    /* I have a read-only copy of the page already */
+    free_page(p);
+
+    s2pte_clear_copyset(pte);
+    *pte |= S2PTE_COPYSET(copyset);
+  } else {
+    vsm_set_cache_fast(page_ipa, copyset, p);
+
+    pte = s2_accessible_pte(page_ipa);
+    assert(pte);
+  }
+
+  /* owner with copyset keeps page read-only */
+  if(copyset)
+    s2pte_ro(pte);
+  else
+    s2pte_rw(pte);
+
+  tlb_s2_flush_ipa(page_ipa);
+
+  page->flags &= ~PD_INVALIDATED;
+  vsm_page_seen_epoch(page, epoch);
+
+  vsm_stat_inc(page_ipa, VSTAT_FETCH_IN);
+  vsm_stat_set_owner(page_ipa, local_nodeid());
+}
+
+/*
+ *  hand ownership (and page) over to @dst.
+ *  the page goes through the manager so that the manager's owner
+ *  is updated before any request is forwarded to @dst.
+ *  requests which reach me after the push are bounced to the manager.
+ *
+ *  must be held page->lock
+ *  return 0 if page was pushed
+ */
+static int __vsm_push_page(u64 page_ipa, int dst) {
+  struct page_desc *page = ipa_to_desc(page_ipa);
+  int manager = page_manager(page_ipa);
+  u64 *pte, pa, copyset;
+
+  if(manager < 0 || dst == local_nodeid())
+    return -1;
+
+  if((pte = vsm_owner_pte(page_ipa)) == NULL)
+    return -1;
+
+  /* replicas are pinned */
+  if(page->flags & PD_REPLICATED)
+    return -1;
+
+  pa = PTE_PA(*pte);
+  copyset = s2pte_copyset(pte);
+
+  /* guest must not write the page while it is on the wire */
+  s2pte_invalidate(pte);
+  s2pte_clear_copyset(pte);
+  tlb_s2_flush_ipa(page_ipa);
+
+  vmm_log("push %p: %d -> %d\n", page_ipa, local_nodeid(), dst);
+
+  /* ownership moves to @dst */
+  page->epoch++;
+
+  if(manager == local_nodeid()) {
+    send_page_push(dst, page_ipa, P2V(pa), copyset, dst, page->epoch);
+
+    ipa_manager_page(page_ipa)->owner = dst;
+  } else {
+    send_page_push(manager, page_ipa, P2V(pa), copyset, dst, page->epoch);
+  }
+
+  free_page(P2V(pa));
+
+  vsm_stat_set_owner(page_ipa, dst);
+
+  return 0;
+}
+
+int vsm_push_page(u64 page_ipa, int dst) {
+  struct page_desc *page = ipa_to_desc(page_ipa);
+  int rc;
+
+  page_spinlock(page);
+
+  vsm_page_warm(page);
+
+  rc = __vsm_push_page(page_ipa, dst);
+
+  vsm_process_waitqueue(page);
+
+  return rc;
+}
+
+/* give ownership of page back to its manager */
+int vsm_release_page(u64 page_ipa) {
+  int manager = page_manager(page_ipa);
+
+  if(manager < 0)
+    return -1;
+  if(manager == local_nodeid())
+    return 0;
+
+  return vsm_push_page(page_ipa, manager);
+}
+
+static void recv_owner_reply(struct msg *reply, void *arg) {
+  struct owner_reply_hdr *h = (struct owner_reply_hdr *)reply->hdr;
+  int *owner = arg;
+
+  *owner = h->owner;
+}
+
+/* return current owner of page */
+int vsm_page_owner(u64 page_ipa) {
+  struct msg msg;
+  struct owner_query_hdr hdr;
+  int manager = page_manager(page_ipa);
+  int owner = -1;
+
+  if(manager < 0)
+    return -1;
+
+  if(vsm_owner_pte(page_ipa) || (ipa_to_desc(page_ipa)->flags & PD_COLD))
+    return local_nodeid();
+
+  if(manager == local_nodeid())
+    return ipa_manager_page(page_ipa)->owner;
+
+  hdr.ipa = page_ipa;
+
+  msg_init(&msg, manager, MSG_OWNER_QUERY, &hdr, NULL, 0);
+
+  send_msg_cb(&msg, recv_owner_reply, &owner);
+
+  return owner;
+}
+
+/* push server */
+static void vsm_push_server_process(struct vsm_server_proc *proc) {
+  u64 page_ipa = proc->page_ipa;
+  struct page_desc *page = ipa_to_desc(page_ipa);
+  int src = proc->req_nodeid;
+  int dst = proc->dst_nodeid;
+
+  assert(page_locked(page));
+
+  int manager = page_manager(page_ipa);
+  if(manager < 0)
+    panic("dare p");
+
+  if(local_nodeid() != manager) {
+    /* page from manager */
+    vsm_push_map(page_ipa, proc->page, proc->copyset, proc->epoch);
+    return;
+  }
+
+  struct manager_page *p = ipa_manager_page(page_ipa);
+
+  if(p->owner != src) {
+    /*
+     *  I have forwarded a write request to src already.
+     *  src bounces it back to me, so keep the page and serve it then.
+     */
+    vmm_log("push server %p: owner %d != %d, keep page\n", page_ipa, p->owner, src);
+
+    vsm_push_map(page_ipa, proc->page, proc->copyset, proc->epoch);
+    return;
+  }
+
+  if(dst == local_nodeid()) {
+    vsm_push_map(page_ipa, proc->page, proc->copyset, proc->epoch);
+  } else {
+    /* page passes through me: replicas sent before are stale here too */
+    vsm_page_seen_epoch(page, proc->epoch);
+
+    send_page_push(dst, page_ipa, proc->page, proc->copyset, dst, proc->epoch);
+    free_page(proc->page);
+  }
+
+  p->owner = dst;
+}
+
+static void recv_fetch_request_intr(struct msg *msg) {
+  struct fetch_req_hdr *a = (struct fetch_req_hdr *)msg->hdr;
+  struct vsm_server_proc *p = new_vsm_server_proc(a->ipa, a->req_nodeid,
+                                                  a->type, msg_connid(msg));
+
+  /* only manager forwards requests; others bounce them back to manager */
+  p->bounced = msg->hdr->src_id != a->req_nodeid && page_manager(a->ipa) == local_nodeid();
+
+  vsm_serve(p);
+}
+
+static void recv_invalidate_intr(struct msg *msg) {
+  struct invalidate_hdr *h = (struct invalidate_hdr *)msg->hdr;
+  struct vsm_server_proc *p = new_vsm_inv_server_proc(h->ipa, h->from_nodeid, h->copyset);
+
+  vsm_serve(p);
+}
+
+static void recv_replicate_request_intr(struct msg *msg) {
+  struct replicate_req_hdr *h = (struct replicate_req_hdr *)msg->hdr;
+  struct vsm_server_proc *p = new_vsm_replicate_server_proc(h->ipa, h->req_nodeid);
+
+  vsm_serve(p);
+}
+
+static void recv_page_push_intr(struct msg *msg) {
+  struct page_push_hdr *h = (struct page_push_hdr *)msg->hdr;
+  struct vsm_server_proc *p;
+
+  if(!msg->body)
+    panic("page push: no page");
+
+  /* take msg->body */
+  p = new_vsm_push_server_proc(h->ipa, h->hdr.src_id, h->dst_nodeid, h->copyset,
+                               msg->body, h->epoch);
+
+  vsm_serve(p);
+}
+
+static void recv_owner_query_intr(struct msg *msg) {
+  struct owner_query_hdr *h = (struct owner_query_hdr *)msg->hdr;
+  struct owner_reply_hdr reply;
+
+  if(vsm_owner_pte(h->ipa) || (ipa_to_desc(h->ipa)->flags & PD_COLD))
+    reply.owner = local_nodeid();
+  else
+    reply.owner = ipa_manager_page(h->ipa)->owner;
+
+  msg_reply(msg, MSG_OWNER_REPLY, &reply, NULL, 0);
+}
+
+static void recv_replica_intr(struct msg *msg) {
+  struct replica_hdr *h = (struct replica_hdr *)msg->hdr;
+  struct vsm_server_proc *p;
+
+  if(!msg->body)
+    panic("replica: no page");
+
+  /* take msg->body: mapped into guest by replica server */
+  p = new_vsm_replica_server_proc(h->ipa, h->owner, msg->body, h->epoch);
+
+  vsm_serve(p);
+}
+
+/*
+ *  swap tier
+ *
+ *  a node short of frames pushes cold pages it owns to a peer which reserved
+ *  frames for them; they come back through the normal fetch path on access.
+ *
+ *  the fault path only checks the free count against VSM_FRAME_RESERVE and
+ *  kicks swap_ev on its cpu: the timer event marks a round due and
+ *  vsm_swap_flush() runs it at the end of irq_entry(), out of hard irq and
+ *  with no page lock of the fault held.  a round asks the peer with the most spare frames
+ *  by its last report for a grant of VSM_SWAP_BATCH frames (MSG_SWAP_RESERVE)
+ *  and pushes at most the granted number of pages.
+ *
+ *  the scanner is a clock over guest memory. the first pass clears access flag
+ *  of an owned page and marks it PD_COLD, a page still cold at the next pass is
+ *  pushed out.  access flag is the valid bit of vsm and is kept by software:
+ *  an access to a cold page traps and vsm_page_touch() clears PD_COLD, so
+ *  PD_COLD alone tells the page was not accessed.
+ */
+static spinlock_t swap_lock = SPINLOCK_INIT;
+static bool swap_running = false;
+static u64 swap_hand = 0;
+static struct timer_event swap_ev;
+/* a round is due: set by swap_ev, taken by vsm_swap_flush() */
+static u8 swap_kicked;
+
+/* pages I may still push to each peer; used by the reclaiming cpu only */
+static u32 swap_grant[NODE_MAX];
+
+/*
+ *  frames reserved for each peer, under swap_lock.  a new request of the
+ *  peer replaces its grant, so frames it has pushed in are counted twice
+ *  until then: at most VSM_SWAP_BATCH per peer.
+ */
+static u32 swap_granted[NODE_MAX];
+static u32 swap_granted_total;
+
+/* frames left after backing @nalloc bytes of guest memory */
+u32 vsm_spare_pages(u64 nalloc) {
+  u64 nfree = nr_free_pages();
+  u64 need = (nalloc >> PAGESHIFT) + VSM_FRAME_RESERVE;
+
+  return nfree > need ? nfree - need : 0;
+}
+
+/* frames which can be granted to peers: lazy pages of mine are backed first */
+static u32 vsm_swap_room() {
+  u64 nfree = nr_free_pages();
+  u64 need = VSM_FRAME_RESERVE + swap_nlazy + swap_granted_total;
+
+  return nfree > need ? nfree - need : 0;
+}
+
+/* peer with the most spare frames by its last report */
+static int vsm_swap_target() {
+  struct cluster_node *node, *target = NULL;
+
+  foreach_cluster_node(node) {
+    if(node == cluster_me() || !node_online(node->nodeid))
+      continue;
+
+    if(node->spare && (!target || node->spare > target->spare))
+      target = node;
+  }
+
+  return target ? target->nodeid : -1;
+}
+
+/* peer I hold a grant of */
+static int vsm_swap_granted_peer() {
+  for(int n = 0; n < NODE_MAX; n++) {
+    if(swap_grant[n] && node_online(n))
+      return n;
+  }
+
+  return -1;
+}
+
+/*
+ *  one step of clock
+ *  must be held page->lock
+ *  return 1 if page was pushed out
+ */
+static int vsm_swap_scan_page(struct page_desc *page, int dst) {
+  u64 page_ipa = page_desc_addr(page);
+  u64 *pte;
+
+  if(page->flags & (PD_REPLICATED | PD_LOCAL | PD_LAZY))
+    return 0;
+
+  if(!(page->flags & PD_COLD)) {
+    if((pte = vsm_owner_pte(page_ipa)) == NULL)
+      return 0;
+
+    s2pte_invalidate(pte);
+    tlb_s2_flush_ipa(page_ipa);
+
+    page->flags |= PD_COLD;
+
+    return 0;
+  }
+
+  /* not accessed since the last pass */
+  vsm_page_warm(page);
+
+  return __vsm_push_page(page_ipa, dst) == 0;
+}
+
+/*
+ *  push at most @nr cold pages out to @dst
+ *  return number of pages pushed
+ */
+static int vsm_swap_out(int dst, int nr) {
+  struct page_desc *page;
+  int npushed = 0;
+
+  for(int i = 0; i < VSM_SWAP_SCAN_MAX && npushed < nr; i++) {
+    page = &ptable[swap_hand];
+    swap_hand = (swap_hand + 1) % (GVM_MEMORY / PAGESIZE);
+
+    /* vcpu on this cpu may hold other page lock: never wait here */
+    if(page_trylock(page))
+      continue;
+
+    npushed += vsm_swap_scan_page(page, dst);
+
+    vsm_process_waitqueue(page);
+  }
+
+  if(npushed)
+    vmm_log("swap out %d pages to Node %d\n", npushed, dst);
+
+  return npushed;
+}
+
+static void vsm_swap_done() {
+  u64 flags;
+
+  spin_lock_irqsave(&swap_lock, flags);
+  swap_running = false;
+  spin_unlock_irqrestore(&swap_lock, flags);
+}
+
+static void recv_swap_reserve_reply(struct msg *reply, void *arg) {
+  struct swap_reserve_reply_hdr *h = (struct swap_reserve_reply_hdr *)reply->hdr;
+  int dst = reply->hdr->src_id;
+
+  swap_grant[dst] = h->granted;
+  cluster_node(dst)->spare = h->spare;
+
+  /* replied on this cpu: go on with the grant from swap_ev */
+  if(h->granted)
+    timer_event_add(&swap_ev, now_cycles());
+  else
+    vsm_swap_done();
+}
+
+static void send_swap_reserve(int dst, u32 nr) {
+  struct swap_reserve_hdr hdr;
+  struct msg msg;
+
+  hdr.nr = nr;
+
+  msg_init(&msg, dst, MSG_SWAP_RESERVE, &hdr, NULL, 0);
+
+  send_msg_async(&msg, recv_swap_reserve_reply, NULL);
+}
+
+static void vsm_swap_work() {
+  int dst, nr;
+
+  if(nr_free_pages() >= VSM_FRAME_RESERVE) {
+    vsm_swap_done();
+    return;
+  }
+
+  if((dst = vsm_swap_granted_peer()) < 0) {
+    if((dst = vsm_swap_target()) < 0) {
+      vsm_swap_done();
+      return;
+    }
+
+    /* continued by recv_swap_reserve_reply() */
+    send_swap_reserve(dst, VSM_SWAP_BATCH);
+    return;
+  }
+
+  nr = vsm_swap_out(dst, min(swap_grant[dst], VSM_SWAP_BATCH));
+  swap_grant[dst] -= nr;
+
+  vsm_swap_done();
+}
+
+static void recv_swap_reserve_intr(struct msg *msg) {
+  struct swap_reserve_hdr *h = (struct swap_reserve_hdr *)msg->hdr;
+  struct swap_reserve_reply_hdr reply;
+  int src = h->hdr.src_id;
+  u64 flags;
+
+  spin_lock_irqsave(&swap_lock, flags);
+
+  swap_granted_total -= swap_granted[src];
+  swap_granted[src] = min(h->nr, vsm_swap_room());
+  swap_granted_total += swap_granted[src];
+
+  reply.granted = swap_granted[src];
+  reply.spare = vsm_swap_room();
+
+  spin_unlock_irqrestore(&swap_lock, flags);
+
+  msg_reply(msg, MSG_SWAP_RESERVE_REPLY, &reply, NULL, 0);
+}
+
+/* in hard irq: server procs of pages scanned must not run here */
+static void vsm_swap_kick(struct timer_event *ev) {
+  swap_kicked = 1;
+}
+
+/*
+ *  run the swap round kicked by swap_ev
+ *  called at the end of irq_entry() with irqs disabled
+ */
+void vsm_swap_flush() {
+  if(!swap_kicked || in_interrupt() || in_lazyirq())
+    return;
+
+  /* other cpu took it */
+  if(!atomic_cmpxchg8(&swap_kicked, 1, 0))
+    return;
+
+  /* vsm_process_waitqueue() runs queued server procs with irqs enabled */
+  local_irq_enable();
+
+  vsm_swap_work();
+
+  local_irq_disable();
+}
+
+/*
+ *  called when a frame was allocated: cheap check of free count,
+ *  swap-out is deferred to swap_ev on this cpu
+ */
+void vsm_swap_balance() {
+  u64 flags;
+
+  if(nr_free_pages() >= VSM_FRAME_RESERVE)
+    return;
+
+  spin_lock_irqsave(&swap_lock, flags);
+
+  /* other cpu is reclaiming */
+  if(swap_running) {
+    spin_unlock_irqrestore(&swap_lock, flags);
+    return;
+  }
+
+  swap_running = true;
+
+  spin_unlock_irqrestore(&swap_lock, flags);
+
+  timer_event_add(&swap_ev, now_cycles());
+}
+
+/*
+ *  back my memrange with local frames as long as they last;
+ *  the rest is backed lazily and overflows to peers via swap tier
+ */
+void vsm_node_init(struct memrange *mem) {
+  u64 start = mem->start, size = mem->size;
+  u64 p, nlazy = 0;
+
+  for(p = 0; p < size; p += PAGESIZE) {
+    if(nr_free_pages() <= VSM_FRAME_RESERVE) {
+      ipa_to_desc(start + p)->flags |= PD_LAZY;
+      nlazy++;
+      continue;
+    }
+
+    char *page = alloc_page();
+    if(!page)
+      panic("ram");
+
+    guest_map_page(start + p, V2P(page), PAGE_NORMAL | PAGE_RW);
+  }
 
   vmm_log("Node %d mapped: [%p - %p]\n", local_nodeid(), start, start+p);
 
+  if(nlazy)
+    printf("Node %d: %d pages are backed lazily\n", local_nodeid(), nlazy);
+
+  swap_nlazy = nlazy;
+  timer_event_init(&swap_ev, vsm_swap_kick, NULL);
+
   struct manager_page *page;
   for(page = manager; page < &manager[NR_MANAGER_PAGES]; page++) {
     /* now owner is me */
@@ -937,3 +2101,10 @@ void vsm_node_init(struct memrange *mem) {
 DEFINE_POCV2_MSG(MSG_FETCH, struct fetch_req_hdr, recv_fetch_request_intr);
 DEFINE_POCV2_MSG(MSG_FETCH_REPLY, struct fetch_reply_hdr, NULL);
 DEFINE_POCV2_MSG(MSG_INVALIDATE, struct invalidate_hdr, recv_invalidate_intr);
+DEFINE_POCV2_MSG(MSG_REPLICATE, struct replicate_req_hdr, recv_replicate_request_intr);
+DEFINE_POCV2_MSG(MSG_REPLICA, struct replica_hdr, recv_replica_intr);
+DEFINE_POCV2_MSG(MSG_PAGE_PUSH, struct page_push_hdr, recv_page_push_intr);
+DEFINE_POCV2_MSG(MSG_OWNER_QUERY, struct owner_query_hdr, recv_owner_query_intr);
+DEFINE_POCV2_MSG(MSG_OWNER_REPLY, struct owner_reply_hdr, NULL);
+DEFINE_POCV2_MSG(MSG_SWAP_RESERVE, struct swap_reserve_hdr, recv_swap_reserve_intr);
+DEFINE_POCV2_MSG(MSG_SWAP_RESERVE_REPLY, struct swap_reserve_reply_hdr, NULL);
@@ -6,15 +6,167 @@
 #include "aarch64.h"
 #include "printf.h"
 #include "irq.h"
+#include "gic.h"
+#include "localnode.h"
+#include "param.h"
+#include "panic.h"
+#include "spinlock.h"
 
 #define CNTHP_CTL_EL2_ENABLE    (1ul << 0)
 #define CNTHP_CTL_EL2_IMASK     (1ul << 1)
 #define CNTHP_CTL_EL2_ISTATUS   (1ul << 2)
 
+/* EL2 physical timer */
+#define HYP_TIMER_IRQ           26
+
 static u64 cpu_hz;
 
+/*
+ *  pending timer events per cpu, sorted by expire.
+ *  an event may be re-added or deleted from other cpu: the lock of a queue
+ *  guards it against that cpu.
+ */
+static struct timer_event *timerq[NCPU_MAX];
+static spinlock_t timerq_lock[NCPU_MAX];
+
+static void hyp_timer_program(struct timer_event *next) {
+  if(next) {
+    write_sysreg(cnthp_cval_el2, next->expire);
+    write_sysreg(cnthp_ctl_el2, CNTHP_CTL_EL2_ENABLE);
+  } else {
+    write_sysreg(cnthp_ctl_el2, CNTHP_CTL_EL2_IMASK | CNTHP_CTL_EL2_ENABLE);
+  }
+
+  isb();
+}
+
 static void hyp_timer_intr(void *arg) {
+  spinlock_t *lk = &timerq_lock[cpuid()];
+  struct timer_event **q = &timerq[cpuid()];
+  struct timer_event *ev;
+  u64 flags;
+
   (void)arg;
+
+  spin_lock_irqsave(lk, flags);
+
+  while((ev = *q) != NULL && ev->expire <= now_cycles()) {
+    *q = ev->next;
+    ev->next = NULL;
+    ev->pending = false;
+
+    if(ev->handler) {
+      spin_unlock_irqrestore(lk, flags);
+      ev->handler(ev);
+      spin_lock_irqsave(lk, flags);
+    }
+  }
+
+  hyp_timer_program(*q);
+
+  spin_unlock_irqrestore(lk, flags);
+}
+
+u64 usecs_to_cycles(u64 us) {
+  return cpu_hz * us / 1000000;
+}
+
+u64 cycles_to_usecs(u64 cycles) {
+  return cycles * 1000000 / cpu_hz;
+}
+
+void timer_event_init(struct timer_event *ev, void (*handler)(struct timer_event *),
+                      void *arg) {
+  ev->next = NULL;
+  ev->expire = 0;
+  ev->handler = handler;
+  ev->arg = arg;
+  ev->pending = false;
+  ev->cpu = -1;
+}
+
+static void __timer_event_del(struct timer_event **q, struct timer_event *ev) {
+  struct timer_event **p;
+
+  for(p = q; *p; p = &(*p)->next) {
+    if(*p == ev) {
+      *p = ev->next;
+      break;
+    }
+  }
+
+  ev->next = NULL;
+  ev->pending = false;
+}
+
+/*
+ *  unlink pending @ev from the queue of the cpu it was added on.
+ *  the timer of other cpu is left programmed: it fires once for nothing.
+ *  must be called with irq disabled
+ */
+static void timer_event_unlink(struct timer_event *ev) {
+  int cpu = ev->cpu;
+
+  if(cpu < 0)
+    return;
+
+  spin_lock(&timerq_lock[cpu]);
+
+  if(ev->pending && ev->cpu == cpu) {
+    __timer_event_del(&timerq[cpu], ev);
+
+    if(cpu == cpuid())
+      hyp_timer_program(timerq[cpu]);
+  }
+
+  spin_unlock(&timerq_lock[cpu]);
+}
+
+/*
+ *  fire @ev at @expire (in cycles) on this cpu, moving it from other cpu if
+ *  pending there.  adds of the same event must not race each other.
+ *  handler is called in interrupt context; NULL handler only wakes up the cpu
+ */
+void timer_event_add(struct timer_event *ev, u64 expire) {
+  int cpu = cpuid();
+  struct timer_event **q = &timerq[cpu];
+  struct timer_event **p;
+  u64 flags;
+
+  irqsave(flags);
+
+  if(ev->pending)
+    timer_event_unlink(ev);
+
+  spin_lock(&timerq_lock[cpu]);
+
+  ev->expire = expire;
+  ev->pending = true;
+  ev->cpu = cpu;
+
+  for(p = q; *p && (*p)->expire <= expire; p = &(*p)->next)
+    ;
+
+  ev->next = *p;
+  *p = ev;
+
+  hyp_timer_program(*q);
+
+  spin_unlock(&timerq_lock[cpu]);
+
+  irqrestore(flags);
+}
+
+/* may be called on any cpu */
+void timer_event_del(struct timer_event *ev) {
+  u64 flags;
+
+  irqsave(flags);
+
+  if(ev->pending)
+    timer_event_unlink(ev);
+
+  irqrestore(flags);
 }
 
 void usleep(int us) {
@@ -28,11 +180,17 @@ void arch_timer_init_core() {
   u64 ctl = CNTHP_CTL_EL2_IMASK | CNTHP_CTL_EL2_ENABLE;
 
   write_sysreg(cnthp_ctl_el2, ctl);
+
+  /* PPI: enable on each cpu */
+  localnode.irqchip->enable_irq(HYP_TIMER_IRQ);
 }
 
 void arch_timer_init() {
+  for(int i = 0; i < NCPU_MAX; i++)
+    spinlock_init(&timerq_lock[i]);
+
   cpu_hz = read_sysreg(cntfrq_el0);
   printf("CPU %d Hz\n", cpu_hz);
 
-  irq_register(26, hyp_timer_intr, NULL);
+  irq_register(HYP_TIMER_IRQ, hyp_timer_intr, NULL);
 }
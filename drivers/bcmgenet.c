@@ -245,6 +245,7 @@ static inline void bcmgenet_bp_mc_set(u32 val) {
 
 static struct bcmgenet_cb *get_txcb(struct bcmgenet_tx_ring *ring);
 static void bcmgenet_intr_disable(void);
+static int bcmgenet_set_mcast_filter(struct nic *nic, u8 (*macs)[6], int n);
 static struct iobuf *rx_refill(struct bcmgenet_cb *cb);
 
 static void bcmgenet_xmit(struct nic *nic, struct iobuf *iobuf) {
@@ -382,12 +383,9 @@ static u32 tx_reclaim(struct bcmgenet_tx_ring *ring) {
 }
 
 
-static int bcmgenet_rxintr(void) {
-  int ret = -1;
-
+static int bcmgenet_rx_poll(struct nic *nic, int budget) {
   struct bcmgenet_rx_ring *ring = &m_rx_rings[GENET_DESC_INDEX]; // the only supported Rx queue
-
-  printf("bcmgenet: rxintr\n");
+  int npkt = 0;
 
   bcmgenet_intrl2_0_writel(UMAC_IRQ_RXDMA_DONE, INTRL2_CPU_CLEAR);
 
@@ -409,17 +407,20 @@ static int bcmgenet_rxintr(void) {
   p_index &= DMA_P_INDEX_MASK;
 
   unsigned rxpkttoprocess = (p_index - ring->c_index) & DMA_C_INDEX_MASK;
-  if (rxpkttoprocess > 0) {
+  while (rxpkttoprocess > 0 && npkt < budget) {
     u32 dma_length_status;
     u32 dma_flag;
     int nLength;
 
+    rxpkttoprocess--;
+    npkt++;
+
     struct bcmgenet_cb *cb = &m_rx_cbs[ring->read_ptr];
 
     struct iobuf *pRxBuffer = rx_refill(cb);
     if (!pRxBuffer) {
       printf("Missing RX buffer!");
-      goto out;
+      goto next;
     }
 
     dma_length_status = dmadesc_get_length_status(cb->bd_addr);
@@ -430,7 +431,7 @@ static int bcmgenet_rxintr(void) {
       printf("Dropping fragmented RX packet!");
       free_iobuf(pRxBuffer);
 
-      goto out;
+      goto next;
     }
 
     // report errors
@@ -438,7 +439,7 @@ static int bcmgenet_rxintr(void) {
       printf("RX error (0x%x)", (unsigned)dma_flag);
       free_iobuf(pRxBuffer);
 
-      goto out;
+      goto next;
     }
 
     iobuf_set_len(pRxBuffer, nLength);
@@ -460,11 +461,8 @@ static int bcmgenet_rxintr(void) {
 //}
     
     netdev_recv(pRxBuffer);
-    
 
-    ret = 0;
-
-out:
+next:
     if (ring->read_ptr < ring->end_ptr) {
       ring->read_ptr++;
     } else {
@@ -475,7 +473,14 @@ out:
     bcmgenet_rdma_ring_writel(ring->index, ring->c_index, RDMA_CONS_INDEX);
   }
 
-  return ret;
+  return npkt;
+}
+
+static void bcmgenet_rx_irq_enable(struct nic *nic, bool enable) {
+  if (enable)
+    bcmgenet_intrl2_0_writel(UMAC_IRQ_RXDMA_DONE, INTRL2_CPU_MASK_CLEAR);
+  else
+    bcmgenet_intrl2_0_writel(UMAC_IRQ_RXDMA_DONE, INTRL2_CPU_MASK_SET);
 }
 
 static void bcmgenet_intr_irq0(void *arg) {
@@ -498,7 +503,7 @@ static void bcmgenet_intr_irq0(void *arg) {
 
   if (status & UMAC_IRQ_RXDMA_DONE) {
     // bcmgenet_intrl2_0_writel(UMAC_IRQ_RXDMA_DONE, INTRL2_CPU_CLEAR);
-    bcmgenet_rxintr();
+    netdev_rx_irq();
   }
 }
 
@@ -529,8 +534,20 @@ static void bcmgenet_intr_irq1(void *arg) {
   }
 }
 
+static int bcmgenet_rx_room(struct nic *nic) {
+  struct bcmgenet_rx_ring *ring = &m_rx_rings[GENET_DESC_INDEX];
+  unsigned p_index = bcmgenet_rdma_ring_readl(ring->index, RDMA_PROD_INDEX) & DMA_P_INDEX_MASK;
+
+  /* received but not processed yet */
+  return GENET_Q16_RX_BD_CNT - ((p_index - ring->c_index) & DMA_C_INDEX_MASK);
+}
+
 static struct nic_ops bcmgenet_ops = {
   .xmit = bcmgenet_xmit,
+  .rx_room = bcmgenet_rx_room,
+  .poll = bcmgenet_rx_poll,
+  .rx_irq_enable = bcmgenet_rx_irq_enable,
+  .set_mcast_filter = bcmgenet_set_mcast_filter,
 };
 
 static void umac_reset() {
@@ -1264,6 +1281,26 @@ static void set_rx_mode(u8 *mac) {
   set_mdf_addr(mac, &i, &mc);
 }
 
+static int bcmgenet_set_mcast_filter(struct nic *nic, u8 (*macs)[6], int n) {
+  u8 Buffer_BR[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+  int i = 0;
+  int mc = 0;
+
+  // broadcast and my own address come first
+  if (n + 2 > MAX_MC_COUNT + 1)
+    return -1;
+
+  bcmgenet_umac_writel(0, UMAC_MDF_CTRL);
+
+  set_mdf_addr(Buffer_BR, &i, &mc);
+  set_mdf_addr(nic->mac, &i, &mc);
+
+  for (int k = 0; k < n; k++)
+    set_mdf_addr(macs[k], &i, &mc);
+
+  return 0;
+}
+
 static void umac_enable_set(u32 mask, bool enable) {
   u32 reg = bcmgenet_umac_readl(UMAC_CMD);
   if (enable)
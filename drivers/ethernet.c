@@ -1,48 +1,62 @@
+/*
+ *  ethernet transport: frames go through nic
+ */
+
 #include "ethernet.h"
 #include "aarch64.h"
 #include "net.h"
-#include "mm.h"
+#include "transport.h"
 #include "lib.h"
-#include "allocpage.h"
-#include "malloc.h"
 #include "log.h"
-#include "msg.h"
-#include "localnode.h"
 
 u8 bcast_mac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
-u8 zeromac[6] = {0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
 
-void ether_send_packet(struct nic *nic, u8 *dst_mac, u16 type, struct iobuf *buf) {
-  struct etherheader *eth = iobuf_push(buf, sizeof(struct etherheader));
-  if(!eth)
-    panic("eth");
+static void ether_xmit(struct transport *tp, struct iobuf *buf) {
+  struct nic *nic = tp->priv;
 
-  memcpy(eth->dst, dst_mac, 6);
-  memcpy(eth->src, localnode.nic->mac, 6);
-  eth->type = type;
+  nic->ops->xmit(nic, buf);
+}
 
-  buf->eth = eth;
+static int ether_rx_room(struct transport *tp) {
+  return netdev_rx_room();
+}
 
-  nic->ops->xmit(nic, buf);
+static int ether_poll(struct transport *tp) {
+  return netdev_poll();
 }
 
-void ethernet_recv_intr(struct nic *nic, struct iobuf *iobuf) {
-  struct etherheader *eth = iobuf_pull(iobuf, sizeof(struct etherheader));
-  int need_free_body = 1;
+static void ether_set_poll_owner(struct transport *tp, int cpu) {
+  netdev_set_poll_owner(cpu);
+}
 
-  iobuf->eth = eth;
+static int ether_set_mcast_filter(struct transport *tp, u8 (*addrs)[6], int n) {
+  return netdev_set_mcast_filter(addrs, n);
+}
 
-  vmm_log("ether: recv intr from %m %p %p\n", eth->src, eth->type, read_sysreg(elr_el2));
+static struct transport_ops ether_transport_ops = {
+  .xmit = ether_xmit,
+  .rx_room = ether_rx_room,
+  .poll = ether_poll,
+  .set_poll_owner = ether_set_poll_owner,
+  .set_mcast_filter = ether_set_mcast_filter,
+};
 
-  if(memcmp(eth->dst, bcast_mac, 6) == 0 || memcmp(eth->dst, nic->mac, 6) == 0) {
-    if((eth->type & 0xff) == 0x19) {
-      msg_recv(eth->src, iobuf);
+static struct transport ether_transport;
 
-      return;
-    }
-  } else if(memcmp(eth->dst, zeromac, 6) == 0) {
-    panic("packet from hell!");
-  }
+void ethernet_recv_intr(struct nic *nic, struct iobuf *iobuf) {
+  transport_recv(&ether_transport, iobuf);
+}
 
-  free_iobuf(iobuf);
+void ethernet_transport_init(struct nic *nic) {
+  ether_transport.name = nic->name;
+  memcpy(ether_transport.addr, nic->mac, 6);
+  ether_transport.mtu = nic->mtu;
+  /* multicast frames reach every port unless nic filters them */
+  ether_transport.caps = TRANSPORT_CAP_MCAST;
+  if(nic->ops->poll)
+    ether_transport.caps |= TRANSPORT_CAP_POLL;
+  ether_transport.ops = &ether_transport_ops;
+  ether_transport.priv = nic;
+
+  transport_register(&ether_transport);
 }
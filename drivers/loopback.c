@@ -0,0 +1,334 @@
+/*
+ *  loopback transport over shared memory
+ */
+
+#include "types.h"
+#include "aarch64.h"
+#include "loopback.h"
+#include "transport.h"
+#include "ethernet.h"
+#include "net.h"
+#include "msg.h"
+#include "spinlock.h"
+#include "arch-timer.h"
+#include "pcpu.h"
+#include "lib.h"
+#include "log.h"
+#include "panic.h"
+#include "allocpage.h"
+
+struct loopback {
+  struct loopback_shm *shm;
+  int port;
+  /* cpus of this node share rings of my port */
+  spinlock_t tx_lock;
+  spinlock_t rx_lock;
+  /* cpu which owns rx rings and polls them all the time, or -1 */
+  int poll_owner;
+  struct timer_event poll_timer;
+};
+
+static struct loopback loopback;
+static struct transport loopback_transport;
+
+/* 02:'l':'o':'o':'p':<port> */
+static void loopback_port_addr(u8 *addr, int port) {
+  addr[0] = 0x02;
+  addr[1] = 'l';
+  addr[2] = 'o';
+  addr[3] = 'o';
+  addr[4] = 'p';
+  addr[5] = port;
+}
+
+static int loopback_addr_port(u8 *addr) {
+  u8 a[6];
+
+  loopback_port_addr(a, 0);
+
+  if(memcmp(a, addr, 5) != 0 || addr[5] >= LOOPBACK_PORTS)
+    return -1;
+
+  return addr[5];
+}
+
+static bool loopback_port_member(struct loopback_port *p, u8 *group) {
+  for(u32 i = 0; i < p->ngroups && i < LOOPBACK_GROUPS_MAX; i++) {
+    if(memcmp(p->groups[i], group, 6) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+/* copy frame @buf to ring: drop it if full, as nic without rx buffers does */
+static void loopback_put(struct loopback_ring *r, struct iobuf *buf) {
+  u32 head = *(volatile u32 *)&r->head;
+  struct loopback_slot *s;
+
+  if(r->tail - head == LOOPBACK_SLOTS)
+    return;
+
+  s = &r->slot[r->tail % LOOPBACK_SLOTS];
+
+  memcpy(s->data, buf->data, buf->len);
+  s->len = buf->len;
+
+  if(buf->body && buf->body_len)
+    memcpy(s->body, buf->body, buf->body_len);
+  s->body_len = buf->body ? buf->body_len : 0;
+
+  /* publish slot before tail */
+  dmb(sy);
+  *(volatile u32 *)&r->tail = r->tail + 1;
+}
+
+/* must be held tx_lock */
+static void __loopback_xmit(struct loopback *lo, struct iobuf *buf) {
+  struct etherheader *eth = buf->data;
+  bool bcast = memcmp(eth->dst, bcast_mac, 6) == 0;
+  u8 mask;
+  bool group = msg_mcast_group(eth->dst, &mask);
+  int dst = loopback_addr_port(eth->dst);
+
+  if(buf->len > LOOPBACK_HDR_MAX || buf->body_len > PAGESIZE) {
+    vmm_warn("loopback: too large frame %d %d\n", buf->len, buf->body_len);
+    return;
+  }
+
+  for(int p = 0; p < LOOPBACK_PORTS; p++) {
+    struct loopback_port *port = &lo->shm->port[p];
+
+    if(p == lo->port || !*(volatile u32 *)&port->up)
+      continue;
+
+    if(bcast || p == dst || (group && loopback_port_member(port, eth->dst)))
+      loopback_put(&lo->shm->ring[lo->port][p], buf);
+  }
+}
+
+static void loopback_xmit(struct transport *tp, struct iobuf *buf) {
+  struct loopback *lo = tp->priv;
+  u64 flags;
+
+  spin_lock_irqsave(&lo->tx_lock, flags);
+  __loopback_xmit(lo, buf);
+  spin_unlock_irqrestore(&lo->tx_lock, flags);
+
+  /* copied: tx is completed */
+  free_iobuf(buf);
+}
+
+static void loopback_xmit_batch(struct transport *tp, struct iobuf *buf) {
+  struct loopback *lo = tp->priv;
+  struct iobuf *next;
+  u64 flags;
+
+  spin_lock_irqsave(&lo->tx_lock, flags);
+
+  for(struct iobuf *b = buf; b; b = b->next)
+    __loopback_xmit(lo, b);
+
+  spin_unlock_irqrestore(&lo->tx_lock, flags);
+
+  for(; buf; buf = next) {
+    next = buf->next;
+    buf->next = NULL;
+    free_iobuf(buf);
+  }
+}
+
+static int loopback_ring_room(struct loopback_ring *r) {
+  return LOOPBACK_SLOTS - (*(volatile u32 *)&r->tail - r->head);
+}
+
+/* each source has own ring: room is of the fullest ring of ports up */
+static int loopback_rx_room(struct transport *tp) {
+  struct loopback *lo = tp->priv;
+  int room = LOOPBACK_SLOTS;
+
+  for(int p = 0; p < LOOPBACK_PORTS; p++) {
+    struct loopback_ring *r = &lo->shm->ring[p][lo->port];
+
+    if(p != lo->port && *(volatile u32 *)&lo->shm->port[p].up)
+      room = min(room, loopback_ring_room(r));
+  }
+
+  return room;
+}
+
+static int loopback_rx_room_from(struct transport *tp, u8 *src) {
+  struct loopback *lo = tp->priv;
+  int p = loopback_addr_port(src);
+
+  if(p < 0 || p == lo->port)
+    return 0;
+
+  return loopback_ring_room(&lo->shm->ring[p][lo->port]);
+}
+
+static struct iobuf *loopback_get(struct loopback_ring *r) {
+  struct loopback_slot *s = &r->slot[r->head % LOOPBACK_SLOTS];
+  struct iobuf *buf;
+
+  /* keep msg hdr 8 byte aligned as in rx buffer of nic */
+  buf = alloc_iobuf_headsize(2 + s->len, 2);
+  if(!buf)
+    return NULL;
+
+  memcpy(buf->data, s->data, s->len);
+
+  if(s->body_len) {
+    buf->body = alloc_page();
+    if(!buf->body) {
+      free_iobuf(buf);
+      return NULL;
+    }
+
+    memcpy(buf->body, s->body, s->body_len);
+    buf->body_len = s->body_len;
+  }
+
+  return buf;
+}
+
+/* must be held rx_lock */
+static int __loopback_poll(struct loopback *lo) {
+  struct iobuf *buf;
+  int n = 0;
+
+  for(int p = 0; p < LOOPBACK_PORTS; p++) {
+    struct loopback_ring *r = &lo->shm->ring[p][lo->port];
+
+    if(p == lo->port)
+      continue;
+
+    while(n < NET_POLL_BUDGET && r->head != *(volatile u32 *)&r->tail) {
+      /* read slot after tail */
+      dmb(sy);
+
+      buf = loopback_get(r);
+
+      /* slot is free to be reused */
+      dmb(sy);
+      *(volatile u32 *)&r->head = r->head + 1;
+      n++;
+
+      if(buf)
+        transport_recv(&loopback_transport, buf);
+    }
+  }
+
+  return n;
+}
+
+static int loopback_poll(struct transport *tp) {
+  struct loopback *lo = tp->priv;
+  u64 flags;
+  int n;
+
+  /* rings are owned by another cpu */
+  if(lo->poll_owner >= 0 && lo->poll_owner != cpuid())
+    return 0;
+
+  spin_lock_irqsave(&lo->rx_lock, flags);
+  n = __loopback_poll(lo);
+  spin_unlock_irqrestore(&lo->rx_lock, flags);
+
+  return n;
+}
+
+/* no rx irq on shared memory: rings are polled periodically */
+static void loopback_poll_timer(struct timer_event *ev) {
+  struct loopback *lo = ev->arg;
+
+  if(lo->poll_owner >= 0)
+    return;
+
+  loopback_poll(&loopback_transport);
+
+  timer_event_add(ev, now_cycles() + usecs_to_cycles(LOOPBACK_POLL_US));
+}
+
+static void loopback_set_poll_owner(struct transport *tp, int cpu) {
+  struct loopback *lo = tp->priv;
+  u64 flags;
+
+  spin_lock_irqsave(&lo->rx_lock, flags);
+  lo->poll_owner = cpu;
+  spin_unlock_irqrestore(&lo->rx_lock, flags);
+}
+
+static int loopback_set_mcast_filter(struct transport *tp, u8 (*addrs)[6], int n) {
+  struct loopback *lo = tp->priv;
+  struct loopback_port *port = &lo->shm->port[lo->port];
+
+  if(n > LOOPBACK_GROUPS_MAX)
+    return -1;
+
+  /* senders see the new groups after ngroups */
+  port->ngroups = 0;
+  dmb(sy);
+
+  memcpy(port->groups, addrs, n * 6);
+
+  dmb(sy);
+  port->ngroups = n;
+
+  return 0;
+}
+
+static struct transport_ops loopback_transport_ops = {
+  .xmit = loopback_xmit,
+  .xmit_batch = loopback_xmit_batch,
+  .rx_room = loopback_rx_room,
+  .rx_room_from = loopback_rx_room_from,
+  .poll = loopback_poll,
+  .set_poll_owner = loopback_set_poll_owner,
+  .set_mcast_filter = loopback_set_mcast_filter,
+};
+
+/*
+ *  attach this node to port @port of loopback region @shm (zeroed by whoever
+ *  created it) and make it the transport of this node
+ */
+void loopback_init(void *shm, int port) {
+  struct loopback *lo = &loopback;
+  struct loopback_port *p;
+
+  if(port < 0 || port >= LOOPBACK_PORTS)
+    panic("loopback: invalid port %d", port);
+
+  lo->shm = shm;
+  lo->port = port;
+  spinlock_init(&lo->tx_lock);
+  spinlock_init(&lo->rx_lock);
+  lo->poll_owner = -1;
+
+  p = &lo->shm->port[port];
+  if(p->up)
+    vmm_warn("loopback: port %d already up\n", port);
+
+  /* frames left in my rings are stale */
+  for(int s = 0; s < LOOPBACK_PORTS; s++) {
+    struct loopback_ring *r = &lo->shm->ring[s][port];
+    r->head = r->tail;
+  }
+
+  p->ngroups = 0;
+  dmb(sy);
+  p->up = 1;
+
+  loopback_transport.name = "loopback";
+  loopback_port_addr(loopback_transport.addr, port);
+  /* a full page of body per frame */
+  loopback_transport.mtu = ETH_POCV2_MSG_HDR_SIZE - sizeof(struct etherheader) + PAGESIZE;
+  loopback_transport.caps = TRANSPORT_CAP_MCAST | TRANSPORT_CAP_POLL;
+  loopback_transport.ops = &loopback_transport_ops;
+  loopback_transport.priv = lo;
+
+  transport_register(&loopback_transport);
+
+  timer_event_init(&lo->poll_timer, loopback_poll_timer, lo);
+  timer_event_add(&lo->poll_timer, now_cycles() + usecs_to_cycles(LOOPBACK_POLL_US));
+}
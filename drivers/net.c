@@ -8,9 +8,27 @@
 #include "allocpage.h"
 #include "malloc.h"
 #include "assert.h"
+#include "atomic.h"
+#include "arch-timer.h"
 
 static struct nic netdev;
 
+/*
+ *  rx interrupt mitigation (NAPI style)
+ *  rx irq only switches nic to polling mode: irq is masked and rx ring is
+ *  polled by NET_POLL_BUDGET frames per round.  while rounds use up the budget
+ *  the ring is busy and polled again by poll_timer; once a round finds the
+ *  ring drained, rx irq is unmasked.
+ *  a cpu waiting for a reply polls the ring by itself (netdev_poll()).
+ */
+static spinlock_t poll_lock = SPINLOCK_INIT;
+static bool poll_armed;
+/* cpu which owns rx ring and polls it all the time, or -1 */
+static int poll_owner = -1;
+static struct timer_event poll_timer;
+
+static void poll_timer_handler(struct timer_event *ev);
+
 static inline int fls(unsigned int n) {
   return sizeof(n) * 8 - __builtin_clz(n);
 }
@@ -31,7 +49,11 @@ void net_init(char *name, u8 *mac, int mtu, void *dev, struct nic_ops *ops) {
 
   localnode.nic = &netdev;
 
+  timer_event_init(&poll_timer, poll_timer_handler, NULL);
+
   printf("found nic: %s @%m\n", name, netdev.mac);
+
+  ethernet_transport_init(&netdev);
 }
 
 static struct iobuf *alloc_iobuf_pages(u32 size, u32 headsize) {
@@ -52,6 +74,9 @@ static struct iobuf *alloc_iobuf_pages(u32 size, u32 headsize) {
 
   buf->body = NULL;
   buf->body_len = 0;
+  buf->body_pinned = false;
+  buf->refcnt = 1;
+  buf->next = NULL;
   buf->npages = npages;
 
   return buf;
@@ -79,21 +104,38 @@ struct iobuf *alloc_iobuf_headsize(u32 size, u32 headsize) {
 
   buf->body = NULL;
   buf->body_len = 0;
+  buf->body_pinned = false;
+  buf->refcnt = 1;
+  buf->next = NULL;
   buf->npages = 0;
 
   return buf;
 }
 
+struct iobuf *iobuf_get(struct iobuf *buf) {
+  atomic_inc32(&buf->refcnt);
+
+  return buf;
+}
+
 void free_iobuf(struct iobuf *buf) {
   assert(buf);
 
+  /* still referenced */
+  if(atomic_dec32(&buf->refcnt) != 1)
+    return;
+
   if(buf->npages)
     free_pages(buf->head, ilog2(buf->npages));
   else
     free(buf->head);
 
-  if(buf->body)
-    free_page(buf->body);
+  if(buf->body) {
+    if(buf->body_pinned)
+      page_unpin(buf->body);
+    else
+      free_page(buf->body);
+  }
 
   free(buf);
 }
@@ -128,6 +170,108 @@ void *iobuf_pull(struct iobuf *buf, u32 size) {
   return old;
 }
 
+int netdev_set_mcast_filter(u8 (*macs)[6], int n) {
+  if(!netdev.ops || !netdev.ops->set_mcast_filter)
+    return -1;
+
+  return netdev.ops->set_mcast_filter(&netdev, macs, n);
+}
+
+int netdev_rx_room() {
+  if(!netdev.ops || !netdev.ops->rx_room)
+    return -1;
+
+  return netdev.ops->rx_room(&netdev);
+}
+
 void netdev_recv(struct iobuf *buf) {
   ethernet_recv_intr(&netdev, buf);
 }
+
+/* called with poll_lock held */
+static int __netdev_poll(void) {
+  return netdev.ops->poll(&netdev, NET_POLL_BUDGET);
+}
+
+static void netdev_poll_round() {
+  u64 flags;
+
+  spin_lock_irqsave(&poll_lock, flags);
+
+  poll_armed = false;
+
+  if(poll_owner >= 0)
+    goto out;
+
+  if(__netdev_poll() == NET_POLL_BUDGET)
+    goto busy;
+
+  /* ring drained: back to interrupt */
+  netdev.ops->rx_irq_enable(&netdev, true);
+
+  /* frames arrived while irq was masked raise no irq */
+  if(__netdev_poll() < NET_POLL_BUDGET)
+    goto out;
+
+  netdev.ops->rx_irq_enable(&netdev, false);
+
+busy:
+  if(!poll_armed) {
+    poll_armed = true;
+    timer_event_add(&poll_timer, now_cycles() + usecs_to_cycles(NET_POLL_US));
+  }
+
+out:
+  spin_unlock_irqrestore(&poll_lock, flags);
+}
+
+static void poll_timer_handler(struct timer_event *ev) {
+  netdev_poll_round();
+}
+
+/* rx interrupt of nic: called by driver in interrupt context */
+void netdev_rx_irq() {
+  netdev.ops->rx_irq_enable(&netdev, false);
+
+  if(poll_owner < 0)
+    netdev_poll_round();
+}
+
+/* from now on only @cpu receives frames, by netdev_poll() without rx irq */
+void netdev_set_poll_owner(int cpu) {
+  u64 flags;
+
+  if(!netdev.ops || !netdev.ops->poll)
+    panic("net: %s cannot be polled", netdev.name);
+
+  spin_lock_irqsave(&poll_lock, flags);
+
+  poll_owner = cpu;
+  netdev.ops->rx_irq_enable(&netdev, false);
+
+  spin_unlock_irqrestore(&poll_lock, flags);
+}
+
+/*
+ *  receive frames from rx ring without waiting for rx irq
+ *  return number of frames received, or -1 if nic does not support polling
+ */
+int netdev_poll() {
+  u64 flags;
+  int n;
+
+  if(!netdev.ops || !netdev.ops->poll)
+    return -1;
+
+  /* rx ring is owned by another cpu */
+  if(poll_owner >= 0 && poll_owner != cpuid())
+    return 0;
+
+  spin_lock_irqsave(&poll_lock, flags);
+
+  n = __netdev_poll();
+
+  spin_unlock_irqrestore(&poll_lock, flags);
+
+  return n;
+}
@@ -63,8 +63,7 @@ static void pl011_intr(__unused void *arg) {
       if(c < 0)
         break;
 
-      if(c == 'p')
-        panic("syspanic");
+      uart_hotkey(c);
     }
   }
 
@@ -109,12 +108,13 @@ static int pl011_dt_init(struct device_node *dev) {
 
   pl011_write(LCRH, LCRH_WLEN_8BIT);
 
-  pl011_write(IMSC, 0);
+  /* console hotkeys */
+  pl011_write(IMSC, INT_RX_ENABLE);
 
   /* enable uart */
   pl011_write(CR, 0x301);   /* RXE, TXE, UARTEN */
 
-  // irq_register(intr, pl011_intr, NULL);
+  irq_register(intr, pl011_intr, NULL);
   localnode.uart = &pl011;
 
   printf("pl011 detected: %p\n", uartbase);
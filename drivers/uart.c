@@ -2,6 +2,15 @@
 #include "uart.h"
 #include "device.h"
 #include "localnode.h"
+#include "pcpu.h"
+#include "atomic.h"
+#include "panic.h"
+#include "vsm-stat.h"
+#include "vsm-trace.h"
+#include "msg.h"
+#include "msg-stat.h"
+#include "cluster-stat.h"
+#include "clocksync.h"
 
 static const struct dt_device sentinel __used __section("__dt_serial_sentinel");
 
@@ -15,6 +24,72 @@ void uart_puts(char *s) {
   localnode.uart->puts(s);
 }
 
+/* hotkeys typed on the console, bit (c - 'a') */
+static u64 hotkey_pending;
+
+/* called from the uart irq: the dump itself is left to uart_flush() */
+void uart_hotkey(int c) {
+  u64 old;
+
+  if(c == 'p')
+    panic("syspanic");
+
+  if(c < 'a' || c > 'z')
+    return;
+
+  do {
+    old = hotkey_pending;
+  } while(!atomic_cmpxchg64(&hotkey_pending, old, old | (1ul << (c - 'a'))));
+}
+
+static void uart_run_hotkey(int c) {
+  switch(c) {
+    case 's':
+      vsm_stat_dump();
+      break;
+    case 'l':
+      msg_link_stat_dump();
+      break;
+    case 'm':
+      msg_stat_dump();
+      break;
+    case 'c':
+      if(local_nodeid() == 0)
+        cluster_stat_collect();
+      break;
+    case 't':
+      vsm_trace_dump();
+      break;
+    case 'k':
+      clocksync_dump();
+      break;
+  }
+}
+
+/*
+ *  run the hotkeys requested since the last call
+ *  called at the end of irq_entry() with irqs disabled
+ */
+void uart_flush() {
+  u64 keys;
+
+  if(!hotkey_pending || in_interrupt() || in_lazyirq())
+    return;
+
+  if(!(keys = atomic_xchg64(&hotkey_pending, 0)))
+    return;
+
+  /* dumps print a lot and may wait for replies */
+  local_irq_enable();
+
+  for(int c = 'a'; c <= 'z'; c++) {
+    if(keys & (1ul << (c - 'a')))
+      uart_run_hotkey(c);
+  }
+
+  local_irq_disable();
+}
+
 void uart_init() {
   struct device_node *n;
   struct dt_device *dev;
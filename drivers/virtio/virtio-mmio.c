@@ -106,6 +106,8 @@ int vtmmio_negotiate(struct virtio_mmio_dev *dev, u64 features) {
   if(!(vtmmio_read(dev, VIRTIO_MMIO_STATUS) & DEV_STATUS_FEATURES_OK))
     return -1;
 
+  dev->features = features;
+
   return 0;
 }
 
@@ -13,6 +13,7 @@
 #include "irq.h"
 #include "panic.h"
 #include "memlayout.h"
+#include "cache.h"
 
 static struct virtio_net vtnet_dev;
 
@@ -84,8 +85,13 @@ static void fill_recv_queue(struct virtq *rxq) {
 
   while(dev->n_rxbuf < NQUEUE/2) {
     struct iobuf *iobuf = alloc_iobuf(hdr_len);
+
+    /* body is received into a page frame which msg layer takes as is */
     iobuf->body = alloc_page();
-    iobuf->body_len = 4096;
+    iobuf->body_len = PAGESIZE;
+
+    /* prepare for DMA */
+    dcache_flush_poc_range(iobuf->body, PAGESIZE);
 
     qs[0] = (struct qlist){ iobuf->data, iobuf->len };
     qs[1] = (struct qlist){ iobuf->body, iobuf->body_len };
@@ -97,24 +103,147 @@ static void fill_recv_queue(struct virtq *rxq) {
 }
 
 static void rxintr(struct virtq *rxq) {
-  struct virtio_net *dev = rxq->dev->priv;
+  netdev_rx_irq();
+}
+
+static int virtio_net_poll(struct nic *nic, int budget) {
+  struct virtio_net *dev = nic->device;
+  struct virtq *rxq = dev->rx;
   struct iobuf *iobuf;
   u32 len;
+  int n = 0;
 
-  while((iobuf = virtq_dequeue(rxq, &len)) != NULL) {
+  while(n < budget && (iobuf = virtq_dequeue(rxq, &len)) != NULL) {
     iobuf->body_len = len - iobuf->len;
     iobuf_pull(iobuf, sizeof(struct virtio_net_hdr));
 
     dev->n_rxbuf--;
+    n++;
 
     netdev_recv(iobuf);
   }
 
-  fill_recv_queue(rxq);
+  if(n)
+    fill_recv_queue(rxq);
+
+  return n;
+}
+
+static void virtio_net_rx_irq_enable(struct nic *nic, bool enable) {
+  struct virtio_net *dev = nic->device;
+
+  if(enable)
+    dev->rx->avail->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+  else
+    dev->rx->avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+  dsb(sy);
+}
+
+static void ctrlintr(struct virtq *ctrlq) {
+  /* completion is polled by virtio_net_ctrl() */
+}
+
+/*
+ *  send a command via control virtqueue and wait for completion
+ *  @data: @len bytes of command specific data
+ */
+static int virtio_net_ctrl(struct virtio_net *dev, u8 class, u8 cmd, void *data, u32 len) {
+  struct virtio_net_ctrl_hdr *hdr;
+  u8 *cmddata, *ack;
+  struct qlist qs[3];
+  u64 flags;
+  int rc;
+
+  if(!dev->ctrl)
+    return -1;
+
+  if(len > PAGESIZE - 64)
+    return -1;
+
+  /* hdr, data and ack in one page */
+  hdr = alloc_page();
+  if(!hdr)
+    return -1;
+
+  cmddata = (u8 *)hdr + 16;
+  ack = (u8 *)hdr + 8;
+
+  hdr->class = class;
+  hdr->cmd = cmd;
+  memcpy(cmddata, data, len);
+  *ack = VIRTIO_NET_ERR;
+
+  qs[0] = (struct qlist){ hdr, sizeof(*hdr) };
+  qs[1] = (struct qlist){ cmddata, len };
+  qs[2] = (struct qlist){ ack, 1 };
+
+  spin_lock_irqsave(&dev->ctrl->lock, flags);
+
+  virtq_enqueue_inout(dev->ctrl, qs, 2, 1, hdr);
+  virtq_kick(dev->ctrl);
+
+  while(virtq_dequeue(dev->ctrl, NULL) == NULL)
+    ;
+
+  spin_unlock_irqrestore(&dev->ctrl->lock, flags);
+
+  rc = *(volatile u8 *)ack == VIRTIO_NET_OK ? 0 : -1;
+
+  free_page(hdr);
+
+  return rc;
+}
+
+static int virtio_net_set_mcast_filter(struct nic *nic, u8 (*macs)[6], int n) {
+  struct virtio_net *dev = nic->device;
+  struct virtio_net_ctrl_mac *uc, *mc;
+  u32 len = sizeof(*uc) + sizeof(*mc) + n * 6;
+  u8 off = 0;
+  u8 *tbl;
+  int rc = -1;
+
+  if(!(dev->dev->features & (1 << VIRTIO_NET_F_CTRL_RX)))
+    return -1;
+
+  tbl = malloc(len);
+  if(!tbl)
+    return -1;
+
+  /* unicast table: own mac is always accepted */
+  uc = (struct virtio_net_ctrl_mac *)tbl;
+  uc->entries = 0;
+
+  mc = (struct virtio_net_ctrl_mac *)(tbl + sizeof(*uc));
+  mc->entries = n;
+  memcpy(mc->macs, macs, n * 6);
+
+  if(virtio_net_ctrl(dev, VIRTIO_NET_CTRL_MAC, VIRTIO_NET_CTRL_MAC_TABLE_SET, tbl, len) < 0)
+    goto out;
+
+  /* filter by the table from now on */
+  if(virtio_net_ctrl(dev, VIRTIO_NET_CTRL_RX, VIRTIO_NET_CTRL_RX_PROMISC, &off, 1) < 0)
+    goto out;
+
+  rc = 0;
+
+out:
+  free(tbl);
+  return rc;
+}
+
+static int virtio_net_rx_room(struct nic *nic) {
+  struct virtio_net *dev = nic->device;
+
+  return dev->n_rxbuf;
 }
 
 static struct nic_ops virtio_net_ops = {
   .xmit = virtio_net_xmit,
+  .rx_room = virtio_net_rx_room,
+  .poll = virtio_net_poll,
+  .rx_irq_enable = virtio_net_rx_irq_enable,
+  .set_mcast_filter = virtio_net_set_mcast_filter,
 };
 
 int virtio_net_probe(struct virtio_mmio_dev *dev) {
@@ -132,6 +261,8 @@ int virtio_net_probe(struct virtio_mmio_dev *dev) {
   features |= 1 << VIRTIO_NET_F_MAC;
   features |= 1 << VIRTIO_NET_F_STATUS;
   features |= 1 << VIRTIO_NET_F_MTU;
+  features |= 1 << VIRTIO_NET_F_CTRL_VQ;
+  features |= 1 << VIRTIO_NET_F_CTRL_RX;
 
   if(vtmmio_negotiate(dev, features) < 0)
     panic("failed negotiate");
@@ -142,6 +273,11 @@ int virtio_net_probe(struct virtio_mmio_dev *dev) {
   virtq_reg_to_dev(vtnet_dev.rx);
   virtq_reg_to_dev(vtnet_dev.tx);
 
+  if(dev->features & (1 << VIRTIO_NET_F_CTRL_VQ)) {
+    vtnet_dev.ctrl = virtq_create(dev, 2, ctrlintr);
+    virtq_reg_to_dev(vtnet_dev.ctrl);
+  }
+
   // vtnet_dev.tx->avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
 
   fill_recv_queue(vtnet_dev.rx);
@@ -30,9 +30,11 @@ static void virtq_free_chain(struct virtq *vq, u16 n) {
   vq->free_head = head;
 }
 
-void virtq_enqueue(struct virtq *vq, struct qlist *qs, int nqs, void *x, bool in) {
+/* @nout device-readable buffers followed by @nin device-writable buffers */
+void virtq_enqueue_inout(struct virtq *vq, struct qlist *qs, int nout, int nin, void *x) {
   u16 head, idx;
   struct virtq_desc *desc;
+  int nqs = nout + nin;
 
   if(!x)
     panic("enqueue: xdata");
@@ -51,7 +53,7 @@ void virtq_enqueue(struct virtq *vq, struct qlist *qs, int nqs, void *x, bool in
     desc->flags = 0;
     if(i != nqs - 1)
       desc->flags |= VIRTQ_DESC_F_NEXT;
-    if(in)
+    if(i >= nout)
       desc->flags |= VIRTQ_DESC_F_WRITE;
   }
 
@@ -65,6 +67,13 @@ void virtq_enqueue(struct virtq *vq, struct qlist *qs, int nqs, void *x, bool in
   dsb(sy);
 }
 
+void virtq_enqueue(struct virtq *vq, struct qlist *qs, int nqs, void *x, bool in) {
+  if(in)
+    virtq_enqueue_inout(vq, qs, 0, nqs, x);
+  else
+    virtq_enqueue_inout(vq, qs, nqs, 0, x);
+}
+
 void *virtq_dequeue(struct virtq *vq, u32 *len) {
   u16 idx = vq->last_used_idx;
 
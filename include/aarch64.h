@@ -45,6 +45,7 @@
 
 #define isb()     asm volatile("isb");
 #define dsb(ty)   asm volatile("dsb " #ty);
+#define dmb(ty)   asm volatile("dmb " #ty ::: "memory");
 
 #define wfi()     asm volatile("wfi" ::: "memory");
 #define wfe()     asm volatile("wfe" ::: "memory");
@@ -1,6 +1,8 @@
 #ifndef ALLOCPAGE_H
 #define ALLOCPAGE_H
 
+#include "types.h"
+
 void pageallocator_init(void);
 void pagealloc_init_early(void);
 
@@ -12,4 +14,9 @@ void free_pages(void *pages, int order);
 
 #define free_page(p)  free_pages(p, 0)
 
+u64 nr_free_pages(void);
+
+bool page_pin(void *page);
+void page_unpin(void *page);
+
 #endif
@@ -4,14 +4,56 @@
 #include "types.h"
 #include "aarch64.h"
 
+/* one-shot event on hyp timer (EL2 physical timer) */
+struct timer_event {
+  struct timer_event *next;
+  u64 expire;       /* in cycles */
+  void (*handler)(struct timer_event *);
+  void *arg;
+  bool pending;
+  int cpu;          /* cpu whose queue holds the event while pending */
+};
+
 void arch_timer_init_core(void);
 
 void arch_timer_init(void);
 
 void usleep(int us);
 
+u64 usecs_to_cycles(u64 us);
+u64 cycles_to_usecs(u64 cycles);
+
+void timer_event_init(struct timer_event *ev, void (*handler)(struct timer_event *),
+                      void *arg);
+void timer_event_add(struct timer_event *ev, u64 expire);
+void timer_event_del(struct timer_event *ev);
+
 static inline u64 now_cycles() {
   return read_sysreg(cntpct_el0);
 }
 
+/*
+ *  sleep in wfi until @cond becomes true or @us elapse.
+ *  @cond must be updated by interrupt handler or receive path (at irq exit)
+ *  of this cpu, so check it with irq disabled to not lose the wakeup.
+ *  return value of @cond
+ */
+#define wait_event_timeout(cond, us)                            \
+  ({                                                            \
+    struct timer_event __ev;                                    \
+    bool __cond;                                                \
+    timer_event_init(&__ev, NULL, NULL);                        \
+    timer_event_add(&__ev, now_cycles() + usecs_to_cycles(us)); \
+    local_irq_disable();                                        \
+    while(!(__cond = !!(cond)) && __ev.pending) {               \
+      wfi();                                                    \
+      /* handle the interrupt which woke me up */               \
+      local_irq_enable();                                       \
+      local_irq_disable();                                      \
+    }                                                           \
+    local_irq_enable();                                         \
+    timer_event_del(&__ev);                                     \
+    __cond;                                                     \
+  })
+
 #endif
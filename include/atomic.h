@@ -0,0 +1,166 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "types.h"
+
+/*
+ *  atomic operations by exclusive load/store (ldxr/stxr)
+ */
+
+static inline u32 atomic_fetch_add32(u32 *p, u32 v) {
+  u32 old, new, tmp;
+
+  asm volatile(
+    "1: ldaxr %w0, [%3]\n"
+    "add    %w1, %w0, %w4\n"
+    "stlxr  %w2, %w1, [%3]\n"
+    "cbnz   %w2, 1b\n"
+    : "=&r"(old), "=&r"(new), "=&r"(tmp) : "r"(p), "r"(v) : "memory"
+  );
+
+  return old;
+}
+
+#define atomic_inc32(p)   atomic_fetch_add32(p, 1)
+#define atomic_dec32(p)   atomic_fetch_add32(p, -1)
+
+static inline u64 atomic_fetch_add64(u64 *p, u64 v) {
+  u64 old, new;
+  u32 tmp;
+
+  asm volatile(
+    "1: ldaxr %0, [%3]\n"
+    "add    %1, %0, %4\n"
+    "stlxr  %w2, %1, [%3]\n"
+    "cbnz   %w2, 1b\n"
+    : "=&r"(old), "=&r"(new), "=&r"(tmp) : "r"(p), "r"(v) : "memory"
+  );
+
+  return old;
+}
+
+/* store @new to *@p if *@p == @old: return true on success */
+static inline bool atomic_cmpxchg32(u32 *p, u32 old, u32 new) {
+  u32 cur, tmp;
+
+  asm volatile(
+    "1: ldaxr %w0, [%2]\n"
+    "cmp    %w0, %w3\n"
+    "b.ne   2f\n"
+    "stlxr  %w1, %w4, [%2]\n"
+    "cbnz   %w1, 1b\n"
+    "2:\n"
+    : "=&r"(cur), "=&r"(tmp) : "r"(p), "r"(old), "r"(new) : "cc", "memory"
+  );
+
+  return cur == old;
+}
+
+static inline bool atomic_cmpxchg64(u64 *p, u64 old, u64 new) {
+  u64 cur;
+  u32 tmp;
+
+  asm volatile(
+    "1: ldaxr %0, [%2]\n"
+    "cmp    %0, %3\n"
+    "b.ne   2f\n"
+    "stlxr  %w1, %4, [%2]\n"
+    "cbnz   %w1, 1b\n"
+    "2:\n"
+    : "=&r"(cur), "=&r"(tmp) : "r"(p), "r"(old), "r"(new) : "cc", "memory"
+  );
+
+  return cur == old;
+}
+
+/* store @new to *@p and return old value */
+static inline u64 atomic_xchg64(u64 *p, u64 new) {
+  u64 old;
+  u32 tmp;
+
+  asm volatile(
+    "1: ldaxr %0, [%2]\n"
+    "stlxr  %w1, %3, [%2]\n"
+    "cbnz   %w1, 1b\n"
+    : "=&r"(old), "=&r"(tmp) : "r"(p), "r"(new) : "memory"
+  );
+
+  return old;
+}
+
+static inline bool atomic_cmpxchg8(u8 *p, u8 old, u8 new) {
+  u32 cur, tmp;
+
+  asm volatile(
+    "1: ldaxrb %w0, [%2]\n"
+    "cmp    %w0, %w3\n"
+    "b.ne   2f\n"
+    "stlxrb %w1, %w4, [%2]\n"
+    "cbnz   %w1, 1b\n"
+    "2:\n"
+    : "=&r"(cur), "=&r"(tmp) : "r"(p), "r"((u32)old), "r"((u32)new) : "cc", "memory"
+  );
+
+  return cur == old;
+}
+
+/* try once to store @v to *@p if it is 0: return 0 on success */
+static inline u8 atomic_trylock8(u8 *p, u8 v) {
+  u8 r;
+
+  asm volatile(
+    "ldaxrb %w0, [%1]\n"
+    "cbnz   %w0, 1f\n"
+    "stxrb  %w0, %w2, [%1]\n"
+    "1:\n"
+    : "=&r"(r) : "r"(p), "r"(v) : "memory"
+  );
+
+  return r;
+}
+
+/* wait in wfe while *@p & @busy, then store @v to *@p: return old value */
+static inline u8 atomic_lock8(u8 *p, u8 busy, u8 v) {
+  u32 old, tmp;
+
+  asm volatile(
+    "sevl\n"
+    "1: wfe\n"
+    "2: ldaxrb %w0, [%2]\n"
+    "tst    %w0, %w3\n"
+    "b.ne   1b\n"
+    "stxrb  %w1, %w4, [%2]\n"
+    "cbnz   %w1, 2b\n"
+    : "=&r"(old), "=&r"(tmp) : "r"(p), "r"((u32)busy), "r"((u32)v) : "cc", "memory"
+  );
+
+  return old;
+}
+
+static inline u16 atomic_lock16(u16 *p, u16 busy, u16 v) {
+  u32 old, tmp;
+
+  asm volatile(
+    "sevl\n"
+    "1: wfe\n"
+    "2: ldaxrh %w0, [%2]\n"
+    "tst    %w0, %w3\n"
+    "b.ne   1b\n"
+    "stxrh  %w1, %w4, [%2]\n"
+    "cbnz   %w1, 2b\n"
+    : "=&r"(old), "=&r"(tmp) : "r"(p), "r"((u32)busy), "r"((u32)v) : "cc", "memory"
+  );
+
+  return old;
+}
+
+/* store 0 to *@p with release semantics */
+static inline void atomic_release8(u8 *p) {
+  asm volatile("stlrb wzr, [%0]" :: "r"(p) : "memory");
+}
+
+static inline void atomic_release16(u16 *p) {
+  asm volatile("stlrh wzr, [%0]" :: "r"(p) : "memory");
+}
+
+#endif  /* ATOMIC_H */
@@ -0,0 +1,52 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include "types.h"
+
+/*
+ *  cluster clock: the counter of Node0
+ *
+ *  a sub-node estimates offset and drift of its counter against Node0 with
+ *  four timestamps per exchange, as PTP and NTP do:
+ *
+ *    t1: MSG_CLOCK_SYNC sent (local)   t2: received by Node0 (Node0)
+ *    t4: reply received (local)        t3: reply sent by Node0 (Node0)
+ *
+ *    offset = ((t2 - t1) + (t3 - t4)) / 2    (Node0 - local)
+ *    delay  = (t4 - t1) - (t3 - t2)
+ *
+ *  a round is CLOCKSYNC_BURST exchanges and keeps the one of the smallest
+ *  delay, which saw the least queueing.  the error of an offset is bounded
+ *  by delay / 2, so a round whose delay exceeds CLOCKSYNC_DELAY_GATE times the
+ *  smallest one in history is dropped, unless CLOCKSYNC_REJECT_MAX rounds in
+ *  a row are (the path got slower).  drift is the least squares slope of the
+ *  offsets of the last CLOCKSYNC_HISTORY rounds kept.  rounds repeat every
+ *  CLOCKSYNC_INTERVAL_MS.
+ *
+ *  vsm traces are timestamped in cluster time.  the guest counter (CNTVOFF)
+ *  is aligned to the boot clock of Node0 and stepped forward by later
+ *  rounds, never backward: a sub-node counter running faster than Node0
+ *  keeps the lead.
+ */
+
+#define CLOCKSYNC_BURST           8
+#define CLOCKSYNC_HISTORY         8
+#define CLOCKSYNC_DELAY_GATE      2
+#define CLOCKSYNC_REJECT_MAX      4
+#define CLOCKSYNC_INTERVAL_MS     1000
+#define CLOCKSYNC_INIT_TIMEOUT_US 1000000
+
+/* drift in parts per 2^32 */
+#define CLOCKSYNC_DRIFT_SHIFT     32
+#define CLOCKSYNC_DRIFT_MAX_PPM   500
+
+u64 local_to_cluster(u64 cycles);
+u64 cluster_to_local(u64 cycles);
+u64 cluster_now(void);
+
+void clocksync_load_cntvoff(void);
+
+void clocksync_init(void);
+void clocksync_dump(void);
+
+#endif  /* CLOCKSYNC_H */
@@ -0,0 +1,47 @@
+#ifndef CLUSTER_STAT_H
+#define CLUSTER_STAT_H
+
+#include "types.h"
+#include "param.h"
+#include "pcpu.h"
+#include "irq.h"
+#include "msg.h"
+#include "msg-stat.h"
+#include "vsm-stat.h"
+
+/*
+ *  cluster-wide statistics
+ *
+ *  Node0 requests a snapshot of counters from every active node by
+ *  MSG_STAT_REQUEST and prints them merged into one report:
+ *
+ *    clusterstat-begin <nnodes> <nodes replied>
+ *    clusterstat: <total> <node0> <node1> ... <counter>
+ *    ...
+ *    clusterstat-end
+ *
+ *  triggered by 'c' on the console of Node0, or every
+ *  CLUSTER_STAT_INTERVAL_SEC seconds if it is defined.
+ */
+
+#define CLUSTER_STAT_VERSION    1
+
+/* snapshot of a node: body of MSG_STAT_REPLY, fits in a page */
+struct node_stat {
+  u32 version;
+  u32 nodeid;
+  u64 vsm[NR_VSTAT];
+  u64 msg[NUM_MSG][NR_MSTAT];
+  struct msg_link_stat link;
+  u64 free_pages;
+  u64 exit[NR_VMEXIT];
+  u32 irq[NIRQ];
+};
+
+void node_stat_snapshot(struct node_stat *st);
+void cluster_stat_collect(void);
+bool cluster_stat_busy(void);
+void cluster_stat_flush(void);
+void cluster_stat_init(void);
+
+#endif  /* CLUSTER_STAT_H */
@@ -79,7 +79,33 @@ static inline u64 fdt64_to_u64(fdt64 x) {
 #define FDT_NOP           0x4
 #define FDT_END           0x9
 
+struct fdt_reserve_entry {
+  fdt64 address;
+  fdt64 size;
+};
+
+/* build flattened device tree */
+struct fdt_writer {
+  fdt32 *dt_struct;
+  u32 struct_len;
+  u32 struct_size;
+
+  char *dt_strings;
+  u32 strings_len;
+  u32 strings_size;
+};
+
 void fdt_probe(struct fdt *fdt, void *base);
 struct device_node *fdt_parse(struct fdt *fdt);
 
+void fdt_writer_init(struct fdt_writer *w, void *struct_buf, u32 struct_size,
+                     char *strings_buf, u32 strings_size);
+void fdt_w_begin_node(struct fdt_writer *w, const char *name);
+void fdt_w_end_node(struct fdt_writer *w);
+void fdt_w_prop(struct fdt_writer *w, const char *name, const void *data, u32 len);
+void fdt_w_prop_u32(struct fdt_writer *w, const char *name, u32 val);
+void fdt_w_prop_string(struct fdt_writer *w, const char *name, const char *str);
+u32 fdt_w_finish(struct fdt_writer *w, void *out, u32 outsize, void *rsvmap,
+                 u32 boot_cpuid);
+
 #endif
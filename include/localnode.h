@@ -4,6 +4,7 @@
 #include "types.h"
 #include "vcpu.h"
 #include "net.h"
+#include "transport.h"
 #include "vgic.h"
 #include "uart.h"
 #include "lib.h"
@@ -37,6 +38,8 @@ struct localnode {
   bool acked;
   /* network interface card */
   struct nic *nic;
+  /* transport of inter node frames */
+  struct transport *transport;
   /* irqchip */
   struct gic_irqchip *irqchip;
   /* uartchip */
@@ -48,8 +51,10 @@ struct localnode {
   /* my node in the cluster */
   struct cluster_node *node;
   int nodeid;
-  /* boot clock */
+  /* boot clock: CNTVOFF of vcpus */
   u64 bootclk;
+  /* boot clock in Node0 counter */
+  u64 cluster_bootclk;
 };
 
 extern struct localnode localnode;
@@ -78,7 +83,7 @@ static inline struct vcpu *local_vcpu(int localcpuid) {
 }
 
 static inline bool node_macaddr_is_me(u8 *mac) {
-  return memcmp(localnode.nic->mac, mac, 6) == 0;
+  return memcmp(localnode.transport->addr, mac, 6) == 0;
 }
 
 #endif
@@ -0,0 +1,56 @@
+#ifndef DRIVER_LOOPBACK_H
+#define DRIVER_LOOPBACK_H
+
+#include "types.h"
+#include "mm.h"
+
+/*
+ *  loopback transport over shared memory
+ *
+ *  nodes sharing one memory region (vmm instances with a shared ram region,
+ *  e.g. ivshmem, or processes of the host simulator) exchange frames through
+ *  rings in it.  every node owns a port; frames from port s to
+ *  port d go through ring[s][d] which has a single producer and a single
+ *  consumer, so the rings need no atomic instructions and work on any memory
+ *  attribute.
+ */
+
+#define LOOPBACK_PORTS        8
+#define LOOPBACK_SLOTS        8
+#define LOOPBACK_GROUPS_MAX   8
+/* ether, link and msg header area */
+#define LOOPBACK_HDR_MAX      128
+
+/* poll interval while no cpu owns the transport */
+#define LOOPBACK_POLL_US      10
+
+struct loopback_slot {
+  u32 len;
+  u32 body_len;
+  u8 data[LOOPBACK_HDR_MAX];
+  u8 body[PAGESIZE];
+};
+
+struct loopback_ring {
+  u32 head;       /* written by consumer */
+  u32 tail;       /* written by producer */
+  struct loopback_slot slot[LOOPBACK_SLOTS];
+};
+
+struct loopback_port {
+  u32 up;
+  u32 ngroups;
+  u8 groups[LOOPBACK_GROUPS_MAX][6];
+};
+
+struct loopback_shm {
+  struct loopback_port port[LOOPBACK_PORTS];
+  /* ring[src][dst] */
+  struct loopback_ring ring[LOOPBACK_PORTS][LOOPBACK_PORTS];
+};
+
+#define LOOPBACK_SHM_SIZE     sizeof(struct loopback_shm)
+
+void loopback_init(void *shm, int port);
+
+#endif  /* DRIVER_LOOPBACK_H */
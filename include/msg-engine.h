@@ -0,0 +1,45 @@
+#ifndef MSG_ENGINE_H
+#define MSG_ENGINE_H
+
+#include "types.h"
+#include "aarch64.h"
+#include "compiler.h"
+#include "msg.h"
+
+/*
+ *  protocol offload engine (build with MSG_ENGINE_CPU=<n>)
+ *  pcpu MSG_ENGINE_CPU runs no vcpu: it owns nic, polls rx ring, serves
+ *  remote requests and sends frames submitted by other cpus.
+ */
+
+#ifdef MSG_ENGINE_CPU
+
+/* frames of one msg submitted to engine */
+struct msg_submission {
+  struct iobuf *buf;
+  u16 dst_id;
+  u16 type;
+  u8 prio;
+  u8 flags;
+};
+
+#define MSG_SUBQ_SIZE     64
+
+/* single producer (owner cpu) single consumer (engine) ring per cpu */
+struct msg_subq {
+  struct msg_submission ent[MSG_SUBQ_SIZE];
+  u32 head;     /* written by engine */
+  u32 tail;     /* written by owner cpu */
+} __cacheline_aligned;
+
+bool msg_engine_submit(u16 dst_id, u16 type, struct iobuf *buf, enum msg_prio prio,
+                       int flags);
+void msg_engine_boot(void);
+void msg_engine_main(void) __noreturn;
+
+/* hand frames to link or nic (core/msg.c) */
+void __msg_output(u16 dst_id, u16 type, struct iobuf *buf, enum msg_prio prio, int flags);
+
+#endif  /* MSG_ENGINE_CPU */
+
+#endif  /* MSG_ENGINE_H */
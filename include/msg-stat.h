@@ -0,0 +1,34 @@
+#ifndef MSG_STAT_H
+#define MSG_STAT_H
+
+#include "types.h"
+
+/*
+ *  per-type, per-peer msg statistics
+ *
+ *  latency of a request splits into rtt (request sent to reply received by
+ *  nic), queueing (received to handled) and handler time.
+ */
+
+enum msg_stat_counter {
+  MSTAT_SENT,
+  MSTAT_RECV,
+  MSTAT_TX_BYTES,
+  MSTAT_RX_BYTES,
+  MSTAT_QUEUE_CYCLES,     /* received to handler called */
+  MSTAT_HANDLER_CYCLES,
+  MSTAT_REPLIED,          /* requests completed by reply */
+  MSTAT_RTT_CYCLES,       /* request sent to reply received */
+  NR_MSTAT,
+};
+
+/* rtt histogram of request/reply pairs: bucket n counts rtt < 2^n cycles */
+#define MSTAT_RTT_BUCKETS     32
+
+void msg_stat_sent(int peer, int type, u32 bytes);
+void msg_stat_recv(int peer, int type, u32 bytes, u64 queue, u64 handler);
+void msg_stat_rtt(int peer, int type, u64 rtt);
+void msg_stat_dump(void);
+void msg_stat_type_total(int type, u64 *sum);
+
+#endif  /* MSG_STAT_H */
@@ -6,6 +6,8 @@
 #include "ethernet.h"
 #include "spinlock.h"
 #include "compiler.h"
+#include "arch-timer.h"
+#include "mm.h"
 
 enum msgtype {
   MSG_NONE            = 0x0,
@@ -27,17 +29,67 @@ enum msgtype {
   MSG_SGI             = 0x10,
   MSG_PANIC           = 0x11,
   MSG_BOOT_SIG        = 0x12,
+  MSG_REPLICATE       = 0x13,
+  MSG_REPLICA         = 0x14,
+  MSG_PAGE_PUSH       = 0x15,
+  MSG_OWNER_QUERY     = 0x16,
+  MSG_OWNER_REPLY     = 0x17,
+  MSG_BUNDLE          = 0x18,
+  MSG_TRACE           = 0x19,
+  MSG_STAT_REQUEST    = 0x1a,
+  MSG_STAT_REPLY      = 0x1b,
+  MSG_CLOCK_SYNC      = 0x1c,
+  MSG_CLOCK_SYNC_REPLY = 0x1d,
+  MSG_SWAP_RESERVE    = 0x1e,
+  MSG_SWAP_RESERVE_REPLY = 0x1f,
+  MSG_NODE_PING       = 0x20,
+  MSG_NODE_PONG       = 0x21,
+  MSG_NODE_RTT        = 0x22,
   NUM_MSG,
 };
 
 /*
- *  pocv2-msg protocol via Ethernet (64 - 4160 byte)
- *  +-------------+---------------------------+------------------+
- *  | etherheader | src | type | conid | argv |      (body)      |
- *  +-------------+---------------------------+------------------+
- *     (14 byte)            (50 byte)           (up to 4096 byte)
+ *  pocv2-msg protocol via Ethernet (80 - 4176 byte)
+ *  +-------------+------------+---------------------------+------------------+
+ *  | etherheader | link hdr   | src | type | conid | argv |      (body)      |
+ *  +-------------+------------+---------------------------+------------------+
+ *     (14 byte)    (16 byte)            (50 byte)          (up to 4096 byte)
+ *
+ *  a body larger than one frame can carry is fragmented: each fragment is
+ *  sent with a copy of msg hdr and reassembled by receiver.
  */
 
+/*
+ *  link header: reliable transport between nodes
+ *  seq: sequence number of frame (LINK_SEQ)
+ *  ack: next seq expected from the peer, cumulative (LINK_ACK)
+ *  credit: number of frames receiver can take after ack (LINK_ACK)
+ *  frag_off, frag_total: fragment of body (LINK_FRAG)
+ */
+/* nodes which can be addressed by multicast group (copyset of a page) */
+#define MSG_MCAST_NODES     4
+
+struct msg_link_header {
+  u16 seq;
+  u16 ack;
+  u8 flags;
+  u8 src_id;
+  u16 credit;         /* peer may send up to seq (ack + credit - 1) */
+  union {
+    struct {
+      u32 frag_off;
+      u32 frag_total;
+    };
+    /* LINK_MCAST: seq for each member node (never fragmented) */
+    u16 mcast_seq[MSG_MCAST_NODES];
+  };
+} __packed;
+
+#define LINK_SEQ            (1 << 0)
+#define LINK_ACK            (1 << 1)
+#define LINK_FRAG           (1 << 2)
+#define LINK_MCAST          (1 << 3)
+
 struct msg_header {
   u16 src_id;         /* msg src */
   u16 type;           /* enum msgtype */
@@ -46,21 +98,69 @@ struct msg_header {
 
 #define POCV2_MSG_HDR_STRUCT      struct msg_header hdr
 
-#define ETH_POCV2_MSG_HDR_SIZE    64
+/* msgs about one page begin with ipa of the page (steered by it on receive) */
+struct msg_ipa_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  u64 ipa;
+};
+
+#define ETH_POCV2_MSG_HDR_SIZE    80
+
+/* max size of msg hdr (+ argv) */
+#define POCV2_MSG_HDR_AREA        \
+  (ETH_POCV2_MSG_HDR_SIZE - sizeof(struct etherheader) - sizeof(struct msg_link_header))
 
 struct msg {
   u16 dst_id;
   struct msg_header *hdr;   /* must be 8 byte alignment */
 
+  /* received body is allocated by alloc_pages(msg_body_order(body_len)) */
   void *body;
   u32 body_len;
 
   /* private */
   struct msg *next;       /* msg_queue */
   struct iobuf *data;     /* raw data */
+  u64 rxts;               /* received (in cycles) */
 };
 
+/* max size of body (fragmented by msg layer) */
+#define MSG_BODY_MAX        (PAGESIZE << 9)
+
+static inline int msg_body_order(u32 len) {
+  int order = 0;
+
+  while((PAGESIZE << order) < len)
+    order++;
+
+  return order;
+}
+
 #define M_BCAST             (1 << 0)    /* broadcast msg */
+#define M_FLUSH             (1 << 1)    /* do not hold msg in tx bundle */
+#define M_MCAST             (1 << 2)    /* multicast msg: dst_id is node mask */
+#define M_ZCOPY             (1 << 3)    /* body is a frame freed by sender: no copy */
+
+/*
+ *  multicast group of nodes in mask: 03:50:4f:43:00:<mask>
+ *  (locally administered group address)
+ */
+static inline void msg_mcast_mac(u8 *mac, u8 mask) {
+  mac[0] = 0x03;
+  mac[1] = 'P';
+  mac[2] = 'O';
+  mac[3] = 'C';
+  mac[4] = 0x00;
+  mac[5] = mask;
+}
+
+static inline bool msg_mcast_group(u8 *mac, u8 *mask) {
+  if(mac[0] != 0x03 || mac[1] != 'P' || mac[2] != 'O' || mac[3] != 'C' || mac[4] != 0)
+    return false;
+
+  *mask = mac[5];
+  return true;
+}
 
 #define msg_cpu(msg)        ((msg)->hdr->connectionid & 0x7)
 #define msg_connid(msg)     ((msg)->hdr->connectionid)
@@ -69,16 +169,181 @@ struct msg {
 
 #define msg_eth(msg)        ((msg)->data->eth)
 
+/*
+ *  priority class of msg: lower class is served first on transmit (link
+ *  backlog) and on receive (recv_waitq)
+ */
+enum msg_prio {
+  MSG_PRIO_REPLY,       /* somebody is waiting for it */
+  MSG_PRIO_CONTROL,     /* ipi, invalidation, cluster control */
+  MSG_PRIO_REQUEST,
+  MSG_PRIO_BULK,        /* replica, trace, statistics */
+  NR_MSG_PRIO,
+};
+
+/*
+ *  lock-free multi producer single consumer queue, per priority class
+ *  producers push msgs onto stack `in` by cmpxchg.  the consumer (owner cpu)
+ *  takes whole stacks at once and keeps msgs in order of arrival in head/tail.
+ */
 struct msg_queue {
-  struct msg *head;
-  struct msg *tail;
+  struct msg *in[NR_MSG_PRIO];      /* newest first */
+  /* consumer only */
+  struct msg *head[NR_MSG_PRIO];
+  struct msg *tail[NR_MSG_PRIO];
+};
+
+/* max outstanding requests per cpu */
+#define MSG_REQ_MAX         16
+
+/* waiting cpu polls rx ring for a reply this long before sleeping in wfi */
+#define MSG_BUSY_POLL_US        100
+
+/*
+ *  outstanding request waiting for reply, keyed by connection id.
+ *  a reply is handed to the waiter (future) or to cb in receive path (async).
+ */
+struct msg_request {
+  u32 connid;
+  u16 type;           /* of request */
+  u16 dst_id;
+  u64 sent;           /* in cycles */
+  bool inuse;
+  bool async;
+  volatile bool done;
+  struct msg *reply;
+  void (*cb)(struct msg *, void *);
+  void *cb_arg;
+};
+
+struct msg_request_table {
+  struct msg_request req[MSG_REQ_MAX];
+};
+
+/*
+ *  tx coalescing: small body-less msgs to the same node are packed into the
+ *  body of one MSG_BUNDLE frame
+ *
+ *  MSG_BUNDLE body:
+ *  +-----------+-----------------+-----------+-----------------+---
+ *  | rec (8 B) | msg hdr (pad 8) | rec (8 B) | msg hdr (pad 8) | ...
+ *  +-----------+-----------------+-----------+-----------------+---
+ */
+#define MSG_BUNDLE_SIZE     1024
+
+/* max delay of a msg held in tx bundle */
+#define MSG_COALESCE_US     10
+
+struct msg_bundle_rec {
+  u16 size;           /* size of msg hdr */
+  u16 _pad[3];
+};
+
+/* per cpu, per destination node */
+struct msg_bundle {
+  void *page;
+  u32 len;
+  u16 nmsg;
+  u16 dst_id;
+  enum msg_prio prio;     /* highest class of msgs in bundle */
+  struct timer_event flush;
+};
+
+/*
+ *  go-back-N window per peer node
+ */
+#define MSG_LINK_WINDOW     32
+
+#define MSG_RTO_INIT_US     1000
+#define MSG_RTO_MIN_US      200
+#define MSG_RTO_MAX_US      200000
+
+/* ack is delayed to be piggybacked on reverse traffic */
+#define MSG_DELACK_US       50
+
+/* give up the peer after this number of retransmission timeouts in a row */
+#define MSG_RETRY_MAX       12
+
+/* longest a link keeps retransmitting before it declares the peer dead */
+#define MSG_LINK_GIVEUP_US  ((MSG_RETRY_MAX + 1) * MSG_RTO_MAX_US)
+
+/*
+ *  request and reply may each use up the retry budget of their link: a
+ *  waiter outlasts both, so lost frames end in the link's panic on a dead
+ *  peer, never in a reply timeout while the link still recovers
+ */
+#define MSG_REPLY_TIMEOUT_US    (2 * MSG_LINK_GIVEUP_US + 100000)
+
+struct msg_link_slot {
+  struct iobuf *buf;
+  u64 sent;           /* in cycles */
+  bool rexmit;
+};
+
+struct msg_link_stat {
+  u64 tx;
+  u64 rx;
+  u64 rexmit;         /* retransmitted frames */
+  u64 timeout;        /* retransmission timeouts */
+  u64 dup;            /* duplicated frames dropped */
+  u64 ooo;            /* out of order frames dropped */
+  u64 ack;            /* pure ack frames sent */
+  u64 stall;          /* frames queued locally for lack of credit */
+};
+
+struct msg_link {
   spinlock_t lock;
+
+  /* tx */
+  u16 snd_una;
+  u16 snd_nxt;
+  u16 snd_limit;              /* credit from peer: seq < snd_limit can be sent */
+  struct msg_link_slot window[MSG_LINK_WINDOW];
+  /* waiting for window or credit, per priority class */
+  struct iobuf *backlog[NR_MSG_PRIO];
+  struct iobuf *backlog_tail[NR_MSG_PRIO];
+  int chain_prio;             /* class of fragments being sent, or -1 */
+  u64 srtt;                   /* in cycles */
+  u64 rttvar;
+  u64 rto;
+  u64 rtx_deadline;
+  int retries;
+  bool rtx_armed;
+  struct timer_event rtx_timer;
+
+  /* rx */
+  u16 rcv_nxt;
+  bool ack_pending;
+  bool delack_armed;
+  struct timer_event delack_timer;
+
+  struct msg_link_stat stat;
 };
 
+/* reassembly of fragmented body per source node */
+struct msg_reasm {
+  spinlock_t lock;
+  struct msg *msg;    /* msg of first fragment */
+  void *body;         /* alloc_pages(order) */
+  int order;
+  u32 total;
+  u32 received;
+};
+
+void msg_link_stat_dump(void);
+void msg_link_stat_total(struct msg_link_stat *sum);
+const char *msg_type_name(int type);
+bool msg_peer_congested(int nodeid);
+
 void msg_queue_init(struct msg_queue *q);
 
 static inline bool msg_queue_empty(struct msg_queue *q) {
-  return q->head == NULL;
+  for(int i = 0; i < NR_MSG_PRIO; i++) {
+    if(q->head[i] || *(struct msg * volatile *)&q->in[i])
+      return false;
+  }
+
+  return true;
 }
 
 struct msg_size_data {
@@ -140,19 +405,32 @@ void __send_msg(struct msg *msg, void (*reply_cb)(struct msg *, void *),
 
 #define send_msg_bcast(msg)   __send_msg((msg), NULL, NULL, M_BCAST)
 
+/* body is a page frame unmapped from the guest, freed right after send */
+#define send_msg_zcopy(msg)   __send_msg((msg), NULL, NULL, M_ZCOPY)
+
 #define send_msg_cb(msg, cb, arg) \
   __send_msg((msg), (cb), (arg), 0)
 
+void send_msg_mcast(struct msg *msg, u64 nodemask);
+void msg_mcast_join(void);
+
+struct msg_request *send_msg_req(struct msg *msg);
+void send_msg_async(struct msg *msg, void (*cb)(struct msg *, void *), void *cb_arg);
+void msg_wait_reply(struct msg_request *req, void (*cb)(struct msg *, void *), void *cb_arg);
+
 int msg_recv(u8 *src_mac, struct iobuf *buf);
 
 #define msg_init(msg, dst_id, type, hdr, body, body_len)   \
   __msg_init(msg, dst_id, type, (struct msg_header *)hdr, body, body_len, cpuid())
 
-#define msg_init_reqcpu(msg, dst_id, type, hdr, body, body_len, reqcpu) \
-  __msg_init(msg, dst_id, type, (struct msg_header *)hdr, body, body_len, reqcpu)
+/* keep connection id of request: forwarded request and its reply */
+#define msg_init_conn(msg, dst_id, type, hdr, body, body_len, connid) \
+  __msg_init_conn(msg, dst_id, type, (struct msg_header *)hdr, body, body_len, connid)
 
 void __msg_init(struct msg *msg, u16 dst_id, enum msgtype type,
                 struct msg_header *hdr, void *body, int body_len, int reqcpu);
+void __msg_init_conn(struct msg *msg, u16 dst_id, enum msgtype type,
+                     struct msg_header *hdr, void *body, int body_len, u32 connid);
 
 #define msg_reply(msg, type, hdr, body, body_len)   \
   __msg_reply(msg, type, (struct msg_header *)hdr, body, body_len)
@@ -9,6 +9,14 @@ struct etherheader;
 
 struct nic_ops {
   void (*xmit)(struct nic *, struct iobuf *);
+  /* number of rx buffers ready for incoming frames */
+  int (*rx_room)(struct nic *);
+  /* receive up to @budget frames from rx ring: return number of frames */
+  int (*poll)(struct nic *, int budget);
+  /* mask/unmask rx interrupt */
+  void (*rx_irq_enable)(struct nic *, bool enable);
+  /* receive frames to multicast addresses @macs only (besides own and broadcast) */
+  int (*set_mcast_filter)(struct nic *, u8 (*macs)[6], int n);
   void (*set_recv_intr_callback)(struct nic *, void (*cb)(struct nic *, void **, int *, int));
   // private
   void (*recv_intr_callback)(struct nic *, void **, int *, int);
@@ -34,6 +42,12 @@ struct iobuf {
   void *body;
   u32 len;
   u32 body_len;
+  /* body is a pinned frame of its owner: unpinned instead of freed */
+  bool body_pinned;
+
+  /* held by nic and by retransmit queue of msg layer */
+  u32 refcnt;
+  struct iobuf *next;
 
   int npages;
 };
@@ -45,11 +59,23 @@ static inline struct iobuf *alloc_iobuf(u32 size) {
 }
 
 void free_iobuf(struct iobuf *buf);
+struct iobuf *iobuf_get(struct iobuf *buf);
 void *iobuf_push(struct iobuf *buf, u32 size);
 void *iobuf_pull(struct iobuf *buf, u32 size);
 void iobuf_set_len(struct iobuf *buf, u32 len);
 
+/* max frames received in one round of polling */
+#define NET_POLL_BUDGET     16
+
+/* interval of polling rounds while rx ring is busy */
+#define NET_POLL_US         5
+
 void netdev_recv(struct iobuf *buf);
+void netdev_rx_irq(void);
+int netdev_poll(void);
+void netdev_set_poll_owner(int cpu);
+int netdev_set_mcast_filter(u8 (*macs)[6], int n);
+int netdev_rx_room(void);
 void net_init(char *name, u8 *mac, int mtu, void *dev, struct nic_ops *ops);
 
 #endif
@@ -44,6 +44,9 @@ struct cluster_node {
 
   u32 vcpus[VCPU_PER_NODE_MAX];
   int nvcpu;
+
+  u32 rtt;      /* round trip time from Node0 (in counter ticks), see NODE_RTT_SAMPLES */
+  u32 spare;    /* frames the node can take from peers (last report, a hint) */
 };
 
 extern struct cluster_node cluster[NODE_MAX];
@@ -179,6 +182,7 @@ struct init_ack_hdr {
   POCV2_MSG_HDR_STRUCT;
   int nvcpu;
   u64 allocated;
+  u32 spare;
 };
 
 /*
@@ -224,8 +228,29 @@ struct panic_hdr {
 
 void node_panic_signal(void);
 
+/*
+ *  rtt measurement: Node0 -> Node n after all nodes are set up
+ *    ping/pong NODE_RTT_SAMPLES times, the smallest rtt is kept.
+ *    then Node0 sends the rtt of every node to Node n (MSG_NODE_RTT).
+ */
+#define NODE_RTT_SAMPLES  16
+
+struct node_ping_hdr {
+  POCV2_MSG_HDR_STRUCT;
+};
+
+struct node_rtt_hdr {
+  POCV2_MSG_HDR_STRUCT;
+  int nnodes;
+};
+
+struct node_rtt_body {
+  u32 rtt[NODE_MAX];
+};
+
 struct boot_sig_hdr {
   POCV2_MSG_HDR_STRUCT;
+  u64 bootclk;    /* in Node0 counter */
 };
 
 void __node0 broadcast_boot_signal(void);
@@ -0,0 +1,16 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include "types.h"
+#include "guest.h"
+
+#define LOCAL_DISTANCE      10
+#define REMOTE_DISTANCE     20
+#define MAX_DISTANCE        254
+
+void numa_init(void);
+int node_distance(int from, int to);
+
+struct guest *numa_guest_fdt(struct guest *fdt);
+
+#endif  /* NUMA_H */
@@ -19,6 +19,15 @@
 /* max node */
 #define NODE_MAX  32
 
+/* cpu serving remote page requests, or -1 to spread them by ipa */
+#ifdef MSG_ENGINE_CPU
+#define MSG_SERVICE_CPU   MSG_ENGINE_CPU
+#endif
+
+#ifndef MSG_SERVICE_CPU
+#define MSG_SERVICE_CPU   -1
+#endif
+
 #ifndef NR_NODE
 #define NR_NODE   2
 #endif
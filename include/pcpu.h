@@ -19,6 +19,18 @@ struct cpu_enable_method {
   int (*boot)(struct pcpu *cpu, physaddr_t entrypoint);
 };
 
+/* guest exits to vmm */
+enum vm_exit {
+  VMEXIT_WFX,
+  VMEXIT_HVC,
+  VMEXIT_SMC,
+  VMEXIT_SYSREG,
+  VMEXIT_IABORT,
+  VMEXIT_DABORT,
+  VMEXIT_IRQ,
+  NR_VMEXIT,
+};
+
 struct pcpu {
   void *stackbase;
   u64 mpidr;
@@ -31,11 +43,14 @@ struct pcpu {
   const struct cpu_enable_method *enable_method;
   
   struct msg_queue recv_waitq;
+  struct msg_request_table reqtable;
+  struct msg_bundle txbundle[NODE_MAX];
 
   int irq_depth;
   bool lazyirq_enabled;
   int lazyirq_depth;
   u64 nirq;
+  u64 nexit[NR_VMEXIT];
 
   union {
     struct {
@@ -68,6 +68,7 @@ extern u64 *vttbr;
 #define S2PTE_COPYSET_SHIFT   55
 #define S2PTE_COPYSET(c)      (((u64)(c) & 0xf) << S2PTE_COPYSET_SHIFT)
 #define S2PTE_COPYSET_MASK    S2PTE_COPYSET(0xf)
+#define S2PTE_COPYSET_NODES   4
 
 void switch_vttbr(physaddr_t vttbr);
 
@@ -0,0 +1,71 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "types.h"
+#include "net.h"
+
+/*
+ *  transport of inter node frames
+ *
+ *  msg layer sends and receives frames only through the transport of
+ *  localnode.  a frame is an iobuf beginning with struct etherheader of which
+ *  addresses are node addresses given by the transport (mac address of nic
+ *  for ethernet), so the frame layout is the same on every backend.
+ *
+ *    ethernet: drivers/ethernet.c, frames go through nic (net.h)
+ *    loopback: drivers/loopback.c, frames go through shared memory
+ */
+
+/* frames to group addresses are delivered to members */
+#define TRANSPORT_CAP_MCAST     (1 << 0)
+/* frames can be received by transport_poll() without irq */
+#define TRANSPORT_CAP_POLL      (1 << 1)
+
+struct transport;
+
+struct transport_ops {
+  /* send a frame: takes a reference of @buf */
+  void (*xmit)(struct transport *, struct iobuf *buf);
+  /* send frames chained by buf->next at once (optional) */
+  void (*xmit_batch)(struct transport *, struct iobuf *buf);
+  /* number of frames which can be received without drop (optional) */
+  int (*rx_room)(struct transport *);
+  /* number of frames which can be received from @src without drop (optional) */
+  int (*rx_room_from)(struct transport *, u8 *src);
+  /* receive pending frames: return number of frames (CAP_POLL) */
+  int (*poll)(struct transport *);
+  /* from now on only @cpu receives frames, by polling (CAP_POLL) */
+  void (*set_poll_owner)(struct transport *, int cpu);
+  /* receive frames to group addresses @addrs besides own and broadcast */
+  int (*set_mcast_filter)(struct transport *, u8 (*addrs)[6], int n);
+};
+
+struct transport {
+  char *name;
+  /* node address of this node */
+  u8 addr[6];
+  /* max frame size without ether header */
+  int mtu;
+  u32 caps;
+  struct transport_ops *ops;
+  void *priv;
+};
+
+typedef int (*transport_recv_fn)(u8 *src, struct iobuf *buf);
+
+void transport_register(struct transport *tp);
+void transport_set_recv_callback(transport_recv_fn fn);
+void transport_recv(struct transport *tp, struct iobuf *buf);
+
+void transport_push_header(u8 *dst, u16 type, struct iobuf *buf);
+void transport_xmit(struct iobuf *buf);
+void transport_xmit_batch(struct iobuf *buf);
+int transport_rx_room(void);
+int transport_rx_room_from(u8 *src);
+int transport_poll(void);
+void transport_set_poll_owner(int cpu);
+int transport_set_mcast_filter(u8 (*addrs)[6], int n);
+int transport_mtu(void);
+bool transport_has_cap(u32 cap);
+
+#endif  /* TRANSPORT_H */
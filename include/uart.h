@@ -15,6 +15,9 @@ struct uartchip {
 void uart_putc(char c);
 void uart_puts(char *s);
 
+void uart_hotkey(int c);
+void uart_flush(void);
+
 void uart_init(void);
 
 #endif
@@ -41,9 +41,6 @@ struct vcpu {
 
   struct cpu_features features;
 
-  /* msg reply manager */
-  struct msg * volatile reply_buf;
-
   u64 sctlr_el1;
 
   struct vgic_cpu vgic;
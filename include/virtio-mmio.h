@@ -42,6 +42,7 @@ struct virtio_mmio_dev {
   int intid;
   struct virtq *vqs;
   int dev_id;
+  u64 features;     /* negotiated */
   void *priv;
 };
 
@@ -46,10 +46,32 @@ struct virtio_net {
   struct virtio_net_config *cfg;
   struct virtq *tx;
   struct virtq *rx;
+  struct virtq *ctrl;     /* NULL if VIRTIO_NET_F_CTRL_VQ is not negotiated */
   u32 mtu;
   u32 n_rxbuf;
 };
 
+/* control virtqueue */
+struct virtio_net_ctrl_hdr {
+  u8 class;
+  u8 cmd;
+} __packed;
+
+#define VIRTIO_NET_OK     0
+#define VIRTIO_NET_ERR    1
+
+#define VIRTIO_NET_CTRL_RX              0
+#define   VIRTIO_NET_CTRL_RX_PROMISC      0
+#define   VIRTIO_NET_CTRL_RX_ALLMULTI     1
+
+#define VIRTIO_NET_CTRL_MAC             1
+#define   VIRTIO_NET_CTRL_MAC_TABLE_SET   0
+
+struct virtio_net_ctrl_mac {
+  u32 entries;
+  u8 macs[][6];
+} __packed;
+
 struct virtio_net_hdr {
 #define VIRTIO_NET_HDR_F_NEEDS_CSUM    1    /* Use csum_start, csum_offset */
 #define VIRTIO_NET_HDR_F_DATA_VALID    2    /* Csum is valid */
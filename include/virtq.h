@@ -69,6 +69,7 @@ struct qlist {
 int virtq_reg_to_dev(struct virtq *vq);
 void virtq_kick(struct virtq *vq);
 void virtq_enqueue(struct virtq *vq, struct qlist *qs, int nqs, void *x, bool in);
+void virtq_enqueue_inout(struct virtq *vq, struct qlist *qs, int nout, int nin, void *x);
 void *virtq_dequeue(struct virtq *vq, u32 *len);
 struct virtq *virtq_create(struct virtio_mmio_dev *dev, int qsel,
                             void (*intr_handler)(struct virtq *));
@@ -0,0 +1,48 @@
+#ifndef VSM_HINT_H
+#define VSM_HINT_H
+
+#include "types.h"
+#include "vcpu.h"
+
+/*
+ *  paravirtual vsm hint interface
+ *
+ *  hvc #VSM_HINT_HVC_IMM
+ *    x0: function id
+ *    x1: ipa
+ *    x2: size
+ *    x3: argument
+ *  return value in x0 (and x1)
+ */
+
+#define VSM_HINT_HVC_IMM        1
+
+#define VSM_HINT_VERSION_1_0    0x10000
+
+enum vsm_hint_func {
+  VSM_HINT_VERSION      = 0x0,
+  VSM_HINT_PREFETCH     = 0x1,    /* x3: 0 read 1 write */
+  VSM_HINT_LOCAL        = 0x2,
+  VSM_HINT_REPLICATED   = 0x3,
+  VSM_HINT_MIGRATORY    = 0x4,    /* x3: 0 clear 1 set */
+  VSM_HINT_RELEASE      = 0x5,
+  VSM_HINT_QUERY        = 0x6,    /* x0: owner x1: distance */
+};
+
+#define VSM_HINT_SUCCESS          0
+#define VSM_HINT_NOT_SUPPORTED    -1
+#define VSM_HINT_INVALID_PARAMS   -2
+
+/* max size of range per one hypercall */
+#define VSM_HINT_MAX_RANGE        (2 * 1024 * 1024)
+
+struct vsm_hint_argv {
+  u32 funcid;
+  u64 ipa;
+  u64 size;
+  u64 arg;
+};
+
+i64 vsm_hint_emulate(struct vcpu *vcpu, struct vsm_hint_argv *argv);
+
+#endif  /* VSM_HINT_H */
@@ -0,0 +1,47 @@
+#ifndef VSM_STAT_H
+#define VSM_STAT_H
+
+#include "types.h"
+
+/*
+ *  per-page access statistics of vsm
+ */
+
+enum vsm_stat_counter {
+  VSTAT_READ_FAULT,
+  VSTAT_WRITE_FAULT,
+  VSTAT_INSTR_FAULT,
+  VSTAT_FETCH_IN,         /* page received from remote node */
+  VSTAT_FETCH_OUT,        /* page sent to remote node */
+  VSTAT_INV_IN,           /* invalidated by remote node */
+  VSTAT_INV_OUT,          /* invalidate request sent */
+  VSTAT_LOCKWAIT,         /* page lock wait (in cycles) */
+  NR_VSTAT,
+};
+
+struct vsm_page_stat {
+  u64 count[NR_VSTAT];
+};
+
+/* snapshot record: one line of hex dump */
+struct vsm_stat_record {
+  u64 ipa;
+  u64 count[NR_VSTAT];
+  u8 last_owner;
+  u8 _pad[7];
+};
+
+#define VSTAT_SNAPSHOT_VERSION    2
+
+#define VSTAT_NO_OWNER            0xff
+
+void vsm_stat_add(u64 ipa, enum vsm_stat_counter c, u64 n);
+void vsm_stat_set_owner(u64 ipa, int owner);
+void vsm_stat_dump(void);
+void vsm_stat_total(u64 *sum);
+
+static inline void vsm_stat_inc(u64 ipa, enum vsm_stat_counter c) {
+  vsm_stat_add(ipa, c, 1);
+}
+
+#endif  /* VSM_STAT_H */
@@ -0,0 +1,47 @@
+#ifndef VSM_TRACE_H
+#define VSM_TRACE_H
+
+#include "types.h"
+
+/*
+ *  trace of guest stage 2 faults
+ *
+ *  a record per fault is appended to the ring of the faulting cpu without
+ *  lock.  sub-nodes stream full batches of records to Node0; vsm_trace_dump()
+ *  drains the rings (and records collected from sub-nodes on Node0) and
+ *  prints them as hex lines:
+ *
+ *    vsmtrace-begin <version> <nodeid> <record size> <counter frequency>
+ *    <up to 4 struct vsm_trace_rec in hex>
+ *    ...
+ *    vsmtrace-end <nrecords> <dropped>
+ *
+ *  tools/vsmtrace.py converts it into a binary trace, which the simulator
+ *  replays (sim/pocsim -w trace).
+ *
+ *  recording is off unless the vmm is built with VSM_TRACE=1.
+ */
+
+#define VTRACE_READ       0
+#define VTRACE_WRITE      1
+#define VTRACE_EXEC       2
+#define VTRACE_ACC_MASK   0x3
+/* fault on stage 1 page table walk */
+#define VTRACE_S1PTW      (1 << 2)
+
+struct vsm_trace_rec {
+  u64 ts;         /* counter ticks of Node0 (cluster_now()) */
+  u32 ipfn;       /* ipa >> PAGESHIFT */
+  u16 vcpuid;
+  u8 nodeid;
+  u8 flags;       /* VTRACE_* */
+};
+
+#define VTRACE_VERSION    1
+
+extern bool vsm_trace_enabled;
+
+void vsm_trace_fault(int vcpuid, u64 ipa, u8 flags);
+void vsm_trace_dump(void);
+
+#endif  /* VSM_TRACE_H */
@@ -33,15 +33,45 @@ struct page_desc {
       u8 wqlock;
     };
   };
+  u8 flags;
+  u8 nfallback;     /* how many times a write broke replication */
+  u16 epoch;        /* ownership changes of page this node has seen */
 };
 
+/* page_desc flags */
+#define PD_REPLICATED     (1 << 0)    /* read-only replica pinned on every node */
+#define PD_INVALIDATED    (1 << 1)    /* invalidate request arrived while inaccessible */
+#define PD_MIGRATORY      (1 << 2)    /* fetch ownership even on read fault */
+#define PD_LOCAL          (1 << 3)    /* used by this node only (guest hint) */
+#define PD_LAZY           (1 << 4)    /* managed by me but not backed by a frame yet */
+#define PD_COLD           (1 << 5)    /* access flag cleared by swap scanner */
+
+/* stop replicating a page after it was written this many times */
+#define VSM_REPLICA_FALLBACK_MAX  2
+
+/* frames kept free for hypervisor (msg buffers, etc.) */
+#define VSM_FRAME_RESERVE         2048
+/* pages pushed out to a peer per reclaim, and frames asked of the peer */
+#define VSM_SWAP_BATCH            32
+/* pages scanned per reclaim: less than a full sweep of guest memory */
+#define VSM_SWAP_SCAN_MAX         4096
+/* fault waits this long for swap rounds to free a frame */
+#define VSM_SWAP_WAIT_US          3000000
+
+/* fetches of a prefetch hint in flight at once: rest of request table is left to others */
+#define VSM_PREFETCH_BATCH        (MSG_REQ_MAX / 2)
+
 struct vsm_server_proc {
   struct vsm_server_proc *next;   // waitqueue
   u64 page_ipa;
   u64 copyset;        // for invalidate server
+  void *page;         // for replica/push server
+  u16 epoch;          // for replica/push server: epoch of page sent
+  int dst_nodeid;     // for push server
+  bool bounced;       // for fetch server: request bounced by old owner
   int req_nodeid;
   int type;
-  int req_cpu;
+  u32 req_connid;     // for fetch server: reply completes this request
   void (*do_process)(struct vsm_server_proc *);
 };
 
@@ -52,6 +82,21 @@ void *vsm_read_fetch_page(u64 page_ipa);
 void *vsm_write_fetch_page(u64 page_ipa);
 void *vsm_read_fetch_instr(u64 page_ipa);
 
+void vsm_replicate_page(u64 page_ipa);
+void vsm_replicate_range(u64 ipa, u64 size);
+void vsm_prefetch_range(u64 ipa, u64 size, bool wr);
+
+void vsm_page_set_flags(u64 page_ipa, u8 set, u8 clear);
+int vsm_push_page(u64 page_ipa, int dst);
+int vsm_release_page(u64 page_ipa);
+int vsm_page_owner(u64 page_ipa);
+bool vsm_in_guest_memory(u64 ipa);
+bool vsm_fetch_congested(u64 ipa);
+
+void vsm_swap_balance(void);
+void vsm_swap_flush(void);
+u32 vsm_spare_pages(u64 nalloc);
+
 void vsm_init(void);
 void vsm_node_init(struct memrange *mem);
 
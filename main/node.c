@@ -14,6 +14,8 @@
 #include "guest.h"
 #include "arch-timer.h"
 #include "s2mm.h"
+#include "numa.h"
+#include "cluster-stat.h"
 
 #define KiB   (1024)
 #define MiB   (1024 * 1024)
@@ -79,6 +81,11 @@ static void node0_init() {
 
   cluster_init();
 
+  cluster_stat_init();
+
+  /* export numa topology of the cluster to guest */
+  vm_desc.fdt_img = numa_guest_fdt(vm_desc.fdt_img);
+
   initvm(&vm_desc);
 }
 
@@ -0,0 +1,378 @@
+/*
+ *  simulated pcpu: system registers, interrupt mask, wfi and irqchip
+ *
+ *  an interrupt is taken when the cpu unmasks irq (local_irq_enable(),
+ *  irqrestore), waits in wfe, or passes an irq point between guest accesses;
+ *  it goes through irq_entry() as the exception vector does.
+ */
+
+#include "types.h"
+#include "aarch64.h"
+#include "gic.h"
+#include "irq.h"
+#include "pcpu.h"
+#include "localnode.h"
+#include "panic.h"
+#include "sim-vmm.h"
+
+/* counter ticks in ns */
+#define SIM_CNTFRQ              1000000000ul
+
+#define CNTHP_CTL_EL2_ENABLE    (1ul << 0)
+#define CNTHP_CTL_EL2_IMASK     (1ul << 1)
+
+#define HYP_TIMER_IRQ           26
+
+/* longest sleep in wfi without any event */
+#define SIM_WFI_MAX_NS          1000000
+
+#define DAIF_I                  (1ul << 7)
+
+struct sim_cpu {
+  bool irq_masked;
+  u32 sgi_pending;
+  u32 ppi_enabled;
+  u64 cnthp_ctl_el2;
+  u64 cnthp_cval_el2;
+  u64 cntvoff_el2;
+  /* futex of wfi */
+  unsigned int *wake;
+
+  /* registers without side effect */
+  u64 elr_el2;
+  u64 esr_el2;
+  u64 far_el2;
+  u64 hpfar_el2;
+  u64 mair_el1;
+  u64 mair_el2;
+  u64 par_el1;
+  u64 tpidr_el2;
+  u64 ttbr0_el1;
+  u64 ttbr1_el1;
+};
+
+__thread int sim_cpuid;
+
+static struct sim_cpu sim_cpus[NCPU_MAX];
+static int sim_ncpus;
+static bool spi_enabled[NIRQ];
+
+/* counter of Node n runs n * skew ahead and drifts n * ppm from host time */
+static int clock_node;
+static long clock_skew_ns;
+static long clock_drift_ppm;
+static u64 clock_base_ns;
+
+void irq_entry(int from_guest);
+
+static inline struct sim_cpu *sim_mycpu() {
+  return &sim_cpus[sim_cpuid];
+}
+
+#define SIM_PLAIN_SYSREG(reg)                     \
+  u64 sim_read_##reg() {                          \
+    return sim_mycpu()->reg;                      \
+  }                                               \
+  void sim_write_##reg(u64 val) {                 \
+    sim_mycpu()->reg = val;                       \
+  }
+
+SIM_PLAIN_SYSREG(cntvoff_el2)
+SIM_PLAIN_SYSREG(elr_el2)
+SIM_PLAIN_SYSREG(esr_el2)
+SIM_PLAIN_SYSREG(far_el2)
+SIM_PLAIN_SYSREG(hpfar_el2)
+SIM_PLAIN_SYSREG(mair_el1)
+SIM_PLAIN_SYSREG(mair_el2)
+SIM_PLAIN_SYSREG(par_el1)
+SIM_PLAIN_SYSREG(tpidr_el2)
+SIM_PLAIN_SYSREG(ttbr0_el1)
+SIM_PLAIN_SYSREG(ttbr1_el1)
+
+/* counter of @node at host time @ns */
+u64 sim_node_counter(int node, u64 ns) {
+  i64 d = ns - clock_base_ns;
+
+  return ns + node * clock_skew_ns + d * node * clock_drift_ppm / 1000000;
+}
+
+static inline u64 sim_counter() {
+  return sim_node_counter(clock_node, sim_now_ns());
+}
+
+/* host time at which the counter of this node reaches @cnt */
+static u64 sim_counter_to_ns(u64 cnt) {
+  i64 d = cnt - clock_node * clock_skew_ns - clock_base_ns;
+
+  return clock_base_ns + d * 1000000 / (1000000 + clock_node * clock_drift_ppm);
+}
+
+void sim_cpu_clock(int node, long skew_ns, long drift_ppm, u64 base_ns) {
+  clock_node = node;
+  clock_skew_ns = skew_ns;
+  clock_drift_ppm = drift_ppm;
+  clock_base_ns = base_ns;
+}
+
+#define SIM_RO_SYSREG(reg, val)                   \
+  u64 sim_read_##reg() {                          \
+    return (val);                                 \
+  }                                               \
+  void sim_write_##reg(u64 v) {                   \
+    panic("sim: write %p to " #reg, v);           \
+  }
+
+SIM_RO_SYSREG(cntfrq_el0, SIM_CNTFRQ)
+SIM_RO_SYSREG(cntpct_el0, sim_counter())
+SIM_RO_SYSREG(cntvct_el0, sim_counter() - sim_mycpu()->cntvoff_el2)
+SIM_RO_SYSREG(mpidr_el1, sim_cpuid)
+/* PARange: 48 bit */
+SIM_RO_SYSREG(id_aa64mmfr0_el1, 5)
+
+/* timer is checked when the cpu looks for pending interrupts */
+u64 sim_read_cnthp_ctl_el2() {
+  return sim_mycpu()->cnthp_ctl_el2;
+}
+
+void sim_write_cnthp_ctl_el2(u64 val) {
+  sim_mycpu()->cnthp_ctl_el2 = val;
+}
+
+u64 sim_read_cnthp_cval_el2() {
+  return sim_mycpu()->cnthp_cval_el2;
+}
+
+void sim_write_cnthp_cval_el2(u64 val) {
+  sim_mycpu()->cnthp_cval_el2 = val;
+}
+
+static inline bool sim_timer_armed(struct sim_cpu *c) {
+  return (c->cnthp_ctl_el2 & (CNTHP_CTL_EL2_ENABLE | CNTHP_CTL_EL2_IMASK)) ==
+         CNTHP_CTL_EL2_ENABLE && (c->ppi_enabled & (1u << (HYP_TIMER_IRQ - 16)));
+}
+
+static inline bool sim_nic_irq(struct sim_cpu *c, u64 now) {
+  /* spi of nic is routed to cpu0 */
+  return c == &sim_cpus[0] && spi_enabled[SIM_NIC_IRQ] && sim_nic_irq_pending(now);
+}
+
+static bool sim_irq_pending(struct sim_cpu *c) {
+  u64 now;
+
+  if(__atomic_load_n(&c->sgi_pending, __ATOMIC_ACQUIRE))
+    return true;
+
+  if(sim_timer_armed(c) && sim_counter() >= c->cnthp_cval_el2)
+    return true;
+
+  now = sim_now_ns();
+
+  return sim_nic_irq(c, now);
+}
+
+/* acknowledge the highest priority pending interrupt: 1023 if none */
+static u32 sim_irq_ack(struct sim_cpu *c) {
+  u32 sgi = __atomic_load_n(&c->sgi_pending, __ATOMIC_ACQUIRE);
+  u64 now;
+
+  if(sgi) {
+    int id = __builtin_ctz(sgi);
+
+    __atomic_fetch_and(&c->sgi_pending, ~(1u << id), __ATOMIC_ACQ_REL);
+    return id;
+  }
+
+  if(sim_timer_armed(c) && sim_counter() >= c->cnthp_cval_el2)
+    return HYP_TIMER_IRQ;
+
+  now = sim_now_ns();
+
+  if(sim_nic_irq(c, now))
+    return SIM_NIC_IRQ;
+
+  return 1023;
+}
+
+/* take pending interrupts while irq is unmasked */
+static void sim_irq_take(struct sim_cpu *c) {
+  while(!c->irq_masked && sim_irq_pending(c)) {
+    c->irq_masked = true;
+
+    irq_entry(0);
+
+    c->irq_masked = false;
+  }
+}
+
+u64 sim_read_daif() {
+  return sim_mycpu()->irq_masked ? DAIF_I : 0;
+}
+
+void sim_write_daif(u64 val) {
+  struct sim_cpu *c = sim_mycpu();
+
+  c->irq_masked = !!(val & DAIF_I);
+
+  sim_irq_take(c);
+}
+
+void sim_irq_enable() {
+  struct sim_cpu *c = sim_mycpu();
+
+  c->irq_masked = false;
+
+  sim_irq_take(c);
+}
+
+void sim_irq_disable() {
+  sim_mycpu()->irq_masked = true;
+}
+
+bool sim_irq_enabled() {
+  return !sim_mycpu()->irq_masked;
+}
+
+/* guest executes an instruction: interrupt may be taken here */
+void sim_irq_point() {
+  sim_irq_take(sim_mycpu());
+}
+
+/* sleep until an interrupt is pending, even if irq is masked */
+void sim_wfi() {
+  struct sim_cpu *c = sim_mycpu();
+  unsigned int seq = __atomic_load_n(c->wake, __ATOMIC_ACQUIRE);
+  u64 now, deadline, next;
+
+  if(sim_irq_pending(c))
+    return;
+
+  now = sim_now_ns();
+  deadline = now + SIM_WFI_MAX_NS;
+
+  if(sim_timer_armed(c)) {
+    next = sim_counter_to_ns(c->cnthp_cval_el2) + 1;
+    if(next < deadline)
+      deadline = next;
+  }
+
+  if(c == &sim_cpus[0] && spi_enabled[SIM_NIC_IRQ]) {
+    next = sim_nic_next_event();
+    if(next && next < deadline)
+      deadline = next;
+  }
+
+  if(deadline > now)
+    sim_futex_wait(c->wake, seq, deadline - now);
+}
+
+/* nothing signals an event: take interrupts and let other cpus run */
+void sim_wfe() {
+  sim_irq_take(sim_mycpu());
+
+  sim_yield();
+}
+
+/* wake up @cpu from wfi */
+void sim_cpu_kick(int cpu) {
+  unsigned int *wake = sim_cpus[cpu].wake;
+
+  __atomic_fetch_add(wake, 1, __ATOMIC_RELEASE);
+  sim_futex_wake(wake);
+}
+
+static void sim_send_sgi(struct gic_sgi *sgi) {
+  for(int i = 0; i < sim_ncpus; i++) {
+    switch(sgi->mode) {
+      case SGI_ROUTE_TARGETS:
+        if(!(sgi->targets & (1u << i)))
+          continue;
+        break;
+      case SGI_ROUTE_BROADCAST:
+        if(i == cpuid())
+          continue;
+        break;
+      case SGI_ROUTE_SELF:
+        if(i != cpuid())
+          continue;
+        break;
+    }
+
+    __atomic_fetch_or(&sim_cpus[i].sgi_pending, 1u << sgi->sgi_id, __ATOMIC_RELEASE);
+    sim_cpu_kick(i);
+  }
+}
+
+static bool sim_irq_enabled_id(u32 irq) {
+  if(is_ppi(irq))
+    return !!(sim_mycpu()->ppi_enabled & (1u << (irq - 16)));
+
+  return irq < NIRQ && spi_enabled[irq];
+}
+
+static void sim_enable_irq(u32 irq) {
+  if(is_ppi(irq))
+    sim_mycpu()->ppi_enabled |= 1u << (irq - 16);
+  else if(irq < NIRQ)
+    spi_enabled[irq] = true;
+}
+
+static void sim_disable_irq(u32 irq) {
+  if(is_ppi(irq))
+    sim_mycpu()->ppi_enabled &= ~(1u << (irq - 16));
+  else if(irq < NIRQ)
+    spi_enabled[irq] = false;
+}
+
+static void sim_setup_irq(u32 irq) {
+  sim_enable_irq(irq);
+}
+
+static void sim_guest_eoi(u32 irq) {
+  panic("sim: no guest for irq %d", irq);
+}
+
+static void sim_irq_handler(int from_guest) {
+  u32 irq;
+
+  while((irq = sim_irq_ack(sim_mycpu())) != 1023) {
+    if(is_sgi(irq))
+      cpu_sgi_handler(irq);
+    else
+      handle_irq(irq);
+  }
+}
+
+static struct gic_irqchip sim_irqchip = {
+  .version            = 3,
+  .nirqs              = NIRQ,
+  .send_sgi           = sim_send_sgi,
+  .irq_enabled        = sim_irq_enabled_id,
+  .enable_irq         = sim_enable_irq,
+  .disable_irq        = sim_disable_irq,
+  .setup_irq          = sim_setup_irq,
+  .guest_eoi          = sim_guest_eoi,
+  .irq_handler        = sim_irq_handler,
+};
+
+/* @wake: futex words of @ncpus cpus */
+void sim_cpu_init(int ncpus, unsigned int *wake) {
+  if(ncpus > NCPU_MAX)
+    panic("sim: %d cpus", ncpus);
+
+  sim_ncpus = ncpus;
+
+  for(int i = 0; i < ncpus; i++) {
+    sim_cpus[i].wake = &wake[i];
+    sim_cpus[i].irq_masked = true;
+    pcpus[i].online = true;
+    pcpus[i].mpidr = i;
+  }
+
+  localnode.irqchip = &sim_irqchip;
+}
+
+/* current thread runs as @cpu: irq is masked as on reset */
+void sim_cpu_enter(int cpu) {
+  sim_cpuid = cpu;
+  sim_cpus[cpu].irq_masked = true;
+}
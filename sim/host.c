@@ -0,0 +1,140 @@
+/*
+ *  host services of the simulator: clock, futex, threads, console and memory
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+/*
+ *  page frames of a node: vmm translates a linear address to physical by
+ *  subtracting VIRT_BASE (0xc0000000), so the arena is placed above it and
+ *  aligned to 2MB as the page allocator hands out 2MB chunks
+ */
+#define SIM_ARENA_VA      0x1000000000ul
+
+static pthread_t threads[SIM_CPUS_MAX];
+static int nthreads;
+
+unsigned long sim_now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+/* @word is in memory shared between nodes: no FUTEX_PRIVATE_FLAG */
+void sim_futex_wait(unsigned int *word, unsigned int val, unsigned long timeout_ns) {
+  struct timespec ts = {
+    .tv_sec = timeout_ns / 1000000000ul,
+    .tv_nsec = timeout_ns % 1000000000ul,
+  };
+
+  syscall(SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+void sim_futex_wake(unsigned int *word) {
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void sim_yield() {
+  sched_yield();
+}
+
+void sim_console_write(int nodeid, const char *s, int len) {
+  char buf[320];
+  int n;
+
+  n = snprintf(buf, sizeof(buf), "node%d: %.*s", nodeid, len, s);
+  if(n > (int)sizeof(buf))
+    n = sizeof(buf);
+
+  /* a line at once: lines of nodes do not mix */
+  if(write(STDERR_FILENO, buf, n) < 0)
+    ;
+}
+
+void *sim_arena_map(unsigned long size) {
+  void *p;
+
+  p = mmap((void *)SIM_ARENA_VA, size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0);
+  if(p == MAP_FAILED || p != (void *)SIM_ARENA_VA) {
+    fprintf(stderr, "sim: cannot map arena at %#lx: %s\n", SIM_ARENA_VA, strerror(errno));
+    sim_abort();
+  }
+
+  return p;
+}
+
+struct thread_arg {
+  void (*fn)(int);
+  int arg;
+};
+
+static void *thread_main(void *p) {
+  struct thread_arg a = *(struct thread_arg *)p;
+
+  free(p);
+  a.fn(a.arg);
+
+  return NULL;
+}
+
+int sim_thread_start(void (*fn)(int), int arg) {
+  struct thread_arg *a;
+
+  if(nthreads == SIM_CPUS_MAX)
+    return -1;
+
+  a = malloc(sizeof(*a));
+  if(!a)
+    return -1;
+
+  a->fn = fn;
+  a->arg = arg;
+
+  if(pthread_create(&threads[nthreads], NULL, thread_main, a) != 0) {
+    free(a);
+    return -1;
+  }
+
+  nthreads++;
+
+  return 0;
+}
+
+void sim_thread_join_all() {
+  for(int i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  nthreads = 0;
+}
+
+/* a node failed: main process kills the others */
+void sim_abort() {
+  extern struct sim_shm *sim_shm;
+
+  if(sim_shm)
+    __atomic_store_n(&sim_shm->failed, 1, __ATOMIC_RELEASE);
+
+  _exit(1);
+}
+
+void sim_exit() {
+  _exit(0);
+}
@@ -0,0 +1,150 @@
+/*
+ *  include/aarch64.h for the host simulator
+ *
+ *  system registers, interrupt mask and barriers of a simulated pcpu
+ *  (sim/cpu.c).  force-included before any header of vmm, so the original
+ *  is skipped by its include guard.
+ */
+
+#ifndef CORE_AARCH64_H
+#define CORE_AARCH64_H
+
+#define SCTLR_M   (1 << 0)
+#define SCTLR_A   (1 << 1)
+#define SCTLR_C   (1 << 2)
+#define SCTLR_I   (1 << 12)
+
+#define SCR_NS    (1 << 0)
+#define SCR_SMD   (1 << 7)
+#define SCR_HCE   (1 << 8)
+#define SCR_RW    (1 << 10)
+
+#define SCR_RES1  ((1 << 4) | (1 << 5))
+
+#include "types.h"
+#include "compiler.h"
+
+/* registers of vmm known to the simulator */
+#define SIM_SYSREGS(X)    \
+  X(cntfrq_el0)           \
+  X(cntpct_el0)           \
+  X(cntvct_el0)           \
+  X(cntvoff_el2)          \
+  X(cnthp_ctl_el2)        \
+  X(cnthp_cval_el2)       \
+  X(daif)                 \
+  X(elr_el2)              \
+  X(esr_el2)              \
+  X(far_el2)              \
+  X(hpfar_el2)            \
+  X(id_aa64mmfr0_el1)     \
+  X(mair_el1)             \
+  X(mair_el2)             \
+  X(mpidr_el1)            \
+  X(par_el1)              \
+  X(tpidr_el2)            \
+  X(ttbr0_el1)            \
+  X(ttbr1_el1)
+
+#define SIM_SYSREG_DECLARE(reg)   \
+  u64 sim_read_##reg(void);       \
+  void sim_write_##reg(u64 val);
+
+SIM_SYSREGS(SIM_SYSREG_DECLARE)
+
+#define read_sysreg(reg)        sim_read_##reg()
+#define write_sysreg(reg, val)  sim_write_##reg((u64)(val))
+
+extern __thread int sim_cpuid;
+
+void sim_irq_enable(void);
+void sim_irq_disable(void);
+bool sim_irq_enabled(void);
+void sim_wfi(void);
+void sim_wfe(void);
+
+#define intr_enable()         sim_irq_enable()
+#define intr_disable()        sim_irq_disable()
+
+#define local_irq_enable()    sim_irq_enable()
+#define local_irq_disable()   sim_irq_disable()
+
+#define isb()     __atomic_signal_fence(__ATOMIC_SEQ_CST);
+#define dsb(ty)   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#define dmb(ty)   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+#define wfi()     sim_wfi();
+#define wfe()     sim_wfe();
+
+#define sev()     ;
+#define sevl()    ;
+
+#define HCR_VM            (1u << 0)
+#define HCR_SWIO          (1u << 1)
+#define HCR_PTW           (1u << 2)
+#define HCR_FMO           (1u << 3)
+#define HCR_IMO           (1u << 4)
+#define HCR_AMO           (1u << 5)
+#define HCR_TWI           (1u << 13)
+#define HCR_TWE           (1u << 14)
+#define HCR_TID3          (1u << 18)
+#define HCR_TSC           (1u << 19)
+#define HCR_TGE           (1u << 27)
+#define HCR_TDZ           (1u << 28)
+#define HCR_RW            (1u << 31)
+#define HCR_CD            (1ul << 32)
+#define HCR_ID            (1ul << 33)
+
+#define HPFAR_FIPA_MASK   0xffffffffffful
+
+#define MPIDR_AFFINITY_LEVEL0(m)    ((m) & 0xff)
+#define MPIDR_AFFINITY_LEVEL1(m)    (((m) >> 8) & 0xff)
+#define MPIDR_AFFINITY_LEVEL2(m)    (((m) >> 16) & 0xff)
+#define MPIDR_AFFINITY_LEVEL3(m)    (((m) >> 32) & 0xff)
+
+#define PSR_EL1H      (5)
+
+#define SPSR_EL(spsr) (((spsr) & 0xf) >> 2)
+
+#define __cacheline_aligned   __aligned(64)
+
+static inline int cpuid() {
+  return sim_cpuid;
+}
+
+#define PAR_ADDR(par)         ((par) & 0xfffffffff000)
+
+/* no stage 1 in the simulator: every translation faults */
+#define do_at_trans(addr, _at)   \
+  do { (void)(addr); sim_write_par_el1(1); } while(0)
+
+static inline bool local_irq_enabled() {
+  return sim_irq_enabled();
+}
+
+static inline bool local_irq_disabled() {
+  return !sim_irq_enabled();
+}
+
+static inline u64 r_sp() {
+  return (u64)__builtin_frame_address(0);
+}
+
+static inline u64 __irqsave() {
+  u64 flags = read_sysreg(daif);
+
+  local_irq_disable();
+
+  return flags;
+}
+
+static inline void __irqrestore(u64 flags) {
+  write_sysreg(daif, flags);
+}
+
+#define irqsave(flags)      do { flags = __irqsave(); } while(0)
+#define irqrestore(flags)   __irqrestore(flags)
+
+void trapinit(void);
+
+#endif  /* CORE_AARCH64_H */
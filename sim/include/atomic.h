@@ -0,0 +1,89 @@
+/*
+ *  include/atomic.h for the host simulator: same operations by
+ *  compiler builtins
+ */
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "types.h"
+#include "aarch64.h"
+
+static inline u32 atomic_fetch_add32(u32 *p, u32 v) {
+  return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+#define atomic_inc32(p)   atomic_fetch_add32(p, 1)
+#define atomic_dec32(p)   atomic_fetch_add32(p, -1)
+
+static inline u64 atomic_fetch_add64(u64 *p, u64 v) {
+  return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+/* store @new to *@p if *@p == @old: return true on success */
+static inline bool atomic_cmpxchg32(u32 *p, u32 old, u32 new) {
+  return __atomic_compare_exchange_n(p, &old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomic_cmpxchg64(u64 *p, u64 old, u64 new) {
+  return __atomic_compare_exchange_n(p, &old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/* store @new to *@p and return old value */
+static inline u64 atomic_xchg64(u64 *p, u64 new) {
+  return __atomic_exchange_n(p, new, __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomic_cmpxchg8(u8 *p, u8 old, u8 new) {
+  return __atomic_compare_exchange_n(p, &old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/* try once to store @v to *@p if it is 0: return 0 on success */
+static inline u8 atomic_trylock8(u8 *p, u8 v) {
+  u8 old = 0;
+
+  if(__atomic_compare_exchange_n(p, &old, v, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return 0;
+
+  return old;
+}
+
+/* wait in wfe while *@p & @busy, then store @v to *@p: return old value */
+static inline u8 atomic_lock8(u8 *p, u8 busy, u8 v) {
+  u8 old;
+
+  for(;;) {
+    old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    if(!(old & busy) &&
+       __atomic_compare_exchange_n(p, &old, v, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return old;
+
+    wfe();
+  }
+}
+
+static inline u16 atomic_lock16(u16 *p, u16 busy, u16 v) {
+  u16 old;
+
+  for(;;) {
+    old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    if(!(old & busy) &&
+       __atomic_compare_exchange_n(p, &old, v, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return old;
+
+    wfe();
+  }
+}
+
+/* store 0 to *@p with release semantics */
+static inline void atomic_release8(u8 *p) {
+  __atomic_store_n(p, 0, __ATOMIC_RELEASE);
+}
+
+static inline void atomic_release16(u16 *p) {
+  __atomic_store_n(p, 0, __ATOMIC_RELEASE);
+}
+
+#endif  /* ATOMIC_H */
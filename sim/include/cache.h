@@ -0,0 +1,33 @@
+/*
+ *  include/cache.h for the host simulator: caches of the host are coherent
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "types.h"
+#include "aarch64.h"
+
+static inline void dcache_flush_poc(void *va_start, void *va_end) {
+  dsb(sy);
+}
+
+static inline void cache_sync_pou(void *va_start, void *va_end) {
+  dsb(sy);
+}
+
+static inline void dcache_flush_poc_range(void *va, u64 size) {
+  void *end = va + size;
+  dcache_flush_poc(va, end);
+}
+
+static inline void cache_sync_pou_range(void *va, u64 size) {
+  void *end = va + size;
+  cache_sync_pou(va, end);
+}
+
+static inline void icache_flush_all_pou() {
+  dsb(ish);
+}
+
+#endif
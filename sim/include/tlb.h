@@ -0,0 +1,25 @@
+/*
+ *  include/tlb.h for the host simulator: every access walks stage 2 page
+ *  table (sim/node.c), so there is no tlb to flush
+ */
+
+#ifndef CORE_TLB_H
+#define CORE_TLB_H
+
+#include "aarch64.h"
+#include "mm.h"
+#include "compiler.h"
+
+static inline void tlb_vmm_flush_all() {
+  dsb(ish);
+}
+
+static inline void tlb_s2_flush_all() {
+  dsb(ish);
+}
+
+static inline void tlb_s2_flush_ipa(u64 __unused ipa) {
+  dsb(ish);
+}
+
+#endif  /* CORE_TLB_H */
@@ -0,0 +1,301 @@
+/*
+ *  pocsim: run the cluster protocol of vmm on the host
+ *
+ *  forks a process per node, runs the workload on every vcpu and reports
+ *  fault latency and the traffic it took.
+ */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+/* frames of a node besides guest memory: page table, msg buffers, ... */
+#define SIM_ARENA_EXTRA   (32ul << 20)
+#define SZ_2M             (2ul << 20)
+/* drift of the fastest counter: within what clock sync corrects */
+#define SIM_DRIFT_MAX_PPM 500
+
+static const char *workload_names[] = {
+  [SIM_WL_SEQ]            = "seq",
+  [SIM_WL_RANDOM]         = "random",
+  [SIM_WL_HOTSPOT]        = "hotspot",
+  [SIM_WL_MIGRATORY]      = "migratory",
+  [SIM_WL_FALSE_SHARING]  = "false",
+  [SIM_WL_TRACE]          = "trace",
+};
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -n nodes       number of nodes (1-%d, default 2)\n"
+          "  -c cpus        pcpus per node (1-%d, default 2)\n"
+          "  -m MB          guest memory of the cluster (default 64)\n"
+          "  -t nic|loop    transport (default nic)\n"
+          "  -l us          one way latency of nic (default 10)\n"
+          "  -b Mbit/s      bandwidth of a nic port, 0 = unlimited (default 1000)\n"
+          "  -p ppm         frame loss per million (default 0)\n"
+          "  -k us          counter of Node n is n * us ahead of Node0 (default 0)\n"
+          "  -r ppm         counter of Node n runs n * ppm fast, up to %d (default 0)\n"
+          "  -w workload    seq|random|hotspot|migratory|false|trace (default random)\n"
+          "  -f file        trace of -w trace\n"
+          "  -s MB          working set (default: guest memory)\n"
+          "  -a n           accesses per vcpu (default 100000)\n"
+          "  -W percent     writes of accesses (default 30)\n"
+          "  -S seed        seed of workload and loss (default 1)\n"
+          "  -T             dump stage 2 fault trace at exit (tools/vsmtrace.py)\n"
+          "  -M             dump msg statistics of every node at exit\n"
+          "  -C             report cluster statistics collected by Node0 at exit\n"
+          "  -v             print vmm log\n",
+          prog, SIM_NODES_MAX, SIM_CPUS_MAX, SIM_DRIFT_MAX_PPM);
+  exit(2);
+}
+
+static int parse_workload(const char *s) {
+  for(int i = 0; i < sizeof(workload_names) / sizeof(*workload_names); i++) {
+    if(strcmp(s, workload_names[i]) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+static unsigned long hist_percentile(unsigned long *hist, unsigned long total, int pct) {
+  unsigned long want = (total * pct + 99) / 100, n = 0;
+
+  for(int b = 0; b < SIM_HIST_BUCKETS; b++) {
+    n += hist[b];
+    if(n >= want && n)
+      return sim_hist_value(b);
+  }
+
+  return 0;
+}
+
+static void report(struct sim_shm *shm) {
+  struct sim_config *cfg = &shm->config;
+  unsigned long elapsed = shm->end_ns - shm->start_ns;
+  unsigned long accesses = 0, faults[3] = {0}, nfaults, lat_sum = 0, lat_max = 0;
+  unsigned long tx_frames = 0, tx_bytes = 0, drop_loss = 0, drop_full = 0;
+  unsigned long tx_type[SIM_MSGTYPES_MAX] = {0};
+  static unsigned long hist[SIM_HIST_BUCKETS];
+
+  for(int n = 0; n < cfg->nnodes; n++) {
+    struct sim_nic_stat *ns = &shm->nicstat[n];
+
+    for(int c = 0; c < cfg->ncpus; c++) {
+      struct sim_vcpu_stat *st = &shm->vstat[n][c];
+
+      accesses += st->accesses;
+      for(int i = 0; i < 3; i++)
+        faults[i] += st->faults[i];
+      lat_sum += st->lat_sum;
+      if(st->lat_max > lat_max)
+        lat_max = st->lat_max;
+      for(int b = 0; b < SIM_HIST_BUCKETS; b++)
+        hist[b] += st->hist[b];
+    }
+
+    tx_frames += ns->tx_frames;
+    tx_bytes += ns->tx_bytes;
+    drop_loss += ns->drop_loss;
+    drop_full += ns->drop_full;
+    for(int t = 0; t < SIM_MSGTYPES_MAX; t++)
+      tx_type[t] += ns->tx_type[t];
+  }
+
+  nfaults = faults[SIM_READ] + faults[SIM_WRITE] + faults[SIM_EXEC];
+
+  printf("\n%d nodes x %d cpus, %s, workload %s, %lu MB guest memory, %lu MB working set\n",
+         cfg->nnodes, cfg->ncpus, cfg->transport == SIM_TRANSPORT_NIC ? "nic" : "loopback",
+         workload_names[cfg->workload], cfg->guest_mem >> 20, cfg->wss >> 20);
+  if(cfg->transport == SIM_TRANSPORT_NIC)
+    printf("nic: latency %lu us, bandwidth %lu Mbit/s, loss %u ppm\n",
+           cfg->latency_ns / 1000, cfg->bandwidth * 8 / 1000000, cfg->loss_ppm);
+
+  printf("elapsed:    %.3f s\n", elapsed / 1e9);
+  printf("accesses:   %lu (%.0f /s)\n", accesses, accesses / (elapsed / 1e9));
+  printf("faults:     %lu (read %lu write %lu exec %lu), %.2f%% of accesses\n",
+         nfaults, faults[SIM_READ], faults[SIM_WRITE], faults[SIM_EXEC],
+         accesses ? 100.0 * nfaults / accesses : 0);
+
+  if(nfaults)
+    printf("latency:    avg %lu ns p50 %lu ns p99 %lu ns max %lu ns\n",
+           lat_sum / nfaults, hist_percentile(hist, nfaults, 50),
+           hist_percentile(hist, nfaults, 99), lat_max);
+
+  if(cfg->transport == SIM_TRANSPORT_NIC) {
+    printf("traffic:    %lu frames %lu bytes (%.1f MB/s)", tx_frames, tx_bytes,
+           tx_bytes / (elapsed / 1e9) / 1e6);
+    if(nfaults)
+      printf(", %.2f frames %lu bytes per fault", (double)tx_frames / nfaults,
+             tx_bytes / nfaults);
+    printf("\n");
+    printf("dropped:    %lu lost %lu rx ring full\n", drop_loss, drop_full);
+
+    printf("frames by msg:\n");
+    for(int t = 0; t < SIM_MSGTYPES_MAX; t++) {
+      if(tx_type[t])
+        printf("  %-20s %lu\n", sim_msg_name(t), tx_type[t]);
+    }
+  }
+
+  printf("per node:\n");
+  for(int n = 0; n < cfg->nnodes; n++) {
+    unsigned long a = 0, f = 0;
+
+    for(int c = 0; c < cfg->ncpus; c++) {
+      struct sim_vcpu_stat *st = &shm->vstat[n][c];
+
+      a += st->accesses;
+      f += st->faults[SIM_READ] + st->faults[SIM_WRITE] + st->faults[SIM_EXEC];
+    }
+
+    printf("  node%d: %lu accesses %lu faults", n, a, f);
+    if(cfg->transport == SIM_TRANSPORT_NIC)
+      printf(" tx %lu frames rx %lu frames", shm->nicstat[n].tx_frames,
+             shm->nicstat[n].rx_frames);
+    printf("\n");
+  }
+}
+
+int main(int argc, char **argv) {
+  struct sim_config cfg = {
+    .nnodes = 2,
+    .ncpus = 2,
+    .guest_mem = 64ul << 20,
+    .transport = SIM_TRANSPORT_NIC,
+    .latency_ns = 10000,
+    .bandwidth = 1000000000ul / 8,
+    .loss_ppm = 0,
+    .workload = SIM_WL_RANDOM,
+    .naccess = 100000,
+    .write_pct = 30,
+    .seed = 1,
+  };
+  const char *trace = NULL;
+  struct sim_shm *shm;
+  unsigned long shmsize;
+  pid_t pids[SIM_NODES_MAX];
+  int opt, failed = 0;
+
+  while((opt = getopt(argc, argv, "n:c:m:t:l:b:p:k:r:w:f:s:a:W:S:TMCvh")) != -1) {
+    switch(opt) {
+      case 'n': cfg.nnodes = atoi(optarg); break;
+      case 'c': cfg.ncpus = atoi(optarg); break;
+      case 'm': cfg.guest_mem = strtoul(optarg, NULL, 0) << 20; break;
+      case 't':
+        if(strcmp(optarg, "nic") == 0)
+          cfg.transport = SIM_TRANSPORT_NIC;
+        else if(strcmp(optarg, "loop") == 0 || strcmp(optarg, "loopback") == 0)
+          cfg.transport = SIM_TRANSPORT_LOOPBACK;
+        else
+          usage(argv[0]);
+        break;
+      case 'l': cfg.latency_ns = strtoul(optarg, NULL, 0) * 1000; break;
+      case 'b': cfg.bandwidth = strtoul(optarg, NULL, 0) * 1000000ul / 8; break;
+      case 'p': cfg.loss_ppm = strtoul(optarg, NULL, 0); break;
+      case 'k': cfg.clock_skew_ns = strtol(optarg, NULL, 0) * 1000; break;
+      case 'r': cfg.clock_drift_ppm = strtol(optarg, NULL, 0); break;
+      case 'w':
+        if((cfg.workload = parse_workload(optarg)) < 0)
+          usage(argv[0]);
+        break;
+      case 'f': trace = optarg; break;
+      case 's': cfg.wss = strtoul(optarg, NULL, 0) << 20; break;
+      case 'a': cfg.naccess = strtoul(optarg, NULL, 0); break;
+      case 'W': cfg.write_pct = atoi(optarg); break;
+      case 'S': cfg.seed = strtoul(optarg, NULL, 0); break;
+      case 'T': cfg.trace_dump = 1; break;
+      case 'M': cfg.msgstat_dump = 1; break;
+      case 'C': cfg.cluster_stat = 1; break;
+      case 'v': cfg.verbose = 1; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if(cfg.nnodes < 1 || cfg.nnodes > SIM_NODES_MAX || cfg.ncpus < 1 ||
+     cfg.ncpus > SIM_CPUS_MAX || cfg.write_pct > 100 || cfg.loss_ppm >= 1000000 ||
+     cfg.clock_drift_ppm * (cfg.nnodes - 1) > SIM_DRIFT_MAX_PPM ||
+     cfg.clock_drift_ppm * (cfg.nnodes - 1) < -SIM_DRIFT_MAX_PPM)
+    usage(argv[0]);
+
+  /* a node manages a 2MB aligned slice of guest memory */
+  if(cfg.guest_mem == 0 || cfg.guest_mem % (SZ_2M * cfg.nnodes) != 0) {
+    fprintf(stderr, "sim: guest memory must be a multiple of %d * 2MB\n", cfg.nnodes);
+    return 2;
+  }
+
+  if(cfg.wss == 0 || cfg.wss > cfg.guest_mem)
+    cfg.wss = cfg.guest_mem;
+
+  if(cfg.workload == SIM_WL_TRACE && !trace) {
+    fprintf(stderr, "sim: -w trace needs -f\n");
+    return 2;
+  }
+
+  /* vmm backs own slice of guest memory with page frames in the arena */
+  cfg.arena = cfg.guest_mem / cfg.nnodes + SIM_ARENA_EXTRA;
+  cfg.arena = (cfg.arena + SZ_2M - 1) & ~(SZ_2M - 1);
+
+  sim_workload_init(&cfg, trace);
+
+  shmsize = sizeof(struct sim_shm) + sim_loopback_size();
+  shm = mmap(NULL, shmsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(shm == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  shm->config = cfg;
+  shm->clock_base_ns = sim_now_ns();
+
+  fflush(stdout);
+
+  for(int n = 0; n < cfg.nnodes; n++) {
+    pids[n] = fork();
+    if(pids[n] < 0) {
+      perror("fork");
+      return 1;
+    }
+
+    if(pids[n] == 0)
+      sim_node_main(shm, n);
+  }
+
+  for(int i = 0; i < cfg.nnodes; i++) {
+    int status;
+    pid_t pid = wait(&status);
+
+    if(pid < 0)
+      break;
+
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+      continue;
+
+    if(!failed) {
+      fprintf(stderr, "sim: a node failed (status %#x)\n", status);
+
+      for(int n = 0; n < cfg.nnodes; n++) {
+        if(pids[n] != pid)
+          kill(pids[n], SIGKILL);
+      }
+    }
+
+    failed = 1;
+  }
+
+  if(failed || shm->failed)
+    return 1;
+
+  report(shm);
+
+  return 0;
+}
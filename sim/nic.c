@@ -0,0 +1,355 @@
+/*
+ *  simulated nic on shared memory
+ *
+ *  a frame leaves port after the frames sent before it (bandwidth of port)
+ *  and is delivered to rx ring of the destination after latency.  frames are
+ *  lost at random, and dropped if rx ring is full, as on a real nic.
+ *  rx irq goes to cpu0 when a frame in rx ring becomes deliverable.
+ */
+
+#include "types.h"
+#include "aarch64.h"
+#include "net.h"
+#include "ethernet.h"
+#include "msg.h"
+#include "irq.h"
+#include "spinlock.h"
+#include "allocpage.h"
+#include "lib.h"
+#include "log.h"
+#include "panic.h"
+#include "localnode.h"
+#include "sim-vmm.h"
+
+struct sim_nic {
+  struct sim_shm *shm;
+  int port;
+  int nports;
+  /* cpus of this node share tx side of my port */
+  spinlock_t tx_lock;
+  bool rx_irq;
+  /* first ring to poll: keep peers fair */
+  int rx_next;
+  u64 rand;
+  struct sim_nic_stat *stat;
+};
+
+static struct sim_nic sim_nic;
+
+/* 02:'s':'i':'m':00:<port> */
+void sim_nic_addr(u8 *mac, int nodeid) {
+  mac[0] = 0x02;
+  mac[1] = 's';
+  mac[2] = 'i';
+  mac[3] = 'm';
+  mac[4] = 0x00;
+  mac[5] = nodeid;
+}
+
+static int sim_nic_addr_port(struct sim_nic *nic, u8 *mac) {
+  u8 a[6];
+
+  sim_nic_addr(a, 0);
+
+  if(memcmp(a, mac, 5) != 0 || mac[5] >= nic->nports)
+    return -1;
+
+  return mac[5];
+}
+
+static bool sim_port_member(struct sim_port *p, u8 *group) {
+  for(int i = 0; i < p->ngroups && i < SIM_NIC_GROUPS_MAX; i++) {
+    if(memcmp(p->groups[i], group, 6) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+static inline struct sim_ring *rx_ring(struct sim_nic *nic, int src) {
+  return &nic->shm->ring[src][nic->port];
+}
+
+/* xorshift: per node, under tx_lock */
+static u32 sim_nic_rand(struct sim_nic *nic) {
+  u64 x = nic->rand;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  nic->rand = x;
+
+  return x;
+}
+
+static void sim_ring_put(struct sim_nic *nic, int dst, struct iobuf *buf, u64 deliver_at) {
+  struct sim_ring *r = &nic->shm->ring[nic->port][dst];
+  struct sim_frame *f;
+
+  if(r->tail - r->head == SIM_NIC_SLOTS) {
+    nic->stat->drop_full++;
+    return;
+  }
+
+  f = &r->slot[r->tail % SIM_NIC_SLOTS];
+
+  memcpy(f->data, buf->data, buf->len);
+  f->len = buf->len;
+
+  if(buf->body && buf->body_len)
+    memcpy(f->body, buf->body, buf->body_len);
+  f->body_len = buf->body ? buf->body_len : 0;
+  f->deliver_at = deliver_at;
+
+  /* publish slot before tail */
+  dmb(sy);
+  r->tail = r->tail + 1;
+
+  /* cpu0 of destination takes rx irq */
+  __atomic_fetch_add(&nic->shm->wake[dst][0], 1, __ATOMIC_RELEASE);
+  sim_futex_wake(&nic->shm->wake[dst][0]);
+}
+
+static void sim_nic_xmit(struct nic *dev, struct iobuf *buf) {
+  struct sim_nic *nic = dev->device;
+  struct sim_config *cfg = &nic->shm->config;
+  struct sim_port *me = &nic->shm->port[nic->port];
+  struct etherheader *eth = buf->data;
+  u32 bytes = buf->len + (buf->body ? buf->body_len : 0);
+  bool bcast = memcmp(eth->dst, bcast_mac, 6) == 0;
+  u8 mask;
+  bool group = msg_mcast_group(eth->dst, &mask);
+  int dst = sim_nic_addr_port(nic, eth->dst);
+  u64 now, deliver_at;
+  u64 flags;
+
+  if(buf->len > SIM_NIC_HDR_MAX || buf->body_len > SIM_PAGESIZE) {
+    vmm_warn("sim-nic: too large frame %d %d\n", buf->len, buf->body_len);
+    free_iobuf(buf);
+    return;
+  }
+
+  spin_lock_irqsave(&nic->tx_lock, flags);
+
+  /* a frame goes out after the frames queued before it */
+  now = sim_now_ns();
+  if(me->busy_until < now)
+    me->busy_until = now;
+  if(cfg->bandwidth)
+    me->busy_until += bytes * 1000000000ul / cfg->bandwidth;
+
+  deliver_at = me->busy_until + cfg->latency_ns;
+
+  nic->stat->tx_frames++;
+  nic->stat->tx_bytes += bytes;
+  if((eth->type >> 8) < SIM_MSGTYPES_MAX)
+    nic->stat->tx_type[eth->type >> 8]++;
+
+  if(cfg->loss_ppm && sim_nic_rand(nic) % 1000000 < cfg->loss_ppm) {
+    nic->stat->drop_loss++;
+    goto out;
+  }
+
+  for(int p = 0; p < nic->nports; p++) {
+    struct sim_port *port = &nic->shm->port[p];
+
+    if(p == nic->port || !port->up)
+      continue;
+
+    if(bcast || p == dst || (group && sim_port_member(port, eth->dst)))
+      sim_ring_put(nic, p, buf, deliver_at);
+  }
+
+out:
+  spin_unlock_irqrestore(&nic->tx_lock, flags);
+
+  /* copied: tx is completed */
+  free_iobuf(buf);
+}
+
+static int sim_nic_rx_room(struct nic *dev) {
+  struct sim_nic *nic = dev->device;
+  int room = 0;
+
+  for(int p = 0; p < nic->nports; p++) {
+    struct sim_ring *r = rx_ring(nic, p);
+
+    if(p != nic->port)
+      room += SIM_NIC_SLOTS - (r->tail - r->head);
+  }
+
+  return room;
+}
+
+static struct iobuf *sim_nic_rx_frame(struct sim_frame *f) {
+  struct iobuf *buf;
+
+  /* keep msg hdr 8 byte aligned as in rx buffer of nic */
+  buf = alloc_iobuf_headsize(2 + f->len, 2);
+  if(!buf)
+    return NULL;
+
+  memcpy(buf->data, f->data, f->len);
+
+  if(f->body_len) {
+    buf->body = alloc_page();
+    if(!buf->body) {
+      free_iobuf(buf);
+      return NULL;
+    }
+
+    memcpy(buf->body, f->body, f->body_len);
+    buf->body_len = f->body_len;
+  }
+
+  return buf;
+}
+
+/* called with poll_lock of net.c held */
+static int sim_nic_poll(struct nic *dev, int budget) {
+  struct sim_nic *nic = dev->device;
+  u64 now = sim_now_ns();
+  struct iobuf *buf;
+  int n = 0;
+
+  for(int i = 0; i < nic->nports && n < budget; i++) {
+    int p = (nic->rx_next + i) % nic->nports;
+    struct sim_ring *r = rx_ring(nic, p);
+    struct sim_frame *f;
+
+    if(p == nic->port)
+      continue;
+
+    while(n < budget && r->head != r->tail) {
+      /* read slot after tail */
+      dmb(sy);
+
+      f = &r->slot[r->head % SIM_NIC_SLOTS];
+      if(f->deliver_at > now)
+        break;
+
+      buf = sim_nic_rx_frame(f);
+
+      /* slot is free to be reused */
+      dmb(sy);
+      r->head = r->head + 1;
+      n++;
+
+      nic->stat->rx_frames++;
+
+      if(buf)
+        netdev_recv(buf);
+    }
+  }
+
+  nic->rx_next = (nic->rx_next + 1) % nic->nports;
+
+  /* busy polling cpu: let the peers filling rx rings run on the host */
+  if(n == 0)
+    sim_yield();
+
+  return n;
+}
+
+static void sim_nic_rx_irq_enable(struct nic *dev, bool enable) {
+  struct sim_nic *nic = dev->device;
+
+  nic->rx_irq = enable;
+}
+
+static int sim_nic_set_mcast_filter(struct nic *dev, u8 (*macs)[6], int n) {
+  struct sim_nic *nic = dev->device;
+  struct sim_port *port = &nic->shm->port[nic->port];
+
+  if(n > SIM_NIC_GROUPS_MAX)
+    return -1;
+
+  /* senders see the new groups after ngroups */
+  port->ngroups = 0;
+  dmb(sy);
+
+  memcpy(port->groups, macs, n * 6);
+
+  dmb(sy);
+  port->ngroups = n;
+
+  return 0;
+}
+
+static struct nic_ops sim_nic_ops = {
+  .xmit = sim_nic_xmit,
+  .rx_room = sim_nic_rx_room,
+  .poll = sim_nic_poll,
+  .rx_irq_enable = sim_nic_rx_irq_enable,
+  .set_mcast_filter = sim_nic_set_mcast_filter,
+};
+
+/* a frame of rx ring is deliverable at @now */
+bool sim_nic_irq_pending(u64 now) {
+  struct sim_nic *nic = &sim_nic;
+
+  if(!nic->rx_irq)
+    return false;
+
+  for(int p = 0; p < nic->nports; p++) {
+    struct sim_ring *r = rx_ring(nic, p);
+
+    if(p != nic->port && r->head != r->tail &&
+       r->slot[r->head % SIM_NIC_SLOTS].deliver_at <= now)
+      return true;
+  }
+
+  return false;
+}
+
+/* when the first frame in rx rings becomes deliverable: 0 if none */
+u64 sim_nic_next_event() {
+  struct sim_nic *nic = &sim_nic;
+  u64 next = 0, t;
+
+  if(!nic->rx_irq)
+    return 0;
+
+  for(int p = 0; p < nic->nports; p++) {
+    struct sim_ring *r = rx_ring(nic, p);
+
+    if(p == nic->port || r->head == r->tail)
+      continue;
+
+    t = r->slot[r->head % SIM_NIC_SLOTS].deliver_at;
+    if(!next || t < next)
+      next = t;
+  }
+
+  return next;
+}
+
+static void sim_nic_intr(void *arg) {
+  netdev_rx_irq();
+}
+
+void sim_nic_init(struct sim_shm *shm, int nodeid) {
+  struct sim_nic *nic = &sim_nic;
+  struct sim_port *port = &shm->port[nodeid];
+  u8 mac[6];
+
+  nic->shm = shm;
+  nic->port = nodeid;
+  nic->nports = shm->config.nnodes;
+  nic->stat = &shm->nicstat[nodeid];
+  nic->rand = shm->config.seed * 2654435761ul + nodeid + 1;
+  spinlock_init(&nic->tx_lock);
+
+  sim_nic_addr(mac, nodeid);
+  memcpy(port->mac, mac, 6);
+  port->ngroups = 0;
+  dmb(sy);
+  port->up = 1;
+
+  /* a full page of body per frame */
+  net_init("sim-nic", mac, ETH_POCV2_MSG_HDR_SIZE - sizeof(struct etherheader) + PAGESIZE,
+           nic, &sim_nic_ops);
+
+  irq_register(SIM_NIC_IRQ, sim_nic_intr, NULL);
+  sim_nic_rx_irq_enable(localnode.nic, true);
+}
@@ -0,0 +1,447 @@
+/*
+ *  a node of the simulator
+ *
+ *  boots the protocol part of vmm as main() does (page allocator, timer, msg,
+ *  transport, stage 2 page table, vsm) and runs a vcpu on every pcpu.  a vcpu
+ *  does not run a guest: it takes guest memory accesses from the workload and
+ *  calls the vsm fault handler when stage 2 does not permit the access, as
+ *  the abort handler of trap.c does.
+ *
+ *  the cluster is configured statically from sim_config instead of the node
+ *  discover protocol of core/node.c: node n manages n-th slice of guest memory.
+ */
+
+#include "types.h"
+#include "aarch64.h"
+#include "pcpu.h"
+#include "localnode.h"
+#include "node.h"
+#include "mm.h"
+#include "s2mm.h"
+#include "memory.h"
+#include "memlayout.h"
+#include "allocpage.h"
+#include "arch-timer.h"
+#include "msg.h"
+#include "msg-stat.h"
+#include "cluster-stat.h"
+#include "clocksync.h"
+#include "vsm.h"
+#include "vsm-trace.h"
+#include "transport.h"
+#include "loopback.h"
+#include "printf.h"
+#include "log.h"
+#include "panic.h"
+#include "lib.h"
+#include "sim-vmm.h"
+
+/* MSG_TRACE of sub-nodes on the wire before Node0 dumps */
+#define SIM_TRACE_SETTLE_NS   (20 * 1000 * 1000)
+
+struct localnode localnode;
+
+struct cluster_node cluster[NODE_MAX];
+int nr_cluster_nodes;
+int nr_cluster_vcpus;
+
+u64 node_online_map;
+u64 node_active_map;
+u64 node_running_vcpu_map;
+
+volatile int panicked_context;
+
+struct sim_shm *sim_shm;
+
+static int sim_nodeid;
+/* cpus of this node which set up */
+static unsigned int sim_cpus_up;
+
+/* console: a line at a time, only warnings unless verbose */
+static char conline[256];
+static int conlen;
+static bool console_force;
+
+void earlycon_putc(char c) {
+  /* printf puts '\r' before '\n' and '\0' after a string */
+  if(c == '\r' || c == '\0')
+    return;
+
+  if(conlen < sizeof(conline) - 1)
+    conline[conlen++] = c;
+
+  if(c != '\n')
+    return;
+
+  if(console_force || sim_shm->config.verbose ||
+     strncmp(conline, "[warning]", 9) == 0)
+    sim_console_write(sim_nodeid, conline, conlen);
+
+  conlen = 0;
+}
+
+void earlycon_puts(const char *s) {
+  while(*s)
+    earlycon_putc(*s++);
+}
+
+void uart_putc(char c) {
+  earlycon_putc(c);
+}
+
+/* no console input */
+void uart_flush() {
+  ;
+}
+
+void panic(const char *fmt, ...) {
+  va_list ap;
+
+  local_irq_disable();
+
+  panicked_context = 1;
+  console_force = true;
+
+  va_start(ap, fmt);
+
+  printf("!!!!!!vmm panic Node%d:cpu%d: ", local_nodeid(), cpuid());
+  vprintf(fmt, ap);
+  printf("\n");
+
+  va_end(ap);
+
+  sim_abort();
+}
+
+/* no guest: nothing to inject */
+void vgic_inject_pending_irqs() {
+  ;
+}
+
+int vgic_inject_virq(struct vcpu *vcpu, u32 intid) {
+  panic("sim: irq %d to guest", intid);
+}
+
+/* wake up every pcpu of the cluster */
+static void sim_kick_all() {
+  struct sim_config *cfg = &sim_shm->config;
+
+  for(int n = 0; n < cfg->nnodes; n++) {
+    for(int c = 0; c < cfg->ncpus; c++) {
+      __atomic_fetch_add(&sim_shm->wake[n][c], 1, __ATOMIC_RELEASE);
+      sim_futex_wake(&sim_shm->wake[n][c]);
+    }
+  }
+}
+
+/* wait for @cond with irq enabled: serve other nodes meanwhile */
+#define sim_wait_for(cond)          \
+  do {                              \
+    while(!(cond)) {                \
+      local_irq_disable();          \
+      if(!(cond))                   \
+        wfi();                      \
+      local_irq_enable();           \
+    }                               \
+  } while(0)
+
+static void sim_cluster_setup(struct sim_config *cfg) {
+  u64 per_node = cfg->guest_mem / cfg->nnodes;
+
+  if(per_node > MEM_PER_NODE)
+    panic("sim: %p byte per node > MEM_PER_NODE", per_node);
+
+  nr_cluster_nodes = cfg->nnodes;
+  nr_cluster_vcpus = cfg->nnodes * cfg->ncpus;
+
+  for(int i = 0; i < cfg->nnodes; i++) {
+    struct cluster_node *c = cluster_node(i);
+
+    c->nodeid = i;
+    c->mem.start = SIM_GUEST_BASE + per_node * i;
+    c->mem.size = per_node;
+    c->nvcpu = cfg->ncpus;
+    for(int v = 0; v < cfg->ncpus; v++)
+      c->vcpus[v] = i * cfg->ncpus + v;
+    c->rtt = 0;
+    c->spare = 0;
+
+    node_set_online(i, true);
+    node_set_active(i, true);
+  }
+
+  localnode.nodeid = sim_nodeid;
+  localnode.node = cluster_node(sim_nodeid);
+  localnode.acked = true;
+}
+
+static void sim_transport_init(struct sim_shm *shm) {
+  struct sim_config *cfg = &shm->config;
+
+  switch(cfg->transport) {
+    case SIM_TRANSPORT_NIC:
+      sim_nic_init(shm, sim_nodeid);
+      break;
+    case SIM_TRANSPORT_LOOPBACK:
+      loopback_init(shm->loopback, sim_nodeid);
+      break;
+  }
+
+  /* publish my address: cluster table of every node needs it */
+  memcpy(shm->port[sim_nodeid].mac, localnode.transport->addr, 6);
+  __atomic_fetch_add(&shm->nattached, 1, __ATOMIC_RELEASE);
+
+  while(__atomic_load_n(&shm->nattached, __ATOMIC_ACQUIRE) < cfg->nnodes)
+    sim_yield();
+
+  for(int i = 0; i < cfg->nnodes; i++)
+    memcpy(cluster_node(i)->mac, shm->port[i].mac, 6);
+}
+
+static const u8 sim_vtrace_acc[] = {
+  [SIM_READ]  = VTRACE_READ,
+  [SIM_WRITE] = VTRACE_WRITE,
+  [SIM_EXEC]  = VTRACE_EXEC,
+};
+
+/* guest memory access of @vcpuid: as the guest and the abort handler do */
+static void sim_access(int vcpuid, struct sim_vcpu_stat *st, struct sim_access *a) {
+  u64 page_ipa = PAGE_ADDRESS(a->ipa);
+  u64 *pte;
+  u64 start, lat;
+  void *p;
+
+  st->accesses++;
+
+  for(;;) {
+    if(a->acc == SIM_WRITE)
+      pte = s2_rwable_pte(page_ipa);
+    else
+      pte = s2_readable_pte(page_ipa);
+
+    if(pte) {
+      volatile u64 *v = P2V(PTE_PA(*pte) + (PAGE_OFFSET(a->ipa) & ~7ul));
+
+      if(a->acc == SIM_WRITE)
+        *v = *v + 1;
+      else
+        (void)*v;
+
+      return;
+    }
+
+    start = sim_now_ns();
+
+    vsm_trace_fault(vcpuid, page_ipa, sim_vtrace_acc[a->acc]);
+
+    switch(a->acc) {
+      case SIM_READ:
+        p = vsm_read_fetch_page(page_ipa);
+        break;
+      case SIM_WRITE:
+        p = vsm_write_fetch_page(page_ipa);
+        break;
+      case SIM_EXEC:
+        p = vsm_read_fetch_instr(page_ipa);
+        break;
+      default:
+        panic("sim: access %d", a->acc);
+    }
+
+    if(!p)
+      panic("sim: no memory at %p", a->ipa);
+
+    lat = sim_now_ns() - start;
+
+    st->faults[a->acc]++;
+    st->lat_sum += lat;
+    if(lat > st->lat_max)
+      st->lat_max = lat;
+    st->hist[sim_hist_bucket(lat)]++;
+
+    /* page may be taken away before the retry, as on a real guest */
+  }
+}
+
+static void sim_vcpu_run(int cpu) {
+  struct sim_config *cfg = &sim_shm->config;
+  struct sim_vcpu_stat *st = &sim_shm->vstat[sim_nodeid][cpu];
+  unsigned int total = cfg->nnodes * cfg->ncpus;
+  int vcpuid = cluster_me()->vcpus[cpu];
+  struct sim_access a;
+
+  local_irq_enable();
+
+  sim_wait_for(__atomic_load_n(&sim_shm->nready, __ATOMIC_ACQUIRE) == cfg->nnodes);
+
+  while(sim_workload_next(sim_nodeid, cpu, &a)) {
+    sim_access(vcpuid, st, &a);
+
+    /* guest instructions between accesses */
+    sim_irq_point();
+  }
+
+  if(__atomic_add_fetch(&sim_shm->ndone, 1, __ATOMIC_ACQ_REL) == total) {
+    sim_shm->end_ns = sim_now_ns();
+    sim_kick_all();
+  }
+
+  /* other vcpus may still fault on my pages */
+  sim_wait_for(__atomic_load_n(&sim_shm->ndone, __ATOMIC_ACQUIRE) == total);
+
+  local_irq_disable();
+}
+
+/* fault traces to console: Node0 prints records streamed from sub-nodes */
+static void sim_trace_dump(struct sim_config *cfg) {
+  u64 settle;
+
+  local_irq_enable();
+
+  if(sim_nodeid != 0) {
+    console_force = true;
+    vsm_trace_dump();
+    console_force = false;
+
+    __atomic_fetch_add(&sim_shm->ntraced, 1, __ATOMIC_RELEASE);
+
+    /* keep serving: MSG_TRACE may be retransmitted */
+    sim_wait_for(__atomic_load_n(&sim_shm->ntraced, __ATOMIC_ACQUIRE) == cfg->nnodes);
+  } else {
+    sim_wait_for(__atomic_load_n(&sim_shm->ntraced, __ATOMIC_ACQUIRE) == cfg->nnodes - 1);
+
+    settle = sim_now_ns() + SIM_TRACE_SETTLE_NS;
+    sim_wait_for(sim_now_ns() >= settle);
+
+    console_force = true;
+    vsm_trace_dump();
+    console_force = false;
+
+    __atomic_fetch_add(&sim_shm->ntraced, 1, __ATOMIC_RELEASE);
+  }
+
+  local_irq_disable();
+}
+
+/* Node0 collects statistics of every node over msg */
+static void sim_cluster_stat() {
+  local_irq_enable();
+
+  if(sim_nodeid == 0) {
+    console_force = true;
+    cluster_stat_collect();
+    sim_wait_for(!cluster_stat_busy());
+    console_force = false;
+
+    __atomic_store_n(&sim_shm->stat_done, 1, __ATOMIC_RELEASE);
+  } else {
+    sim_wait_for(__atomic_load_n(&sim_shm->stat_done, __ATOMIC_ACQUIRE));
+  }
+
+  local_irq_disable();
+}
+
+/* error of cluster time against the counter of Node0, which the sim knows */
+static void sim_clock_error() {
+  u64 ns = sim_now_ns();
+  i64 err = local_to_cluster(sim_node_counter(sim_nodeid, ns)) - sim_node_counter(0, ns);
+
+  console_force = true;
+  clocksync_dump();
+  if(sim_nodeid != 0)
+    printf("sim: Node%d cluster time error %d ns\n", sim_nodeid, err);
+  console_force = false;
+}
+
+static void sim_secondary(int cpu) {
+  sim_cpu_enter(cpu);
+
+  pcpu_init_core();
+  arch_timer_init_core();
+
+  __atomic_fetch_add(&sim_cpus_up, 1, __ATOMIC_RELEASE);
+
+  sim_vcpu_run(cpu);
+}
+
+void sim_node_main(struct sim_shm *shm, int nodeid) {
+  struct sim_config *cfg = &shm->config;
+  void *arena;
+
+  sim_shm = shm;
+  sim_nodeid = nodeid;
+
+  sim_cpu_init(cfg->ncpus, shm->wake[nodeid]);
+  sim_cpu_clock(nodeid, cfg->clock_skew_ns, cfg->clock_drift_ppm, shm->clock_base_ns);
+  sim_cpu_enter(0);
+
+  arena = sim_arena_map(cfg->arena);
+  system_memory_reg(V2P(arena), cfg->arena);
+  pageallocator_init();
+
+  sim_cluster_setup(cfg);
+
+  pcpu_init_core();
+  arch_timer_init();
+  arch_timer_init_core();
+
+  msg_sysinit();
+
+  sim_transport_init(shm);
+
+  s2mmu_init();
+  vsm_node_init(&cluster_me()->mem);
+
+  /* traces are recorded only to be dumped */
+  vsm_trace_enabled = cfg->trace_dump;
+
+  msg_mcast_join();
+
+  /* as subnode_cluster_init() does before the guest boots */
+  if(nodeid != 0)
+    clocksync_init();
+
+  for(int i = 1; i < cfg->ncpus; i++) {
+    if(sim_thread_start(sim_secondary, i) < 0)
+      panic("sim: cpu%d", i);
+  }
+
+  while(__atomic_load_n(&sim_cpus_up, __ATOMIC_ACQUIRE) < cfg->ncpus - 1)
+    sim_yield();
+
+  if(__atomic_add_fetch(&shm->nready, 1, __ATOMIC_ACQ_REL) == cfg->nnodes) {
+    shm->start_ns = sim_now_ns();
+    sim_kick_all();
+  }
+
+  sim_vcpu_run(0);
+
+  sim_thread_join_all();
+
+  if(cfg->trace_dump)
+    sim_trace_dump(cfg);
+
+  if(cfg->msgstat_dump) {
+    console_force = true;
+    msg_stat_dump();
+    console_force = false;
+  }
+
+  if(cfg->cluster_stat)
+    sim_cluster_stat();
+
+  if(cfg->clock_skew_ns || cfg->clock_drift_ppm)
+    sim_clock_error();
+
+  __atomic_fetch_add(&shm->nexit, 1, __ATOMIC_RELEASE);
+
+  sim_exit();
+}
+
+unsigned long sim_loopback_size() {
+  return LOOPBACK_SHM_SIZE;
+}
+
+const char *sim_msg_name(int type) {
+  return msg_type_name(type);
+}
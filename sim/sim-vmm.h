@@ -0,0 +1,27 @@
+/*
+ *  vmm side of the host simulator
+ */
+
+#ifndef SIM_VMM_H
+#define SIM_VMM_H
+
+#include "types.h"
+#include "sim.h"
+
+extern struct sim_shm *sim_shm;
+
+/* sim/cpu.c */
+void sim_cpu_init(int ncpus, unsigned int *wake);
+void sim_cpu_enter(int cpu);
+void sim_cpu_kick(int cpu);
+void sim_cpu_clock(int node, long skew_ns, long drift_ppm, u64 base_ns);
+u64 sim_node_counter(int node, u64 ns);
+void sim_irq_point(void);
+
+/* sim/nic.c */
+void sim_nic_init(struct sim_shm *shm, int nodeid);
+bool sim_nic_irq_pending(u64 now);
+u64 sim_nic_next_event(void);
+void sim_nic_addr(u8 *mac, int nodeid);
+
+#endif  /* SIM_VMM_H */
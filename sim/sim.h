@@ -0,0 +1,211 @@
+/*
+ *  host side multi-node simulator
+ *
+ *  every node runs in its own process with the protocol code of vmm
+ *  (core/msg.c, core/vsm.c, stage 2 page table, page allocator, ...) built
+ *  for the host; pcpus are threads.  guest memory accesses come from a
+ *  workload generator instead of a guest, and a fault on stage 2 calls the
+ *  vsm fault handler as the abort handler does.  nodes talk through a
+ *  simulated nic on shared memory with latency, bandwidth and loss.
+ *
+ *  this header is shared by both sides of the simulator:
+ *    vmm side (sim/cpu.c, sim/nic.c, sim/node.c): built against include/
+ *    host side (sim/main.c, sim/host.c, sim/workload.c): built against libc
+ *  so it uses plain C types only.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+/* copyset in stage 2 pte holds 4 nodes */
+#define SIM_NODES_MAX       4
+#define SIM_CPUS_MAX        8
+
+#define SIM_PAGESIZE        4096
+/* guest memory starts at */
+#define SIM_GUEST_BASE      0x40000000ul
+
+/* simulated nic */
+#define SIM_NIC_SLOTS       64
+#define SIM_NIC_HDR_MAX     128
+#define SIM_NIC_GROUPS_MAX  16
+#define SIM_NIC_IRQ         48
+
+/* frame counters per msg type */
+#define SIM_MSGTYPES_MAX    32
+
+/* fault latency histogram: 8 buckets per power of 2 of ns */
+#define SIM_HIST_SUB        8
+#define SIM_HIST_BUCKETS    (64 * SIM_HIST_SUB)
+
+static inline int sim_hist_bucket(unsigned long ns) {
+  int msb;
+
+  if(ns < SIM_HIST_SUB)
+    return ns;
+
+  msb = 63 - __builtin_clzl(ns);
+
+  return msb * SIM_HIST_SUB + ((ns >> (msb - 3)) & (SIM_HIST_SUB - 1));
+}
+
+/* lowest latency which falls into bucket @b */
+static inline unsigned long sim_hist_value(int b) {
+  int msb = b / SIM_HIST_SUB;
+
+  if(msb < 3)
+    return b;
+
+  return (unsigned long)(SIM_HIST_SUB + b % SIM_HIST_SUB) << (msb - 3);
+}
+
+enum sim_transport {
+  SIM_TRANSPORT_NIC,
+  SIM_TRANSPORT_LOOPBACK,
+};
+
+enum sim_workload {
+  SIM_WL_SEQ,
+  SIM_WL_RANDOM,
+  SIM_WL_HOTSPOT,
+  SIM_WL_MIGRATORY,
+  SIM_WL_FALSE_SHARING,
+  SIM_WL_TRACE,
+};
+
+enum sim_acc {
+  SIM_READ,
+  SIM_WRITE,
+  SIM_EXEC,
+};
+
+struct sim_config {
+  int nnodes;
+  int ncpus;                    /* pcpus (a vcpu each) per node */
+  unsigned long guest_mem;      /* in bytes, split between nodes */
+  unsigned long arena;          /* page frames of a node in bytes */
+
+  enum sim_transport transport;
+  unsigned long latency_ns;     /* one way */
+  unsigned long bandwidth;      /* bytes per second of a port, 0 = unlimited */
+  unsigned int loss_ppm;        /* frames dropped per million */
+  long clock_skew_ns;           /* counter of Node n is n * skew ahead */
+  long clock_drift_ppm;         /* and runs n * drift faster */
+
+  enum sim_workload workload;
+  unsigned long wss;            /* working set in bytes */
+  unsigned long naccess;        /* accesses per vcpu */
+  unsigned int write_pct;
+  unsigned long seed;
+
+  int verbose;
+  int trace_dump;               /* dump stage 2 fault trace at exit */
+  int msgstat_dump;             /* dump msg statistics at exit */
+  int cluster_stat;             /* Node0 reports cluster statistics at exit */
+};
+
+struct sim_frame {
+  unsigned long deliver_at;     /* in ns */
+  unsigned int len;
+  unsigned int body_len;
+  unsigned char data[SIM_NIC_HDR_MAX];
+  unsigned char body[SIM_PAGESIZE];
+};
+
+/* frames from one port to another: a producer and a consumer */
+struct sim_ring {
+  volatile unsigned int head;   /* written by consumer */
+  volatile unsigned int tail;   /* written by producer */
+  struct sim_frame slot[SIM_NIC_SLOTS];
+};
+
+struct sim_port {
+  volatile int up;
+  volatile int ngroups;
+  unsigned char mac[6];
+  unsigned char groups[SIM_NIC_GROUPS_MAX][6];
+  /* egress of port is busy until (in ns) */
+  unsigned long busy_until;
+};
+
+struct sim_nic_stat {
+  unsigned long tx_frames;
+  unsigned long tx_bytes;
+  unsigned long rx_frames;
+  unsigned long drop_loss;
+  unsigned long drop_full;
+  unsigned long tx_type[SIM_MSGTYPES_MAX];
+};
+
+struct sim_vcpu_stat {
+  unsigned long accesses;
+  unsigned long faults[3];      /* by enum sim_acc */
+  unsigned long lat_sum;        /* in ns */
+  unsigned long lat_max;
+  unsigned int hist[SIM_HIST_BUCKETS];
+};
+
+/* shared by all processes */
+struct sim_shm {
+  struct sim_config config;
+
+  volatile unsigned int failed;
+  /* nodes which published their address */
+  volatile unsigned int nattached;
+  /* nodes ready to run workload */
+  volatile unsigned int nready;
+  /* vcpus which finished workload */
+  volatile unsigned int ndone;
+  /* nodes which dumped fault trace */
+  volatile unsigned int ntraced;
+  /* Node0 printed cluster statistics */
+  volatile unsigned int stat_done;
+  /* nodes which stopped serving */
+  volatile unsigned int nexit;
+
+  unsigned long start_ns;
+  unsigned long end_ns;
+  /* counters of all nodes agree at */
+  unsigned long clock_base_ns;
+
+  /* futex of wfi of each pcpu */
+  unsigned int wake[SIM_NODES_MAX][SIM_CPUS_MAX];
+
+  struct sim_port port[SIM_NODES_MAX];
+  struct sim_nic_stat nicstat[SIM_NODES_MAX];
+  struct sim_vcpu_stat vstat[SIM_NODES_MAX][SIM_CPUS_MAX];
+
+  /* ring[src][dst] */
+  struct sim_ring ring[SIM_NODES_MAX][SIM_NODES_MAX];
+
+  /* region of loopback transport follows (sim_loopback_size()) */
+  unsigned char loopback[] __attribute__((aligned(4096)));
+};
+
+struct sim_access {
+  unsigned long ipa;
+  enum sim_acc acc;
+};
+
+/* host side: sim/host.c */
+unsigned long sim_now_ns(void);
+void sim_futex_wait(unsigned int *word, unsigned int val, unsigned long timeout_ns);
+void sim_futex_wake(unsigned int *word);
+void sim_yield(void);
+void sim_console_write(int nodeid, const char *s, int len);
+void *sim_arena_map(unsigned long size);
+int sim_thread_start(void (*fn)(int), int arg);
+void sim_thread_join_all(void);
+void sim_abort(void) __attribute__((noreturn));
+void sim_exit(void) __attribute__((noreturn));
+
+/* host side: sim/workload.c */
+void sim_workload_init(struct sim_config *cfg, const char *trace);
+int sim_workload_next(int nodeid, int cpu, struct sim_access *a);
+
+/* vmm side: sim/node.c */
+void sim_node_main(struct sim_shm *shm, int nodeid) __attribute__((noreturn));
+unsigned long sim_loopback_size(void);
+const char *sim_msg_name(int type);
+
+#endif  /* SIM_H */
@@ -0,0 +1,255 @@
+/*
+ *  guest memory access patterns of the simulator
+ *
+ *    seq:        every vcpu walks its own slice of the working set by 64 byte;
+ *                the slice is managed by the next node
+ *    random:     uniform over the working set
+ *    hotspot:    90% of accesses go to 10% of the working set
+ *    migratory:  a vcpu reads a page and then writes it (lock, counter, ...)
+ *    false:      vcpus write their own 64 bytes of a few shared pages
+ *    trace:      accesses recorded in a file, one per line:
+ *                  <node> <cpu> <ipa> <r|w|x>
+ *                or stage 2 faults recorded by vmm (tools/vsmtrace.py -o):
+ *                a fault of vcpu v on node n is replayed by cpu v % ncpus of
+ *                node n % nnodes, in order of time
+ *
+ *  loaded before nodes are forked, so every node sees the same workload.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define FALSE_SHARING_PAGES   4
+
+struct vcpu_wl {
+  unsigned long rand;
+  unsigned long n;
+  /* migratory: page read last time, written next */
+  unsigned long pending;
+  int has_pending;
+
+  /* trace */
+  struct sim_access *trace;
+  unsigned long ntrace;
+  unsigned long cap;
+};
+
+static struct sim_config *config;
+static struct vcpu_wl wl[SIM_NODES_MAX][SIM_CPUS_MAX];
+
+/* xorshift64* */
+static unsigned long wl_rand(struct vcpu_wl *w) {
+  unsigned long x = w->rand;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  w->rand = x;
+
+  return x * 0x2545f4914f6cdd1dul;
+}
+
+static enum sim_acc wl_rw(struct vcpu_wl *w) {
+  return wl_rand(w) % 100 < config->write_pct ? SIM_WRITE : SIM_READ;
+}
+
+static void trace_add(int node, int cpu, unsigned long ipa, enum sim_acc acc) {
+  struct vcpu_wl *w = &wl[node][cpu];
+
+  if(w->ntrace == w->cap) {
+    w->cap = w->cap ? w->cap * 2 : 1024;
+    w->trace = realloc(w->trace, w->cap * sizeof(*w->trace));
+    if(!w->trace) {
+      fprintf(stderr, "sim: trace: out of memory\n");
+      exit(1);
+    }
+  }
+
+  w->trace[w->ntrace].ipa = ipa;
+  w->trace[w->ntrace].acc = acc;
+  w->ntrace++;
+}
+
+/* binary trace of tools/vsmtrace.py: struct vsm_trace_rec of include/vsm-trace.h */
+#define VTRACE_MAGIC      "vsmtrace"
+#define VTRACE_VERSION    1
+#define VTRACE_ACC_MASK   0x3
+
+struct vtrace_hdr {
+  char magic[8];
+  unsigned int version;
+  unsigned int recsize;
+  unsigned long cntfrq;
+  unsigned long nrec;
+};
+
+struct vtrace_rec {
+  unsigned long ts;
+  unsigned int ipfn;
+  unsigned short vcpuid;
+  unsigned char nodeid;
+  unsigned char flags;
+};
+
+static void trace_load_bin(FILE *f, const char *path) {
+  static const enum sim_acc accs[] = { SIM_READ, SIM_WRITE, SIM_EXEC, SIM_READ };
+  struct vtrace_hdr hdr;
+  struct vtrace_rec rec;
+  unsigned long ipa, total = 0, skipped = 0;
+
+  if(fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.version != VTRACE_VERSION ||
+     hdr.recsize != sizeof(rec)) {
+    fprintf(stderr, "%s: unsupported trace\n", path);
+    exit(1);
+  }
+
+  for(unsigned long i = 0; i < hdr.nrec; i++) {
+    if(fread(&rec, sizeof(rec), 1, f) != 1) {
+      fprintf(stderr, "%s: truncated at record %lu\n", path, i);
+      exit(1);
+    }
+
+    ipa = (unsigned long)rec.ipfn * SIM_PAGESIZE;
+
+    /* layout of guest memory may differ from the recorded one */
+    if(ipa < SIM_GUEST_BASE || ipa >= SIM_GUEST_BASE + config->guest_mem) {
+      skipped++;
+      continue;
+    }
+
+    /* a fault on page table walk reads the table */
+    trace_add(rec.nodeid % config->nnodes, rec.vcpuid % config->ncpus, ipa,
+              accs[rec.flags & VTRACE_ACC_MASK]);
+    total++;
+  }
+
+  printf("trace: %lu faults from %s", total, path);
+  if(skipped)
+    printf(", %lu outside guest memory skipped", skipped);
+  printf("\n");
+}
+
+static void trace_load(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[256], rw;
+  unsigned long ipa, lineno = 0, total = 0;
+  int node, cpu;
+
+  if(!f) {
+    perror(path);
+    exit(1);
+  }
+
+  if(fread(line, 1, 8, f) == 8 && memcmp(line, VTRACE_MAGIC, 8) == 0) {
+    rewind(f);
+    trace_load_bin(f, path);
+    fclose(f);
+    return;
+  }
+
+  rewind(f);
+
+  while(fgets(line, sizeof(line), f)) {
+    lineno++;
+
+    if(line[0] == '#' || line[0] == '\n')
+      continue;
+
+    if(sscanf(line, "%d %d %li %c", &node, &cpu, &ipa, &rw) != 4 ||
+       node < 0 || node >= config->nnodes || cpu < 0 || cpu >= config->ncpus ||
+       ipa < SIM_GUEST_BASE || ipa >= SIM_GUEST_BASE + config->guest_mem ||
+       !strchr("rwx", rw)) {
+      fprintf(stderr, "%s:%lu: invalid access\n", path, lineno);
+      exit(1);
+    }
+
+    trace_add(node, cpu, ipa, rw == 'w' ? SIM_WRITE : rw == 'x' ? SIM_EXEC : SIM_READ);
+    total++;
+  }
+
+  fclose(f);
+
+  printf("trace: %lu accesses from %s\n", total, path);
+}
+
+void sim_workload_init(struct sim_config *cfg, const char *trace) {
+  config = cfg;
+
+  for(int n = 0; n < cfg->nnodes; n++) {
+    for(int c = 0; c < cfg->ncpus; c++) {
+      struct vcpu_wl *w = &wl[n][c];
+
+      memset(w, 0, sizeof(*w));
+      w->rand = (cfg->seed + 1) * 0x9e3779b97f4a7c15ul ^ ((n * SIM_CPUS_MAX + c + 1) << 20);
+    }
+  }
+
+  if(cfg->workload == SIM_WL_TRACE)
+    trace_load(trace);
+}
+
+/* next access of vcpu on @cpu of @nodeid: 0 when the workload is over */
+int sim_workload_next(int nodeid, int cpu, struct sim_access *a) {
+  struct vcpu_wl *w = &wl[nodeid][cpu];
+  int nvcpu = config->nnodes * config->ncpus;
+  int id = nodeid * config->ncpus + cpu;
+  unsigned long wss = config->wss;
+  unsigned long off, slice;
+
+  if(config->workload == SIM_WL_TRACE) {
+    if(w->n == w->ntrace)
+      return 0;
+
+    *a = w->trace[w->n++];
+    return 1;
+  }
+
+  if(w->n == config->naccess)
+    return 0;
+
+  w->n++;
+
+  switch(config->workload) {
+    case SIM_WL_SEQ:
+      slice = wss / nvcpu;
+      off = slice * ((id + config->ncpus) % nvcpu) + ((w->n - 1) * 64) % slice;
+      a->acc = wl_rw(w);
+      break;
+    case SIM_WL_RANDOM:
+      off = wl_rand(w) % wss;
+      a->acc = wl_rw(w);
+      break;
+    case SIM_WL_HOTSPOT:
+      if(wl_rand(w) % 100 < 90)
+        off = wl_rand(w) % (wss / 10);
+      else
+        off = wl_rand(w) % wss;
+      a->acc = wl_rw(w);
+      break;
+    case SIM_WL_MIGRATORY:
+      if(w->has_pending) {
+        off = w->pending;
+        a->acc = SIM_WRITE;
+        w->has_pending = 0;
+      } else {
+        off = wl_rand(w) % wss;
+        a->acc = SIM_READ;
+        w->pending = off;
+        w->has_pending = 1;
+      }
+      break;
+    case SIM_WL_FALSE_SHARING:
+      off = (wl_rand(w) % FALSE_SHARING_PAGES) * SIM_PAGESIZE + (id * 64) % SIM_PAGESIZE;
+      a->acc = wl_rw(w);
+      break;
+    default:
+      return 0;
+  }
+
+  a->ipa = SIM_GUEST_BASE + (off & ~7ul);
+
+  return 1;
+}
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+#
+#  decode vsm per-page statistics dumped by vsm_stat_dump() (core/vsm-stat.c)
+#
+#  usage: vsmstat.py [-m System.map] [-b kernel-load-ipa] [-r name:start:size]
+#                    [-n top] console.log [console.log ...]
+#
+#  each console log may contain snapshots of any node; records of all nodes
+#  are merged and pages are mapped back to guest kernel symbols and regions.
+#
+
+import argparse
+import bisect
+import struct
+import sys
+
+COUNTERS = ["rfault", "wfault", "ifault", "fetch_in", "fetch_out",
+            "inv_in", "inv_out", "lockwait"]
+
+# struct vsm_stat_record by snapshot version: counters are u64 since 2
+RECORDS = {
+    1: struct.Struct("<Q%dIB7x" % len(COUNTERS)),
+    2: struct.Struct("<Q%dQB7x" % len(COUNTERS)),
+}
+
+NO_OWNER = 0xff
+
+# guest memory layout used by main/node.c
+DEFAULT_REGIONS = [
+    ("kernel", 0x40200000, 0x07e00000),
+    ("initrd", 0x48000000, 0x05400000),
+    ("fdt",    0x4d400000, 0x00200000),
+]
+
+
+def parse_snapshots(path):
+    """yield (nodeid, ipa, counters, last_owner)"""
+    node = None
+    record = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            idx = line.find("vsmstat-")
+            if idx >= 0:
+                line = line[idx:]
+                w = line.split()
+                if w[0] == "vsmstat-begin":
+                    version, node, size = int(w[1]), int(w[2]), int(w[3])
+                    record = RECORDS.get(version)
+                    if record is None or size != record.size:
+                        sys.exit("%s: unsupported snapshot (version %d size %d)"
+                                 % (path, version, size))
+                elif w[0] == "vsmstat-end":
+                    node = None
+                continue
+
+            if node is None:
+                continue
+
+            try:
+                raw = bytes.fromhex(line)
+            except ValueError:
+                continue
+            if len(raw) != record.size:
+                continue
+
+            v = record.unpack(raw)
+            yield node, v[0], v[1:1 + len(COUNTERS)], v[-1]
+
+
+class Symbols:
+    def __init__(self, path, load_ipa):
+        self.addrs = []
+        self.names = []
+        text = None
+
+        entries = []
+        with open(path) as f:
+            for line in f:
+                w = line.split()
+                if len(w) < 3 or w[1] not in "tTdDrRbBsS":
+                    continue
+                addr = int(w[0], 16)
+                entries.append((addr, w[2]))
+                if w[2] == "_text":
+                    text = addr
+
+        if text is None:
+            sys.exit("%s: _text not found" % path)
+
+        entries.sort()
+        for addr, name in entries:
+            self.addrs.append(addr - text + load_ipa)
+            self.names.append(name)
+
+    def lookup(self, ipa):
+        i = bisect.bisect_right(self.addrs, ipa) - 1
+        if i < 0:
+            return None
+        return "%s+0x%x" % (self.names[i], ipa - self.addrs[i])
+
+
+def region_of(regions, ipa):
+    for name, start, size in regions:
+        if start <= ipa < start + size:
+            return name
+    return "ram"
+
+
+def main():
+    ap = argparse.ArgumentParser(description="decode vsm page statistics")
+    ap.add_argument("-m", "--system-map", help="guest kernel System.map")
+    ap.add_argument("-b", "--load-ipa", type=lambda x: int(x, 0), default=0x40200000,
+                    help="ipa the guest kernel image is loaded at")
+    ap.add_argument("-r", "--region", action="append", default=[],
+                    help="extra region name:start:size")
+    ap.add_argument("-n", "--top", type=int, default=32, help="show top n pages")
+    ap.add_argument("logs", nargs="+")
+    args = ap.parse_args()
+
+    regions = []
+    for r in args.region:
+        name, start, size = r.split(":")
+        regions.append((name, int(start, 0), int(size, 0)))
+    regions += DEFAULT_REGIONS
+
+    syms = Symbols(args.system_map, args.load_ipa) if args.system_map else None
+
+    pages = {}
+    owners = {}
+    for path in args.logs:
+        for node, ipa, counters, owner in parse_snapshots(path):
+            p = pages.setdefault(ipa, {})
+            p[node] = counters
+            if owner != NO_OWNER:
+                owners[ipa] = owner
+
+    def traffic(ipa):
+        return sum(c[0] + c[1] + c[2] + c[5] for c in pages[ipa].values())
+
+    print("%-18s %-8s %-32s %4s %s" % ("ipa", "region", "symbol", "own",
+                                     " ".join("%9s" % c for c in COUNTERS)))
+
+    for ipa in sorted(pages, key=traffic, reverse=True)[:args.top]:
+        sym = syms.lookup(ipa) if syms else None
+        owner = owners.get(ipa)
+        for node, c in sorted(pages[ipa].items()):
+            print("%#018x %-8s %-32s %4s %s  node%d" % (
+                ipa, region_of(regions, ipa), sym or "-",
+                "-" if owner is None else owner,
+                " ".join("%9d" % v for v in c), node))
+
+    # per region summary
+    summary = {}
+    for ipa, nodes in pages.items():
+        s = summary.setdefault(region_of(regions, ipa), [0] * len(COUNTERS))
+        for c in nodes.values():
+            for i, v in enumerate(c):
+                s[i] += v
+
+    print()
+    print("%-8s %s" % ("region", " ".join("%9s" % c for c in COUNTERS)))
+    for name, s in sorted(summary.items()):
+        print("%-8s %s" % (name, " ".join("%9d" % v for v in s)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+#
+#  convert stage 2 fault traces dumped by vsm_trace_dump() (core/vsm-trace.c)
+#  into a trace the simulator replays (sim/pocsim -w trace -f trace.bin)
+#
+#  usage: vsmtrace.py [-o trace.bin] [-t] [-s] console.log [console.log ...]
+#
+#  records of all nodes in all console logs are merged and sorted by time;
+#  timestamps are in the counter of Node0 (include/clocksync.h).
+#  the binary trace is a header followed by struct vsm_trace_rec:
+#
+#    "vsmtrace" u32 version u32 record size u64 counter frequency u64 nrecords
+#
+
+import argparse
+import struct
+import sys
+
+VERSION = 1
+
+# struct vsm_trace_rec
+RECORD = struct.Struct("<QIHBB")
+HEADER = struct.Struct("<8sIIQQ")
+MAGIC = b"vsmtrace"
+
+PAGESHIFT = 12
+
+READ, WRITE, EXEC = 0, 1, 2
+ACC_MASK = 0x3
+S1PTW = 1 << 2
+
+ACC_CHARS = "rwx"
+
+
+def parse_dumps(path):
+    """yield (records, cntfrq, dropped) of every dump in @path"""
+    recs = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            idx = line.find("vsmtrace-")
+            if idx >= 0:
+                w = line[idx:].split()
+                if w[0] == "vsmtrace-begin":
+                    version, size, freq = int(w[1]), int(w[3]), int(w[4])
+                    if version != VERSION or size != RECORD.size:
+                        sys.exit("%s: unsupported trace (version %d size %d)"
+                                 % (path, version, size))
+                    recs = []
+                elif w[0] == "vsmtrace-end" and recs is not None:
+                    if len(recs) != int(w[1]):
+                        print("%s: %d records dumped, %d decoded"
+                              % (path, int(w[1]), len(recs)), file=sys.stderr)
+                    yield recs, freq, int(w[2])
+                    recs = None
+                continue
+
+            if recs is None:
+                continue
+
+            # console may prefix lines ("node0: ...")
+            w = line.split()
+            if not w:
+                continue
+            try:
+                raw = bytes.fromhex(w[-1])
+            except ValueError:
+                continue
+            if len(raw) == 0 or len(raw) % RECORD.size != 0:
+                continue
+
+            recs.extend(RECORD.iter_unpack(raw))
+
+
+def main():
+    ap = argparse.ArgumentParser(description="convert vsm fault traces")
+    ap.add_argument("-o", "--output", help="write binary trace")
+    ap.add_argument("-t", "--text", action="store_true",
+                    help="print records as text (ts node vcpu ipa r|w|x [s1ptw])")
+    ap.add_argument("-s", "--summary", action="store_true", help="print summary")
+    ap.add_argument("logs", nargs="+")
+    args = ap.parse_args()
+
+    recs = []
+    freq = None
+    dropped = 0
+    for path in args.logs:
+        for r, f, d in parse_dumps(path):
+            if freq is not None and f != freq:
+                sys.exit("%s: counter frequency %d != %d" % (path, f, freq))
+            freq = f
+            recs += r
+            dropped += d
+
+    if freq is None:
+        sys.exit("no trace found")
+
+    # sort by time; ties keep order of dump, which is per cpu order
+    recs.sort(key=lambda r: r[0])
+
+    if dropped:
+        print("warning: %d records dropped by vmm" % dropped, file=sys.stderr)
+
+    if args.output:
+        with open(args.output, "wb") as f:
+            f.write(HEADER.pack(MAGIC, VERSION, RECORD.size, freq, len(recs)))
+            for r in recs:
+                f.write(RECORD.pack(*r))
+
+    if args.text:
+        start = recs[0][0] if recs else 0
+        for ts, ipfn, vcpuid, nodeid, flags in recs:
+            print("%12.6f %3d %3d %#012x %s%s" % (
+                (ts - start) / freq, nodeid, vcpuid, ipfn << PAGESHIFT,
+                ACC_CHARS[flags & ACC_MASK], " s1ptw" if flags & S1PTW else ""))
+
+    if args.summary or not (args.output or args.text):
+        nodes = {}
+        for ts, ipfn, vcpuid, nodeid, flags in recs:
+            n = nodes.setdefault(nodeid, [0, 0, 0, 0, set()])
+            n[flags & ACC_MASK] += 1
+            if flags & S1PTW:
+                n[3] += 1
+            n[4].add(ipfn)
+
+        span = (recs[-1][0] - recs[0][0]) / freq if recs else 0
+        print("%d records in %.3f s, %d dropped" % (len(recs), span, dropped))
+        print("%-6s %9s %9s %9s %9s %9s" % ("node", "read", "write", "exec",
+                                            "s1ptw", "pages"))
+        for nodeid, n in sorted(nodes.items()):
+            print("%-6d %9d %9d %9d %9d %9d" % (nodeid, n[0], n[1], n[2], n[3],
+                                                len(n[4])))
+
+
+if __name__ == "__main__":
+    main()